@@ -0,0 +1,217 @@
+#include "rengine.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+using namespace rengine;
+using namespace std;
+
+/*
+    Ticks N animations through AnimationManager and reports the cost per
+    animation per tick, as percentiles over all ticks, together with the
+    number of heap allocations per tick. No window or GL is needed.
+
+    The animations cycle through value types, keyframe counts, timing
+    functions and directions so that no single code path dominates. A
+    second set of runs does the same with from-to animations in
+    AnimationBatches.
+
+    Usage: ex_benchmark_animations [ticks]
+ */
+
+static unsigned long long allocations = 0;
+
+void *operator new(size_t size)
+{
+    ++allocations;
+    void *p = malloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    ++allocations;
+    void *p = malloc(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+
+struct Target
+{
+    double value;
+    vec2 position;
+    vec4 color;
+    mat4 matrix;
+};
+
+struct Target_setValue { void operator()(double v, Target *t) { t->value = v; } };
+struct Target_setPosition { void operator()(const vec2 &v, Target *t) { t->position = v; } };
+struct Target_setColor { void operator()(const vec4 &v, Target *t) { t->color = v; } };
+struct Target_setMatrix { void operator()(const mat4 &m, Target *t) { t->matrix = m; } };
+
+enum ValueType { Double, Vec2, Vec4, Mat4, ValueTypeCount };
+enum Timing { Linear, Ease, Steps, TimingCount };
+
+static const char *valueTypeNames[] = { "double", "vec2", "vec4", "mat4" };
+static const int keyFrameCounts[] = { 2, 5, 20 };
+static const int keyFrameCountCount = sizeof(keyFrameCounts) / sizeof(int);
+static const Animation::Direction directions[] = { Animation::Normal, Animation::Reverse, Animation::Alternate };
+static const int directionCount = sizeof(directions) / sizeof(Animation::Direction);
+
+static mat4 matrixAt(int i)
+{
+    return mat4::translate2D(i * 10, i * 5) * mat4::rotate2D(i * 0.3) * mat4::scale2D(1 + i * 0.1, 1);
+}
+
+class AnimationBenchmark
+{
+public:
+    AnimationBenchmark() {
+        for (int type=0; type<ValueTypeCount; ++type) {
+            for (int k=0; k<keyFrameCountCount; ++k) {
+                KeyFrames<Target> &kf = m_keyFrames[type][k];
+                const int count = keyFrameCounts[k];
+                for (int i=0; i<count; ++i)
+                    kf.times() << i / double(count - 1);
+                switch (type) {
+                case Double: {
+                    auto &values = kf.addValues<double, Target_setValue>();
+                    for (int i=0; i<count; ++i)
+                        values << i * 10;
+                    break; }
+                case Vec2: {
+                    auto &values = kf.addValues<vec2, Target_setPosition>();
+                    for (int i=0; i<count; ++i)
+                        values << vec2(i, i * 2);
+                    break; }
+                case Vec4: {
+                    auto &values = kf.addValues<vec4, Target_setColor>();
+                    for (int i=0; i<count; ++i)
+                        values << vec4(i % 2, 0.5, i * 0.05, 1);
+                    break; }
+                case Mat4: {
+                    auto &values = kf.addValues<mat4, Target_setMatrix>();
+                    for (int i=0; i<count; ++i)
+                        values << matrixAt(i);
+                    break; }
+                }
+            }
+        }
+    }
+
+    Animation *createAnimation(unsigned i, Target *target) {
+        const KeyFrames<Target> *kf = &m_keyFrames[i % ValueTypeCount][(i / ValueTypeCount) % keyFrameCountCount];
+        const unsigned variation = i / (ValueTypeCount * keyFrameCountCount);
+
+        Animation *a = 0;
+        switch (variation % TimingCount) {
+        case Linear: a = new SharedAnimationClosure<Target>(target, kf); break;
+        case Ease: a = new SharedAnimationClosure<Target, EaseTimingFunction>(target, kf); break;
+        case Steps: a = new SharedAnimationClosure<Target, StepsTimingFunction>(target, kf, 0, StepsTimingFunction(5)); break;
+        }
+        a->setDuration(0.5 + (i % 7) * 0.25);
+        a->setIterations(-1);
+        a->setDirection(directions[(variation / TimingCount) % directionCount]);
+        return a;
+    }
+
+    void addToBatches(unsigned i, Target *target, AnimationBatches *batches) {
+        const double duration = 0.5 + (i % 7) * 0.25;
+        const Animation::Direction direction = directions[(i / ValueTypeCount) % directionCount];
+        switch (i % ValueTypeCount) {
+        case Double:
+            batches->batch<double, Target, Target_setValue>()->add(target, 0, 10, 0, duration, -1, direction);
+            break;
+        case Vec2:
+            batches->batch<vec2, Target, Target_setPosition, EaseTimingFunction>()->add(target, vec2(0, 0), vec2(1, 2), 0, duration, -1, direction);
+            break;
+        case Vec4:
+            batches->batch<vec4, Target, Target_setColor>()->add(target, vec4(0, 0, 0, 1), vec4(1, 0.5, 0.25, 0), 0, duration, -1, direction);
+            break;
+        case Mat4:
+            batches->batch<mat4, Target, Target_setMatrix>()->add(target, matrixAt(0), matrixAt(1), 0, duration, -1, direction);
+            break;
+        }
+    }
+
+    void run(unsigned count, unsigned ticks, bool batched) {
+        std::vector<Target> targets(count);
+        std::vector<std::unique_ptr<Animation>> animations;
+
+        AnimationManager manager;
+        manager.start();
+        if (batched) {
+            for (unsigned i=0; i<count; ++i)
+                addToBatches(i, &targets[i], manager.batches());
+        } else {
+            animations.reserve(count);
+            for (unsigned i=0; i<count; ++i) {
+                animations.push_back(std::unique_ptr<Animation>(createAnimation(i, &targets[i])));
+                manager.startAnimation(animations.back().get());
+            }
+        }
+
+        // Let everything start and settle before measuring
+        for (int i=0; i<3; ++i)
+            manager.tick();
+
+        std::vector<double> samples;
+        samples.reserve(ticks);
+        const unsigned long long allocationsBefore = allocations;
+        for (unsigned i=0; i<ticks; ++i) {
+            time_point start = clock::now();
+            manager.tick();
+            time_point end = clock::now();
+            samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / count);
+        }
+        const double allocationsPerTick = (allocations - allocationsBefore) / double(ticks);
+
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples] (double p) {
+            return samples[std::min<size_t>(samples.size() - 1, size_t(p * samples.size()))];
+        };
+        printf("%10u  %-8s  %6u  %8.1f  %8.1f  %8.1f  %8.1f  %11.2f\n",
+               count, batched ? "batched" : "keyframe", ticks,
+               percentile(0.5), percentile(0.9), percentile(0.99), samples.back(),
+               allocationsPerTick);
+    }
+
+private:
+    KeyFrames<Target> m_keyFrames[ValueTypeCount][keyFrameCountCount];
+};
+
+int main(int argc, char **argv)
+{
+    const unsigned ticks = argc > 1 ? std::max(atoi(argv[1]), 1) : 0;
+
+    printf("Keyframe animations cycle through");
+    for (int i=0; i<ValueTypeCount; ++i)
+        printf(" %s", valueTypeNames[i]);
+    printf(" values with");
+    for (int i=0; i<keyFrameCountCount; ++i)
+        printf(" %d", keyFrameCounts[i]);
+    printf(" keyframes, linear, ease and steps timing and normal, reverse and alternate directions.\n\n");
+
+    printf("%10s  %-8s  %6s  %8s  %8s  %8s  %8s  %11s\n",
+           "animations", "kind", "ticks", "p50 ns", "p90 ns", "p99 ns", "max ns", "allocs/tick");
+
+    AnimationBenchmark benchmark;
+    const unsigned counts[] = { 10, 1000, 10000, 100000 };
+    for (bool batched : { false, true }) {
+        for (unsigned count : counts) {
+            // Keep the total work per run roughly constant unless told otherwise
+            unsigned n = ticks ? ticks : std::max(20u, std::min(1000u, 2000000u / count));
+            benchmark.run(count, n, batched);
+        }
+    }
+
+    return 0;
+}
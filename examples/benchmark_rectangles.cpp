@@ -6,9 +6,9 @@ class Rectangles : public StandardSurfaceInterface
 public:
     Node *update(Node *root) {
         if (root)
-            root->destroy();
+            m_recycler.recycle(root);
 
-        root = Node::create();
+        root = m_recycler.create<Node>();
 
         vec2 size = surface()->size();
 
@@ -26,7 +26,7 @@ public:
                        (rand() % 100)/100.0,
                        (rand() % 100)/100.0,
                        0.9);
-            RectangleNode *rect = RectangleNode::create();
+            RectangleNode *rect = m_recycler.create<RectangleNode>();
             rect->setGeometry(rect2d::fromXywh(rand() % w, rand() % h, rw, rh));
             rect->setColor(color);
             *root << rect;
@@ -36,6 +36,9 @@ public:
 
         return root;
     }
+
+private:
+    NodeRecycler m_recycler;
 };
 
 int main(int argc, char **argv) {
@@ -10,37 +10,81 @@ using namespace std;
 
 RENGINE_BEGIN_NAMESPACE
 
-inline Texture *rengine_loadImage(Renderer *renderer, const char *file)
+/*!
+    Reads a KTX file made with tools/ktxconvert into \a image, keeping it
+    compressed.
+ */
+inline bool rengine_decodeKTX(const std::string &location, DecodedImage *image)
 {
-    // read the image...
-    int w, h, n;
-    char location[1024];
-    sprintf(location, "../examples/images/%s", file);
-    unsigned char *data = stbi_load(location, &w, &h, &n, 4);
-    if (!data) {
-        sprintf(location, "examples/images/%s", file);
-        data = stbi_load(file, &w, &h, &n, 4);
+    FILE *f = fopen(location.c_str(), "rb");
+    if (!f)
+        return false;
+    std::vector<unsigned char> file;
+    unsigned char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        file.insert(file.end(), buffer, buffer + n);
+    fclose(f);
+
+    texturecompression::KTXImage ktx;
+    if (!texturecompression::parseKTX(file.data(), file.size(), &ktx))
+        return false;
+    image->pixels = (unsigned char *) malloc(ktx.size);
+    memcpy(image->pixels, ktx.data, ktx.size);
+    image->width = ktx.width;
+    image->height = ktx.height;
+    image->format = ktx.format;
+    image->freePixels = ::free;
+    return true;
+}
+
+/*!
+    Decodes an image from 'examples/images' for use with TextureLoader.
+    '.ktx' files are passed on compressed.
+ */
+inline bool rengine_decodeImage(const std::string &file, DecodedImage *image)
+{
+    const bool ktx = file.size() > 4 && file.compare(file.size() - 4, 4, ".ktx") == 0;
+    for (const char *dir : { "../examples/images/", "examples/images/" }) {
+        const std::string location = dir + file;
+        if (ktx) {
+            if (rengine_decodeKTX(location, image))
+                return true;
+            continue;
+        }
+        int n;
+        image->pixels = stbi_load(location.c_str(), &image->width, &image->height, &n, 4);
+        if (image->pixels) {
+            image->format = (n == 2 || n == 4) ? Texture::RGBA_32 : Texture::RGBx_32;
+            image->freePixels = stbi_image_free;
+            return true;
+        }
     }
-    if (!data) {
-        cout << "Failed to find the image 'walker.png' under 'examples/images' or '../examples/images'. "
-             << "We're a bit dumb, you see, and can't find images unless you've built directly in the "
-             << "source directory or in a direct subdirectory, like 'build' or 'debug'..." << endl;
+    cout << "Failed to find the image '" << file << "' under 'examples/images' or '../examples/images'. "
+         << "We're a bit dumb, you see, and can't find images unless you've built directly in the "
+         << "source directory or in a direct subdirectory, like 'build' or 'debug'..." << endl;
+    return false;
+}
+
+/*!
+    Loads an image synchronously. Prefer TextureLoader, which does this on
+    worker threads without stalling the frame.
+ */
+inline Texture *rengine_loadImage(Renderer *renderer, const char *file)
+{
+    DecodedImage image;
+    if (!rengine_decodeImage(file, &image))
         exit(1);
-    }
 
-    // Premultiply it...
-    for (int y=0; y<h; ++y)
-        for (int x=0; x<w; ++x) {
-            unsigned char *p = data + (y * w + x) * 4;
-            unsigned a = p[3];
-            p[0] = (unsigned(p[0]) * a) / 255;
-            p[1] = (unsigned(p[1]) * a) / 255;
-            p[2] = (unsigned(p[2]) * a) / 255;
-        }
+    Texture::Format format = image.format;
+    if (!(format & Texture::CompressedFormatMask)) {
+        pixels::premultiply(image.pixels, image.width * image.height);
+        format = Texture::RGBA_32;
+    }
 
-    Texture *layer = renderer->createTextureFromImageData(vec2(w,h), Texture::RGBA_32, data);
+    Texture *layer = renderer->createTextureFromImageData(vec2(image.width, image.height), format, image.pixels);
     assert(layer);
-    STBI_FREE(data);
+    image.freePixels(image.pixels);
     return layer;
 }
 
@@ -20,7 +20,9 @@ public:
 
         vec2 s = surface()->size();
 
-        m_layer = rengine_loadImage(renderer(), "walker.png");
+        // The cards are drawn without the image until it has been loaded
+        textureLoader()->setDecoder(rengine_decodeImage);
+        m_layer = textureLoader()->load("walker.png");
 
         // Root has origin in screen center
         TransformNode *root = TransformNode::create();
@@ -25,9 +25,16 @@
 
 /*!
 
-    This file is fully self-contained and can be deployed in other projects
-    with minimal additional dependencies. Just define RENGINE_BEGIN_NAMESPACE
-    and RENGINE_END_NAMESPACE before including it, and you should be good.
+    This file is included through rengine.h and relies on what it includes
+    before it:
+
+    - common/mathtypes.h for vec2, vec4 and mat4, which batches blend and
+      keyframes interpolate.
+    - common/simd.h for blending the float vector types in batches.
+    - common/transforminterpolation.h for DecomposedTransform, which
+      matrices are interpolated through.
+    - scenegraph/node.h for Node, as AnimationManager throttles animations
+      whose target nodes were not rendered.
 
  */
 
@@ -36,7 +43,9 @@
 
 #include <vector>
 #include <chrono>
-#include <list>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 RENGINE_BEGIN_NAMESPACE
 
@@ -60,6 +69,158 @@ public:
     double operator()(double t) const { return 3*t*t - 2*t*t*t; }
 };
 
+/*!
+    Timing function matching CSS' cubic-bezier(x1, y1, x2, y2).
+
+    The curve starts in (0, 0), ends in (1, 1) and is shaped by the two
+    control points. Evaluating it means solving x(s) = t for the curve
+    parameter s and returning y(s). To keep this cheap, x is sampled in a
+    small table when the function is created; evaluation picks the initial
+    guess from the table and refines it with a few Newton-Raphson steps,
+    falling back to bisection where the curve is too flat for Newton.
+
+    The default constructed function is CSS' 'ease'.
+ */
+class CubicBezierTimingFunction
+{
+public:
+    enum { SampleCount = 11 };
+
+    CubicBezierTimingFunction(double x1 = 0.25, double y1 = 0.1, double x2 = 0.25, double y2 = 1.0)
+    {
+        assert(x1 >= 0 && x1 <= 1);
+        assert(x2 >= 0 && x2 <= 1);
+
+        // Polynomial coefficients, with p0 = (0, 0) and p3 = (1, 1)
+        m_cx = 3 * x1;
+        m_bx = 3 * (x2 - x1) - m_cx;
+        m_ax = 1 - m_cx - m_bx;
+        m_cy = 3 * y1;
+        m_by = 3 * (y2 - y1) - m_cy;
+        m_ay = 1 - m_cy - m_by;
+        m_linear = x1 == y1 && x2 == y2;
+
+        for (int i=0; i<SampleCount; ++i)
+            m_samples[i] = sampleX(i * SampleStep);
+    }
+
+    double operator()(double t) const {
+        if (m_linear || t <= 0 || t >= 1)
+            return t;
+        return sampleY(solveX(t));
+    }
+
+    static CubicBezierTimingFunction ease() { return CubicBezierTimingFunction(0.25, 0.1, 0.25, 1.0); }
+    static CubicBezierTimingFunction easeIn() { return CubicBezierTimingFunction(0.42, 0.0, 1.0, 1.0); }
+    static CubicBezierTimingFunction easeOut() { return CubicBezierTimingFunction(0.0, 0.0, 0.58, 1.0); }
+    static CubicBezierTimingFunction easeInOut() { return CubicBezierTimingFunction(0.42, 0.0, 0.58, 1.0); }
+
+private:
+    static constexpr double SampleStep = 1.0 / (SampleCount - 1);
+
+    double sampleX(double s) const { return ((m_ax * s + m_bx) * s + m_cx) * s; }
+    double sampleY(double s) const { return ((m_ay * s + m_by) * s + m_cy) * s; }
+    double slopeX(double s) const { return (3 * m_ax * s + 2 * m_bx) * s + m_cx; }
+
+    double solveX(double x) const {
+        // Locate the sample interval and interpolate linearly within it
+        int i = 1;
+        while (i < SampleCount - 1 && m_samples[i] <= x)
+            ++i;
+        --i;
+        double lo = i * SampleStep;
+        double dist = (x - m_samples[i]) / (m_samples[i + 1] - m_samples[i]);
+        double s = lo + dist * SampleStep;
+
+        // Newton-Raphson converges in a couple of steps, except where the
+        // curve is nearly flat in x, so bisect within the sample interval
+        // when it does not.
+        if (slopeX(s) >= 0.001) {
+            for (int n=0; n<4; ++n) {
+                double dx = sampleX(s) - x;
+                if (std::abs(dx) < 1e-7)
+                    return s;
+                double slope = slopeX(s);
+                if (slope == 0)
+                    break;
+                s -= dx / slope;
+            }
+            if (std::abs(sampleX(s) - x) < 1e-7)
+                return s;
+        }
+
+        double hi = lo + SampleStep;
+        while (hi - lo > 1e-7) {
+            s = (lo + hi) * 0.5;
+            if (sampleX(s) > x)
+                hi = s;
+            else
+                lo = s;
+        }
+        return (lo + hi) * 0.5;
+    }
+
+    double m_ax, m_bx, m_cx;
+    double m_ay, m_by, m_cy;
+    double m_samples[SampleCount];
+    bool m_linear;
+};
+
+/*!
+    The CSS presets as distinct types, so they can be used directly as the
+    TimingFunction template argument, as in
+    AnimationClosure<OpacityNode, EaseInOutTimingFunction>.
+ */
+class EaseTimingFunction : public CubicBezierTimingFunction {
+public: EaseTimingFunction() : CubicBezierTimingFunction(0.25, 0.1, 0.25, 1.0) { }
+};
+class EaseInTimingFunction : public CubicBezierTimingFunction {
+public: EaseInTimingFunction() : CubicBezierTimingFunction(0.42, 0.0, 1.0, 1.0) { }
+};
+class EaseOutTimingFunction : public CubicBezierTimingFunction {
+public: EaseOutTimingFunction() : CubicBezierTimingFunction(0.0, 0.0, 0.58, 1.0) { }
+};
+class EaseInOutTimingFunction : public CubicBezierTimingFunction {
+public: EaseInOutTimingFunction() : CubicBezierTimingFunction(0.42, 0.0, 0.58, 1.0) { }
+};
+
+/*!
+    Timing function matching CSS' steps(n, start|end), which jumps between
+    \a n evenly spaced levels. With End, the first level is held from the
+    beginning and the last is reached at t=1; with Start, the first jump
+    happens right away.
+ */
+class StepsTimingFunction
+{
+public:
+    enum Position {
+        Start,
+        End
+    };
+
+    StepsTimingFunction(int steps = 1, Position position = End)
+        : m_steps(steps)
+        , m_position(position)
+    {
+        assert(steps > 0);
+    }
+
+    double operator()(double t) const {
+        int step = int(std::floor(t * m_steps));
+        if (m_position == Start)
+            ++step;
+        if (t >= 0 && step < 0)
+            step = 0;
+        if (t <= 1 && step > m_steps)
+            step = m_steps;
+        return step / double(m_steps);
+    }
+
+private:
+    int m_steps;
+    Position m_position;
+};
+
 /*!
 
     Defines an animation, greatly inspored by the HTML/CSS animation
@@ -97,6 +258,7 @@ public:
     Animation()
       : m_iterations(1)
       , m_duration(1)
+      , m_keyFrameCursor(1)
       , m_running(false)
       , m_direction(Normal)
     {
@@ -179,9 +341,85 @@ public:
     bool isRunning() const { return m_running; }
     void setRunning(bool r) { m_running = r; }
 
+    /*!
+        Returns the node this animation changes, or 0 if it is not tied to
+        one. AnimationManager uses this to throttle animations of nodes
+        which are not being drawn.
+
+        AnimationClosure and SharedAnimationClosure return their target if
+        it is a node, or whatever animationTargetNode() returns for it.
+     */
+    virtual const Node *targetNode() const { return 0; }
+
+    /*!
+        Returns the number of seconds AnimationManager waits before starting
+        this animation, on top of the delay passed to
+        AnimationManager::scheduleAnimation(). Until then, the animation is
+        scheduled rather than running, so it does not keep frames coming.
+
+        SharedAnimationClosure returns its startOffset.
+     */
+    virtual double startDelay() const { return 0; }
+
+    /*!
+        Maps \a t, the number of iterations since the start of an animation,
+        to the progress in the range [0, 1] within the current iteration,
+        taking \a direction into account. Once \a t has passed the last of
+        \a iterations, \a done is set and the progress of the final frame is
+        returned.
+     */
+    static double iterationProgress(double t, int iterations, Direction direction, bool *done) {
+        *done = iterations > 0 && t >= iterations;
+        int iteration;
+        double progress;
+        if (*done) {
+            iteration = iterations - 1;
+            progress = 1;
+        } else {
+            iteration = int(t);
+            progress = t - iteration;
+        }
+
+        switch (direction) {
+        case Normal: break;
+        case Reverse: progress = 1 - progress; break;
+        case Alternate: if (iteration & 1) progress = 1 - progress; break;
+        case AlternateReverse: if (!(iteration & 1)) progress = 1 - progress; break;
+        }
+        return progress;
+    }
+
 private:
+    /*!
+        Returns the first index, starting from 1, of a keyframe time which
+        is not before \a time, or the number of keyframes if there is none.
+
+        Time normally moves in small steps in one direction, so the segment
+        from the previous tick is checked first, then its neighbours, and
+        only on seeks do we fall back to a binary search.
+     */
+    size_t findKeyFrame(const std::vector<double> &kft, double time) {
+        const size_t size = kft.size();
+        size_t i = m_keyFrameCursor;
+        if (i < 1 || i > size)
+            i = 1;
+        for (int step=0; step<2; ++step) {
+            if (i < size && kft[i] < time)
+                ++i;                                    // moving forward
+            else if (i > 1 && kft[i - 1] >= time)
+                --i;                                    // moving backward
+            else
+                return m_keyFrameCursor = i;
+        }
+        if ((i == size || kft[i] >= time) && (i == 1 || kft[i - 1] < time))
+            return m_keyFrameCursor = i;
+        i = std::lower_bound(kft.begin() + 1, kft.end(), time) - kft.begin();
+        return m_keyFrameCursor = i;
+    }
+
     int m_iterations;
     double m_duration;
+    size_t m_keyFrameCursor;
 
     unsigned m_running : 1;
     unsigned m_direction : 2;
@@ -200,6 +438,54 @@ public:
     virtual size_t size() const = 0;
 };
 
+/*!
+    Returns the value at \a t between \a a and \a b, where \a t is in the
+    range [0, 1]. Overload this for value types which can't be interpolated
+    with + and *.
+ */
+template <typename ValueType>
+inline ValueType lerp(const ValueType &a, const ValueType &b, double t)
+{
+    return a + (b - a) * t;
+}
+
+/*!
+    Interpolates matrices by decomposing them, like CSS does. See
+    DecomposedTransform. Animations decompose their matrices once up front
+    instead, see InterpolationTraits.
+ */
+inline mat4 lerp(const mat4 &a, const mat4 &b, double t)
+{
+    return DecomposedTransform::interpolate(DecomposedTransform(a), DecomposedTransform(b), t);
+}
+
+/*!
+    Defines how keyframe and compositor animations store the values they
+    interpolate between. The default stores them as they are and
+    interpolates them with lerp().
+ */
+template <typename ValueType>
+struct InterpolationTraits
+{
+    typedef ValueType Stored;
+
+    static Stored store(const ValueType &value) { return value; }
+    static ValueType interpolate(const Stored &a, const Stored &b, double t) { return lerp(a, b, t); }
+};
+
+/*!
+    Matrices are stored decomposed, so they are decomposed once when the
+    animation is set up rather than on every tick.
+ */
+template <>
+struct InterpolationTraits<mat4>
+{
+    typedef DecomposedTransform Stored;
+
+    static Stored store(const mat4 &value) { return DecomposedTransform(value); }
+    static mat4 interpolate(const Stored &a, const Stored &b, double t) { return DecomposedTransform::interpolate(a, b, t); }
+};
+
 template <typename ValueType, typename Target, typename ApplyFunctor>
 class KeyFrameValues : public KeyFrameValuesBase<Target>
 {
@@ -211,15 +497,13 @@ public:
         assert(i1 < values.size());
         assert(t >= 0);
         assert(t <= 1);
-        const ValueType &v0 = values.at(i0);
-        const ValueType &v1 = values.at(i1);
-        applyFunctor(v0 + (v1 - v0) * t, target);
+        applyFunctor(Traits::interpolate(values[i0], values[i1], t), target);
     }
 
     /*!
         Add \a value to this keyframevalues set
      */
-    void append(const ValueType &value) { values.push_back(value); }
+    void append(const ValueType &value) { values.push_back(Traits::store(value)); }
 
     /*!
         Convenience overload to append() which allows for appending
@@ -230,8 +514,10 @@ public:
     size_t size() const { return values.size(); }
 
 private:
+    typedef InterpolationTraits<ValueType> Traits;
+
     ApplyFunctor applyFunctor;
-    std::vector<ValueType> values;
+    std::vector<typename Traits::Stored> values;
 };
 
 /*!
@@ -375,9 +661,7 @@ void Animation::tick(double time, Target *target, const KeyFrames<Target> *keyFr
     if (kft.front() > scaledTime) {
         i0 = i1 = 0;
     } else {
-        while (i1 < kft.size() && kft.at(i1) < scaledTime)
-            ++i1;
-        // if (kft.at(i1) > scaledTime) // common case
+        i1 = findKeyFrame(kft, scaledTime);
         if (i1 >= kft.size())
             i0 = i1 = kft.size() - 1;
         else
@@ -388,8 +672,8 @@ void Animation::tick(double time, Target *target, const KeyFrames<Target> *keyFr
 
     assert(i0 >= 0);
     assert(i1 < kft.size());
-    double t0 = kft.at(i0);
-    double t1 = kft.at(i1);
+    double t0 = kft[i0];
+    double t1 = kft[i1];
     double t = (i0 < i1) ? (scaledTime - t0) / (t1 - t0) : t1;
     double et = func(t);
 
@@ -403,7 +687,15 @@ void Animation::tick(double time, Target *target, const KeyFrames<Target> *keyFr
 }
 
 
-// ### TODO: do we need an AnimationClosure with for shared keyframes?
+
+/*!
+    Returns the node that changes when \a target is animated. Overload this
+    for custom target types which wrap a node so that their animations can
+    be throttled while the node is hidden, see
+    AnimationManager::setThrottleInterval().
+ */
+inline const Node *animationTargetNode(const Node *target) { return target; }
+inline const Node *animationTargetNode(const void *) { return 0; }
 
 template <typename Target, typename TimingFunction = LinearTimingFunction>
 class AnimationClosure : public Animation
@@ -419,95 +711,1182 @@ public:
         Animation::tick(t, target, &keyFrames, timingFunction);
     }
 
+    const Node *targetNode() const { return animationTargetNode(target); }
+
     Target *target;
     KeyFrames<Target> keyFrames;
     TimingFunction timingFunction;
 };
 
+/*!
+    An animation of a single target which uses keyframes owned elsewhere,
+    so that many animations can share one KeyFrames definition. Where each
+    AnimationClosure allocates its own keyframe times and value vectors, an
+    instance of this class is a fixed size object holding only a pointer to
+    the keyframes and its own playback state.
+
+    The \a startOffset delays the animation relative to when it is started,
+    which makes it easy to stagger the same animation over many targets.
+    AnimationManager schedules the animation that much later, see
+    startDelay(), and the target is left as it is until then.
+
+    \code
+    KeyFrames<OpacityNode> fadeIn;
+    fadeIn.times() << 0 << 1;
+    fadeIn.addValues<double, OpacityNode_setOpacity>() << 0 << 1;
+
+    std::vector<SharedAnimationClosure<OpacityNode>> fades;
+    fades.reserve(items.size());
+    for (unsigned i=0; i<items.size(); ++i)
+        fades.push_back(SharedAnimationClosure<OpacityNode>(items[i], &fadeIn, i * 0.02));
+    for (auto &fade : fades)
+        manager->startAnimation(&fade);
+    \endcode
+
+    The keyframes must not be changed or deleted while animations using them
+    are running.
+ */
+template <typename Target, typename TimingFunction = LinearTimingFunction>
+class SharedAnimationClosure : public Animation
+{
+public:
+    SharedAnimationClosure(Target *t = 0,
+                           const KeyFrames<Target> *kf = 0,
+                           double offset = 0,
+                           const TimingFunction &func = TimingFunction())
+        : target(t)
+        , keyFrames(kf)
+        , startOffset(offset)
+        , timingFunction(func)
+    {
+    }
+
+    void tick(double t) {
+        Animation::tick(t, target, keyFrames, timingFunction);
+    }
+
+    const Node *targetNode() const { return animationTargetNode(target); }
+    double startDelay() const { return startOffset; }
+
+    Target *target;
+    const KeyFrames<Target> *keyFrames;
+    double startOffset;
+    TimingFunction timingFunction;
+};
+
+/*!
+    Type-erased interface for AnimationBatch so batches of different value
+    types and appliers can be ticked together by AnimationBatches.
+ */
+class AnimationBatchBase
+{
+public:
+    virtual ~AnimationBatchBase() {}
+    virtual void tick(double time) = 0;
+    virtual unsigned size() const = 0;
+
+    /*!
+        Returns true if any animation in the batch had started as of the
+        last tick, or was added with a start time before it.
+     */
+    virtual bool animationsRunning() const = 0;
+
+    /*!
+        Returns the start time of the earliest animation which has not yet
+        started, or infinity if there is none.
+     */
+    virtual double nextStartTime() const = 0;
+
+protected:
+    friend class AnimationBatches;
+
+    // The time of the last tick
+    double m_lastTime = -std::numeric_limits<double>::infinity();
+};
+
+/*!
+    Defines how AnimationBatch stores and blends values of a given type. The
+    default stores the start value and the difference to the end value, and
+    works for any type which supports + and -, and * by a scalar. The float
+    vector types are blended with SIMD.
+ */
+template <typename ValueType>
+struct BatchValueTraits
+{
+    typedef ValueType From;
+    typedef ValueType Delta;
+
+    static From from(const ValueType &from) { return from; }
+    static Delta delta(const ValueType &from, const ValueType &to) { return to - from; }
+
+    static void blend(ValueType *out, const From *from, const Delta *delta, const float *t, unsigned count) {
+        for (unsigned i=0; i<count; ++i)
+            out[i] = from[i] + delta[i] * t[i];
+    }
+};
+
+template <>
+struct BatchValueTraits<vec2>
+{
+    static_assert(sizeof(vec2) == 2 * sizeof(float), "vec2 must be tightly packed");
+
+    typedef vec2 From;
+    typedef vec2 Delta;
+
+    static vec2 from(const vec2 &from) { return from; }
+    static vec2 delta(const vec2 &from, const vec2 &to) { return to - from; }
+
+    static void blend(vec2 *out, const vec2 *from, const vec2 *delta, const float *t, unsigned count) {
+        simd::blend(&out->x, &from->x, &delta->x, t, count, 2, 2);
+    }
+};
+
+template <>
+struct BatchValueTraits<vec4>
+{
+    static_assert(sizeof(vec4) == 4 * sizeof(float), "vec4 must be tightly packed");
+
+    typedef vec4 From;
+    typedef vec4 Delta;
+
+    static vec4 from(const vec4 &from) { return from; }
+    static vec4 delta(const vec4 &from, const vec4 &to) { return to - from; }
+
+    static void blend(vec4 *out, const vec4 *from, const vec4 *delta, const float *t, unsigned count) {
+        simd::blend(&out->x, &from->x, &delta->x, t, count, 4, 4);
+    }
+};
+
+/*!
+    Matrices are decomposed once when the animation is added and are then
+    interpolated like CSS does, see DecomposedTransform. The Delta holds the
+    decomposed end value.
+ */
+template <>
+struct BatchValueTraits<mat4>
+{
+    typedef DecomposedTransform From;
+    typedef DecomposedTransform Delta;
+
+    static From from(const mat4 &from) { return DecomposedTransform(from); }
+    static Delta delta(const mat4 &, const mat4 &to) { return DecomposedTransform(to); }
+
+    static void blend(mat4 *out, const From *from, const Delta *to, const float *t, unsigned count) {
+        for (unsigned i=0; i<count; ++i)
+            out[i] = DecomposedTransform::interpolate(from[i], to[i], t[i]);
+    }
+};
+
+/*!
+    Runs many simple from-to animations of the same value type and applier
+    in one go.
+
+    Where AnimationManager handles each Animation through virtual calls and
+    walks its KeyFrames, an AnimationBatch stores the state of all its
+    animations in contiguous arrays, one per field, and advances them in a
+    single loop with the applier and timing function inlined. The values
+    are blended for all animations at once, see BatchValueTraits. This is the
+    preferred way to run thousands of concurrent animations, such as fading
+    the items of a large list.
+
+    Each animation is identified by the handle returned from add(), which
+    stays valid until the animation finishes or is removed. Removal swaps
+    the last animation into the freed spot, so it is O(1). Like
+    AnimationManager's, handles carry a generation count, so a handle to an
+    animation which is gone never refers to a later one which reuses its
+    slot.
+
+    Times are in seconds, on the same clock as is passed to tick().
+ */
+template <typename ValueType,
+          typename Target,
+          typename ApplyFunctor,
+          typename TimingFunction = LinearTimingFunction>
+class AnimationBatch : public AnimationBatchBase
+{
+public:
+    /*!
+        The slot of the animation in the low 32 bits and the slot's
+        generation in the high 32 bits. 0 is never a valid handle.
+     */
+    typedef unsigned long long Handle;
+    enum { InvalidHandle = 0 };
+
+    /*!
+        Adds an animation of \a target from \a from to \a to, which starts
+        at \a startTime and runs \a iterations times for \a duration seconds
+        each. Use -1 for \a iterations to run forever.
+     */
+    Handle add(Target *target, const ValueType &from, const ValueType &to,
+               double startTime, double duration, int iterations = 1,
+               Animation::Direction direction = Animation::Normal) {
+        assert(target);
+        assert(duration > 0);
+        assert(iterations != 0);
+
+        unsigned slot;
+        if (!m_freeSlots.empty()) {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else {
+            slot = m_indexOf.size();
+            m_indexOf.push_back(0);
+            m_generations.push_back(1);
+        }
+        m_indexOf[slot] = m_targets.size();
+        const Handle handle = (Handle(m_generations[slot]) << 32) | slot;
+
+        m_handles.push_back(handle);
+        m_targets.push_back(target);
+        m_from.push_back(BatchValueTraits<ValueType>::from(from));
+        m_delta.push_back(BatchValueTraits<ValueType>::delta(from, to));
+        m_start.push_back(startTime);
+        m_rate.push_back(1.0 / duration);
+        m_iterations.push_back(iterations);
+        m_direction.push_back(direction);
+
+        if (startTime <= m_lastTime)
+            ++m_running;
+        else
+            m_nextStart = std::min(m_nextStart, startTime);
+        return handle;
+    }
+
+    /*!
+        Removes the animation identified by \a handle without applying any
+        more values to its target.
+     */
+    void remove(Handle handle) {
+        assert(isActive(handle));
+        const unsigned i = m_indexOf[slotOf(handle)];
+        if (m_start[i] <= m_lastTime && m_running > 0)
+            --m_running;
+        removeAt(i);
+    }
+
+    /*!
+        Returns true if \a handle refers to an animation in this batch which
+        has not yet finished.
+     */
+    bool isActive(Handle handle) const {
+        const unsigned slot = slotOf(handle);
+        return slot < m_indexOf.size()
+            && m_generations[slot] == unsigned(handle >> 32)
+            && m_indexOf[slot] < m_handles.size()
+            && m_handles[m_indexOf[slot]] == handle;
+    }
+
+    /*!
+        Advances all animations in the batch to \a time. Animations which
+        have not yet started are left alone; animations which reach their
+        end get their final value applied and are removed.
+     */
+    void tick(double time) override {
+        m_lastTime = time;
+        m_running = 0;
+        m_nextStart = std::numeric_limits<double>::infinity();
+
+        // First work out where each animation is at..
+        const unsigned count = m_targets.size();
+        m_progress.resize(count);
+        m_started.resize(count);
+        m_values.resize(count);
+        m_finished.clear();
+        for (unsigned i=0; i<count; ++i) {
+            double t = (time - m_start[i]) * m_rate[i];
+            if (t < 0) {
+                m_nextStart = std::min(m_nextStart, m_start[i]);
+                m_started[i] = false;
+                m_progress[i] = 0;
+                continue;
+            }
+
+            bool done;
+            double progress = Animation::iterationProgress(t, m_iterations[i], (Animation::Direction) m_direction[i], &done);
+            m_progress[i] = m_timingFunction(progress);
+            m_started[i] = true;
+            if (done)
+                m_finished.push_back(i);
+            else
+                ++m_running;
+        }
+
+        // .. then blend all the values in one go ..
+        BatchValueTraits<ValueType>::blend(m_values.data(), m_from.data(), m_delta.data(), m_progress.data(), count);
+
+        // .. and hand them to the targets.
+        for (unsigned i=0; i<count; ++i) {
+            if (m_started[i])
+                m_applyFunctor(m_values[i], m_targets[i]);
+        }
+
+        // Removing from the back keeps the remaining indices valid
+        for (unsigned i=m_finished.size(); i>0; --i)
+            removeAt(m_finished[i - 1]);
+    }
+
+    /*!
+        Returns the number of animations in this batch, including the ones
+        which have not yet started.
+     */
+    unsigned size() const override { return m_targets.size(); }
+
+    bool animationsRunning() const override { return m_running > 0; }
+    double nextStartTime() const override { return m_nextStart; }
+
+    /*!
+        Sets the timing function used for all animations in this batch.
+     */
+    void setTimingFunction(const TimingFunction &func) { m_timingFunction = func; }
+    const TimingFunction &timingFunction() const { return m_timingFunction; }
+
+private:
+    static unsigned slotOf(Handle handle) { return unsigned(handle & 0xffffffff); }
+
+    // Outstanding handles to the slot become inactive, as its generation
+    // changes.
+    void removeAt(unsigned i) {
+        const unsigned last = m_targets.size() - 1;
+        const unsigned slot = slotOf(m_handles[i]);
+        if (++m_generations[slot] == 0)
+            m_generations[slot] = 1;
+        m_freeSlots.push_back(slot);
+        if (i != last) {
+            m_handles[i] = m_handles[last];
+            m_targets[i] = m_targets[last];
+            m_from[i] = m_from[last];
+            m_delta[i] = m_delta[last];
+            m_start[i] = m_start[last];
+            m_rate[i] = m_rate[last];
+            m_iterations[i] = m_iterations[last];
+            m_direction[i] = m_direction[last];
+            m_indexOf[slotOf(m_handles[i])] = i;
+        }
+        m_handles.pop_back();
+        m_targets.pop_back();
+        m_from.pop_back();
+        m_delta.pop_back();
+        m_start.pop_back();
+        m_rate.pop_back();
+        m_iterations.pop_back();
+        m_direction.pop_back();
+    }
+
+    ApplyFunctor m_applyFunctor;
+    TimingFunction m_timingFunction;
+
+    double m_nextStart = std::numeric_limits<double>::infinity();
+    unsigned m_running = 0;
+
+    std::vector<Handle> m_handles;
+    std::vector<Target *> m_targets;
+    std::vector<typename BatchValueTraits<ValueType>::From> m_from;
+    std::vector<typename BatchValueTraits<ValueType>::Delta> m_delta;
+    std::vector<double> m_start;
+    std::vector<double> m_rate;         // 1 / duration
+    std::vector<int> m_iterations;
+    std::vector<unsigned char> m_direction;
+
+    std::vector<unsigned> m_indexOf;    // slot -> index
+    std::vector<unsigned> m_generations;
+    std::vector<unsigned> m_freeSlots;
+
+    // Scratch space for tick()
+    std::vector<float> m_progress;
+    std::vector<unsigned char> m_started;
+    std::vector<ValueType> m_values;
+    std::vector<unsigned> m_finished;
+};
+
+/*!
+    Owns one AnimationBatch per combination of value type, target, applier
+    and timing function and ticks them all.
+
+    \code
+    auto *fades = batches.batch<double, OpacityNode, OpacityNode_setOpacity>();
+    for (auto node : items)
+        fades->add(node, 0, 1, now, 0.3);
+    \endcode
+ */
+class AnimationBatches
+{
+public:
+    ~AnimationBatches() {
+        for (auto &entry : m_batches)
+            delete entry.batch;
+    }
+
+    /*!
+        Returns the batch for the given types, creating it if needed.
+     */
+    template <typename ValueType,
+              typename Target,
+              typename ApplyFunctor,
+              typename TimingFunction = LinearTimingFunction>
+    AnimationBatch<ValueType, Target, ApplyFunctor, TimingFunction> *batch() {
+        typedef AnimationBatch<ValueType, Target, ApplyFunctor, TimingFunction> Batch;
+        const void *key = typeKey<Batch>();
+        for (auto &entry : m_batches) {
+            if (entry.key == key)
+                return static_cast<Batch *>(entry.batch);
+        }
+        Entry entry = { key, new Batch() };
+        entry.batch->m_lastTime = m_lastTime;
+        m_batches.push_back(entry);
+        return static_cast<Batch *>(entry.batch);
+    }
+
+    void tick(double time) {
+        m_lastTime = time;
+        for (auto &entry : m_batches)
+            entry.batch->tick(time);
+    }
+
+    bool animationsRunning() const {
+        for (auto &entry : m_batches) {
+            if (entry.batch->animationsRunning())
+                return true;
+        }
+        return false;
+    }
+
+    double nextStartTime() const {
+        double t = std::numeric_limits<double>::infinity();
+        for (auto &entry : m_batches)
+            t = std::min(t, entry.batch->nextStartTime());
+        return t;
+    }
+
+    /*!
+        Returns the total number of animations in all batches.
+     */
+    unsigned size() const {
+        unsigned count = 0;
+        for (auto &entry : m_batches)
+            count += entry.batch->size();
+        return count;
+    }
+
+private:
+    // A unique address per type, without relying on RTTI.
+    template <typename T>
+    static const void *typeKey() {
+        static const char key = 0;
+        return &key;
+    }
+
+    struct Entry {
+        const void *key;
+        AnimationBatchBase *batch;
+    };
+    std::vector<Entry> m_batches;
+    double m_lastTime = -std::numeric_limits<double>::infinity();
+};
+
 typedef std::chrono::steady_clock clock;
 typedef std::chrono::steady_clock::time_point time_point;
 
-class AnimationManager
+/*!
+    Keeps track of when frames reach the screen and predicts when the next
+    one will, so animations can be advanced to the time they will actually
+    be seen at.
+
+    The frame interval is estimated from the presentation timestamps passed
+    to framePresented() using an exponential moving average, so it follows
+    displays with variable refresh rates. An interval which is close to a
+    whole multiple of the estimate is counted as dropped frames rather than
+    a change in rate, until it has happened several frames in a row. Gaps
+    longer than MaxFrameGap intervals, such as when the application has been
+    idle, are ignored.
+
+    The deviation of each interval from the estimate is reported as jitter.
+ */
+class FramePacer
 {
 public:
+    enum {
+        MaxFrameGap = 8,
+        RateChangeFrames = 4
+    };
+
+    FramePacer()
+        : m_interval(0)
+        , m_variance(0)
+        , m_maxJitter(0)
+        , m_frames(0)
+        , m_droppedFrames(0)
+        , m_slowFrames(0)
+    {
+    }
 
     /*!
-        Advances the clock forward based on current time.
+        Records that a frame was presented at \a when. Backends which know
+        the actual presentation time should pass it on; otherwise the time
+        right after the swap is a fair approximation.
+     */
+    void framePresented(time_point when) {
+        if (m_frames > 0 && when > m_last) {
+            double dt = std::chrono::duration<double>(when - m_last).count();
+            if (m_interval == 0) {
+                m_interval = dt;
+            } else {
+                double frames = std::round(dt / m_interval);
+                bool multiple = frames >= 2 && std::abs(dt - frames * m_interval) < m_interval * 0.2;
+                if (frames > MaxFrameGap) {
+                    // Idle, not a frame interval
+                } else if (multiple && ++m_slowFrames < RateChangeFrames) {
+                    m_droppedFrames += unsigned(frames) - 1;
+                    sample(dt / frames);
+                } else if (multiple) {
+                    // Consistently slower, the display rate has changed
+                    m_interval = dt;
+                    m_variance = 0;
+                    m_slowFrames = 0;
+                } else {
+                    m_slowFrames = 0;
+                    sample(dt);
+                }
+            }
+        }
+        m_last = when;
+        ++m_frames;
+    }
 
-        The setup here is 'controlled' and we're guaranteed to tick in line
-        with vsync without any significant drift, so we don't bother with
-        predictive/fixed time increments for now. We can always add that
-        later...
+    /*!
+        Returns the predicted presentation time of the next frame, given
+        that it is now \a now. Returns \a now if there is not enough data
+        to make a prediction.
+     */
+    time_point nextPresentation(time_point now) const {
+        if (m_frames == 0 || m_interval <= 0)
+            return now;
+        const std::chrono::duration<double> interval(m_interval);
+        time_point next = m_last + std::chrono::duration_cast<clock::duration>(interval);
+        if (next < now) {
+            // Missed one or more; align with the display's phase again.
+            double frames = std::ceil(std::chrono::duration<double>(now - m_last).count() / m_interval);
+            next = m_last + std::chrono::duration_cast<clock::duration>(interval * frames);
+        }
+        return next;
+    }
+
+    /*!
+        Returns the estimated frame interval in seconds, or 0 if not enough
+        frames have been presented yet.
+     */
+    double frameInterval() const { return m_interval; }
+
+    /*!
+        Returns the standard deviation of the frame interval, in seconds.
+     */
+    double jitter() const { return std::sqrt(m_variance); }
+
+    /*!
+        Returns the largest deviation from the estimated frame interval
+        seen since the last call to resetStatistics(), in seconds.
+     */
+    double maxJitter() const { return m_maxJitter; }
+
+    unsigned framesPresented() const { return m_frames; }
+    unsigned droppedFrames() const { return m_droppedFrames; }
+
+    void resetStatistics() {
+        m_maxJitter = 0;
+        m_droppedFrames = 0;
+    }
+
+private:
+    void sample(double dt) {
+        const double smoothing = 0.1;
+        double deviation = dt - m_interval;
+        m_interval += deviation * smoothing;
+        m_variance = (1 - smoothing) * m_variance + smoothing * deviation * deviation;
+        m_maxJitter = std::max(m_maxJitter, std::abs(deviation));
+    }
+
+    time_point m_last;
+    double m_interval;
+    double m_variance;
+    double m_maxJitter;
+    unsigned m_frames;
+    unsigned m_droppedFrames;
+    unsigned m_slowFrames;
+};
+
+/*!
+    Runs animations on a common clock, see tick().
+
+    startAnimation() and scheduleAnimation() return a handle which can be
+    used to cancel(), pause(), resume() or seek() the animation while it is
+    in progress. A handle becomes invalid when its animation finishes or is
+    cancelled, after which the calls are ignored and return false, so a
+    handle can safely be kept around after the animation is gone.
+
+    The animations are owned by the application. An animation which has
+    finished or been cancelled is no longer running and can be started
+    again, so an item which restarts its animation on every hover change
+    can keep a single animation and its handle:
+
+    \code
+    void hoverChanged(bool hovered) {
+        manager->cancel(m_hoverHandle);
+        m_hoverHandle = manager->startAnimation(hovered ? &m_hoverIn : &m_hoverOut);
+    }
+    \endcode
+
+    The bookkeeping for each animation is kept in a table of slots which
+    are reused once an animation is done, so starting and cancelling
+    animations does not allocate once the table has grown to fit the
+    number of animations in progress.
+ */
+class AnimationManager
+{
+public:
+    /*!
+        Identifies an animation started on this manager. 0 is never a valid
+        handle.
+     */
+    typedef unsigned long long Handle;
+
+    enum State {
+        Stopped,        // finished, cancelled or never started
+        Scheduled,
+        Running,
+        Paused
+    };
+
+    /*!
+        Advances the animations to the time the frame being rendered is
+        predicted to reach the screen, based on the presentation times
+        passed to framePresented(). Without those, the current time is
+        used.
      */
     void tick() {
-        // alternatively:
-        // time_point now = clock::now();
-        time_point now = m_nextTick;
-        m_nextTick += std::chrono::milliseconds(16);
+        time_point now = m_pacer.nextPresentation(clock::now());
+        if (now < m_currentTick)
+            now = m_currentTick;
+        m_currentTick = now;
 
         // Start pending animations if we've passed beyond its starting point.
-        // ### TODO: these should probably be sorted so animations start in the right order
-        auto si = m_scheduledAnimations.begin();
-        while (si != m_scheduledAnimations.end()) {
-            assert(!si->animation->isRunning());
-            if (si->when < now) {
-                // Make sure we start at t=0
-                si->when = now;
-                si->animation->setRunning(true);
-                m_runningAnimations.push_back(*si);
-                si = m_scheduledAnimations.erase(si);
-            } else {
-                ++si;
-            }
+        // The heap hands them out in start order, so they are also ticked in
+        // that order. Cancelled and paused ones are dropped as they come to
+        // the top, whether they are due or not, so the top is always one
+        // which will start; timeToNextAnimation() relies on that.
+        while (!m_scheduledAnimations.empty()
+               && (m_scheduledAnimations.front().when < now || !isPending(m_scheduledAnimations.front()))) {
+            std::pop_heap(m_scheduledAnimations.begin(), m_scheduledAnimations.end(), startsLater);
+            ScheduledAnimation sa = m_scheduledAnimations.back();
+            m_scheduledAnimations.pop_back();
+            if (!isPending(sa))
+                continue;
+            Slot &slot = m_slots[sa.slot];
+            assert(!slot.animation->isRunning());
+            // Make sure we start at t=0
+            slot.when = now;
+            slot.animation->setRunning(true);
+            --m_scheduledCount;
+            link(sa.slot);
         }
 
-        auto ri = m_runningAnimations.begin();
-        while (ri != m_runningAnimations.end()) {
-            assert(ri->animation->isRunning());
-            std::chrono::duration<double> animTime = now - ri->when;
-            ri->animation->tick(animTime.count());
-            if (!ri->animation->isRunning()) {
-                ri = m_runningAnimations.erase(ri);
-            } else {
-                ++ri;
+        // Animations of nodes which were not drawn in the last frame are
+        // only ticked every m_throttleInterval. Their time is still taken
+        // from the clock, so they are back in sync on their first tick
+        // after the node becomes visible again. Every animation is ticked
+        // when it starts so its target never shows a value from before.
+        const double time = currentTime();
+        const bool throttling = m_renderedFrame > 0 && m_throttleInterval > 0;
+        m_fullRateAnimations = 0;
+        m_nextThrottledTick = std::numeric_limits<double>::infinity();
+
+        unsigned i = m_firstRunning;
+        while (i != NoSlot) {
+            Slot &slot = m_slots[i];
+            assert(slot.state == Running);
+            assert(slot.animation->isRunning());
+            bool throttled = false;
+            if (throttling && slot.lastTick >= 0) {
+                const Node *node = slot.animation->targetNode();
+                throttled = node && node->renderedFrame() != m_renderedFrame;
+                if (throttled && time < slot.lastTick + m_throttleInterval) {
+                    m_nextThrottledTick = std::min(m_nextThrottledTick, slot.lastTick + m_throttleInterval);
+                    i = slot.next;
+                    continue;
+                }
             }
+            slot.lastTick = time;
+            std::chrono::duration<double> animTime = now - slot.when;
+            tickSlot(i, animTime.count());
+            // The tick may have started, paused or cancelled animations and
+            // grown m_slots. Changes to this animation itself are left for
+            // settle(), so it is still linked and 'next' is up to date.
+            const unsigned next = m_slots[i].next;
+            if (settle(i)) {
+                if (throttled)
+                    m_nextThrottledTick = std::min(m_nextThrottledTick, time + m_throttleInterval);
+                else
+                    ++m_fullRateAnimations;
+            }
+            i = next;
         }
+
+        m_batches.tick(currentTime());
+    }
+
+    /*!
+        Returns the time of the current tick, in seconds since start(). This
+        is the clock used by the batches().
+     */
+    double currentTime() const {
+        std::chrono::duration<double> t = m_currentTick - m_startTime;
+        return t.count();
     }
 
+    /*!
+        Batched animations, see AnimationBatch.
+     */
+    AnimationBatches *batches() { return &m_batches; }
+
 
     void start() {
         m_startTime = clock::now();
-        m_nextTick = m_startTime;
+        m_currentTick = m_startTime;
         tick();
     }
 
+    /*!
+        Cancels all scheduled, running and paused animations. Batched
+        animations are not affected.
+     */
     void stop() {
+        for (unsigned i=0; i<m_slots.size(); ++i) {
+            Slot &slot = m_slots[i];
+            if (slot.state == Stopped)
+                continue;
+            slot.animation->setRunning(false);
+            if (slot.ticking) {
+                // Released by settle() once its tick returns
+                slot.state = Stopped;
+                slot.prev = slot.next = NoSlot;
+            } else {
+                release(i);
+            }
+        }
+        m_scheduledAnimations.clear();
+        m_scheduledCount = 0;
+        m_firstRunning = m_lastRunning = NoSlot;
+        m_runningCount = 0;
+        m_fullRateAnimations = 0;
+        m_nextThrottledTick = std::numeric_limits<double>::infinity();
+    }
+
+    /*!
+        Records that the last rendered frame was presented at \a when. See
+        FramePacer.
+     */
+    void framePresented(time_point when = clock::now()) { m_pacer.framePresented(when); }
+
+    const FramePacer &framePacer() const { return m_pacer; }
+
+    /*!
+        Records that the renderer's last frame was \a frame, see
+        Renderer::frameNumber(). Animations whose targetNode() was not drawn
+        in that frame, because it was outside the surface, below a fully
+        transparent OpacityNode or not in the rendered tree at all, are
+        throttled from then on.
+
+        Until this has been called, all animations run at full rate.
+     */
+    void setRenderedFrame(unsigned frame) { m_renderedFrame = frame; }
+
+    /*!
+        Contains the number of seconds between ticks of throttled
+        animations. An interval of 0 turns throttling off, and infinity
+        suspends throttled animations until their node is drawn again.
+
+        A node which becomes visible is drawn once with the value from its
+        last throttled tick before its animations run at full rate again.
+
+        The default is 0.25 seconds.
+     */
+    double throttleInterval() const { return m_throttleInterval; }
+    void setThrottleInterval(double interval) {
+        assert(interval >= 0);
+        m_throttleInterval = interval;
+    }
+
+    Handle startAnimation(Animation *animation) {
+        return scheduleAnimation(0, animation);
+    }
+
+    /*!
+        Starts \a animation on the first tick() which is \a delay seconds
+        or more from now, plus the animation's own Animation::startDelay().
+
+        It is an error to start an animation which is already in progress.
+     */
+    Handle scheduleAnimation(double delay, Animation *animation) {
+        assert(animation);
+        assert(!animation->isRunning());
+        const unsigned index = acquire(animation);
+        Slot &slot = m_slots[index];
+        slot.state = Scheduled;
+        slot.order = m_scheduleCount++;
+        ScheduledAnimation sa;
+        delay += animation->startDelay();
+        sa.when = clock::now() + std::chrono::milliseconds(int(delay * 1000));
+        sa.order = slot.order;
+        sa.slot = index;
+        m_scheduledAnimations.push_back(sa);
+        std::push_heap(m_scheduledAnimations.begin(), m_scheduledAnimations.end(), startsLater);
+        ++m_scheduledCount;
+        return handleFor(index);
+    }
+
+    /*!
+        Returns the state of the animation identified by \a handle. Handles
+        of animations which have finished or were cancelled are Stopped.
+     */
+    State state(Handle handle) const {
+        const Slot *slot = slotFor(handle);
+        return slot ? slot->state : Stopped;
     }
 
-    void startAnimation(Animation *animation) {
-        scheduleAnimation(0, animation);
+    /*!
+        Stops the animation identified by \a handle where it is, without
+        applying any further values to its target.
+
+        cancel(), pause(), resume() and seek() may be called from within
+        the tick() of the animation they are applied to. The change is then
+        only recorded and applied to the manager's lists once that tick()
+        returns.
+     */
+    bool cancel(Handle handle) {
+        const unsigned index = indexFor(handle);
+        if (index == NoSlot)
+            return false;
+        Slot &slot = m_slots[index];
+        if (slot.ticking) {
+            slot.animation->setRunning(false);
+            slot.state = Stopped;
+            return true;
+        }
+        if (slot.state == Running)
+            unlink(index);
+        else if (slot.state == Scheduled)
+            unschedule(index);
+        slot.animation->setRunning(false);
+        release(index);
+        return true;
     }
 
-    void scheduleAnimation(double delay, Animation *animation) {
-        TimedAnimation ta;
-        ta.when = clock::now() + std::chrono::milliseconds(int(delay * 1000));
-        ta.animation = animation;
-        m_scheduledAnimations.push_back(ta);
+    /*!
+        Holds the animation identified by \a handle at its current value
+        until it is resumed. A scheduled animation which is paused will
+        start from its beginning when it is resumed.
+
+        A paused animation is still in progress, so it is not stopped and
+        can't be started again until it is cancelled.
+     */
+    bool pause(Handle handle) {
+        const unsigned index = indexFor(handle);
+        if (index == NoSlot || m_slots[index].state == Paused)
+            return index != NoSlot;
+        Slot &slot = m_slots[index];
+        if (slot.state == Running) {
+            if (!slot.ticking)
+                unlink(index);
+            slot.pausedTime = std::chrono::duration<double>(m_currentTick - slot.when).count();
+        } else {
+            unschedule(index);
+            slot.pausedTime = 0;
+        }
+        slot.state = Paused;
+        return true;
+    }
+
+    /*!
+        Continues the paused animation identified by \a handle from where
+        it was paused, as of the last tick().
+     */
+    bool resume(Handle handle) {
+        const unsigned index = indexFor(handle);
+        if (index == NoSlot || m_slots[index].state != Paused)
+            return index != NoSlot;
+        Slot &slot = m_slots[index];
+        slot.when = m_currentTick - toDuration(slot.pausedTime);
+        slot.lastTick = -1;
+        slot.animation->setRunning(true);
+        if (slot.ticking)
+            slot.state = Running;
+        else
+            link(index);
+        return true;
+    }
+
+    /*!
+        Moves the animation identified by \a handle to \a time seconds from
+        its start. A running animation picks up the new time on the next
+        tick(). A paused animation is updated right away and stays paused,
+        unless the new time is past its end, in which case it finishes.
+        A scheduled animation is started.
+     */
+    bool seek(Handle handle, double time) {
+        const unsigned index = indexFor(handle);
+        if (index == NoSlot)
+            return false;
+        Slot &slot = m_slots[index];
+        switch (slot.state) {
+        case Scheduled:
+            unschedule(index);
+            slot.animation->setRunning(true);
+            slot.lastTick = -1;
+            link(index);
+            // fall through
+        case Running:
+            slot.when = m_currentTick - toDuration(time);
+            break;
+        case Paused:
+            slot.pausedTime = time;
+            slot.animation->setRunning(true);
+            if (!slot.ticking) {
+                tickSlot(index, time);
+                settle(index);
+            }
+            break;
+        case Stopped:
+            assert(false);
+            break;
+        }
+        return true;
+    }
+
+    bool animationsRunning() const { return m_runningCount > 0 || m_batches.animationsRunning(); }
+
+    /*!
+        Returns true if some animation was throttled in the last tick().
+     */
+    bool animationsThrottled() const { return m_fullRateAnimations < m_runningCount; }
+    bool animationsScheduled() const {
+        return m_scheduledCount > 0 || m_batches.nextStartTime() != std::numeric_limits<double>::infinity();
     }
 
-    bool animationsRunning() const { return !m_runningAnimations.empty(); }
-    bool animationsScheduled() const { return !m_scheduledAnimations.empty(); }
+    /*!
+        Returns the number of seconds until the next tick which will do
+        anything: 0 if animations are running at full rate, the time until
+        the earliest scheduled animation starts or throttled animation is
+        due otherwise, or -1 if there is nothing to wait for.
+
+        Use this to sleep until an animation is due rather than rendering
+        frames which will look the same.
+     */
+    double timeToNextAnimation() const {
+        if (m_fullRateAnimations > 0 || m_batches.animationsRunning())
+            return 0;
+        double next = std::numeric_limits<double>::infinity();
+        time_point now = clock::now();
+        if (!m_scheduledAnimations.empty()) {
+            assert(isPending(m_scheduledAnimations.front()));
+            next = std::chrono::duration<double>(m_scheduledAnimations.front().when - now).count();
+        }
+        const double sinceStart = std::chrono::duration<double>(now - m_startTime).count();
+        double batchStart = m_batches.nextStartTime();
+        if (batchStart != std::numeric_limits<double>::infinity())
+            next = std::min(next, batchStart - sinceStart);
+        if (m_nextThrottledTick != std::numeric_limits<double>::infinity())
+            next = std::min(next, m_nextThrottledTick - sinceStart);
+        if (next == std::numeric_limits<double>::infinity())
+            return -1;
+        return std::max(next, 0.0);
+    }
 
 private:
-    struct TimedAnimation {
-        time_point when;
+    static const unsigned NoSlot = ~0u;
+
+    struct Slot {
         Animation *animation;
+        time_point when;            // when the animation's t=0 is, once started
+        unsigned long long order;   // matches its ScheduledAnimation while scheduled
+        double lastTick;            // in currentTime(), -1 until the first tick
+        double pausedTime;
+        unsigned generation;
+        unsigned prev;              // running list, or free list in 'next'
+        unsigned next;
+        State state;
+        bool ticking;               // inside its animation's tick()
+    };
+
+    // Entries in the heap are not removed when their animation is
+    // cancelled, paused or seeked before it starts. They are skipped when
+    // they reach the top instead, as the order no longer matches.
+    struct ScheduledAnimation {
+        time_point when;
+        unsigned long long order;
+        unsigned slot;
     };
+
+    // Heap ordering for m_scheduledAnimations, earliest start on top.
+    // Animations scheduled for the same time start in the order they were
+    // scheduled.
+    static bool startsLater(const ScheduledAnimation &a, const ScheduledAnimation &b) {
+        if (a.when != b.when)
+            return a.when > b.when;
+        return a.order > b.order;
+    }
+
+    static clock::duration toDuration(double seconds) {
+        return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+    }
+
+    bool isPending(const ScheduledAnimation &sa) const {
+        const Slot &slot = m_slots[sa.slot];
+        return slot.state == Scheduled && slot.order == sa.order;
+    }
+
+    Handle handleFor(unsigned index) const {
+        return (Handle(m_slots[index].generation) << 32) | index;
+    }
+
+    unsigned indexFor(Handle handle) const {
+        const unsigned index = unsigned(handle & 0xffffffff);
+        if (index >= m_slots.size())
+            return NoSlot;
+        const Slot &slot = m_slots[index];
+        if (slot.generation != unsigned(handle >> 32) || slot.state == Stopped)
+            return NoSlot;
+        return index;
+    }
+
+    const Slot *slotFor(Handle handle) const {
+        const unsigned index = indexFor(handle);
+        return index == NoSlot ? 0 : &m_slots[index];
+    }
+
+    unsigned acquire(Animation *animation) {
+        unsigned index = m_freeSlots;
+        if (index != NoSlot) {
+            m_freeSlots = m_slots[index].next;
+        } else {
+            index = m_slots.size();
+            m_slots.push_back(Slot());
+            m_slots.back().generation = 1;
+        }
+        Slot &slot = m_slots[index];
+        slot.animation = animation;
+        slot.lastTick = -1;
+        slot.pausedTime = 0;
+        slot.prev = slot.next = NoSlot;
+        slot.ticking = false;
+        return index;
+    }
+
+    // Handles to the slot become invalid, as its generation changes.
+    void release(unsigned index) {
+        Slot &slot = m_slots[index];
+        slot.animation = 0;
+        slot.state = Stopped;
+        if (++slot.generation == 0)
+            slot.generation = 1;
+        slot.next = m_freeSlots;
+        m_freeSlots = index;
+    }
+
+    // Appends to the running list.
+    void link(unsigned index) {
+        Slot &slot = m_slots[index];
+        slot.state = Running;
+        slot.prev = m_lastRunning;
+        slot.next = NoSlot;
+        if (m_lastRunning != NoSlot)
+            m_slots[m_lastRunning].next = index;
+        else
+            m_firstRunning = index;
+        m_lastRunning = index;
+        ++m_runningCount;
+    }
+
+    void unlink(unsigned index) {
+        Slot &slot = m_slots[index];
+        assert(isLinked(index));
+        if (slot.prev != NoSlot)
+            m_slots[slot.prev].next = slot.next;
+        else
+            m_firstRunning = slot.next;
+        if (slot.next != NoSlot)
+            m_slots[slot.next].prev = slot.prev;
+        else
+            m_lastRunning = slot.prev;
+        slot.prev = slot.next = NoSlot;
+        --m_runningCount;
+    }
+
+    bool isLinked(unsigned index) const {
+        return m_slots[index].prev != NoSlot || m_firstRunning == index;
+    }
+
+    // Ticks the animation in slot 'index'. Calls which the animation makes
+    // on its own handle meanwhile only update the slot's state.
+    void tickSlot(unsigned index, double time) {
+        m_slots[index].ticking = true;
+        Animation *animation = m_slots[index].animation;
+        animation->tick(time);
+        m_slots[index].ticking = false;
+    }
+
+    // Applies the state of slot 'index' after tickSlot() to the running
+    // list: animations which finished or were cancelled are released,
+    // paused ones unlinked and resumed ones linked. Returns true if the
+    // animation is still running.
+    bool settle(unsigned index) {
+        Slot &slot = m_slots[index];
+        if (slot.state != Stopped && !slot.animation->isRunning())
+            slot.state = Stopped;
+        const bool linked = isLinked(index);
+        if (slot.state == Running) {
+            if (!linked)
+                link(index);
+            return true;
+        }
+        if (linked)
+            unlink(index);
+        if (slot.state == Stopped)
+            release(index);
+        return false;
+    }
+
+    // Leaves the heap entry behind, but keeps the top of the heap pending
+    // so that timeToNextAnimation() sees the right start time. The slot is
+    // left as Paused until the caller gives it its new state.
+    void unschedule(unsigned index) {
+        assert(m_slots[index].state == Scheduled);
+        m_slots[index].state = Paused;
+        --m_scheduledCount;
+        while (!m_scheduledAnimations.empty() && !isPending(m_scheduledAnimations.front())) {
+            std::pop_heap(m_scheduledAnimations.begin(), m_scheduledAnimations.end(), startsLater);
+            m_scheduledAnimations.pop_back();
+        }
+    }
+
     time_point m_startTime;
-    time_point m_nextTick;
+    time_point m_currentTick;
+
+    FramePacer m_pacer;
+
+    std::vector<Slot> m_slots;
+    unsigned m_freeSlots = NoSlot;
+    unsigned m_firstRunning = NoSlot;
+    unsigned m_lastRunning = NoSlot;
+    size_t m_runningCount = 0;
+
+    std::vector<ScheduledAnimation> m_scheduledAnimations;
+    size_t m_scheduledCount = 0;
+    unsigned long long m_scheduleCount = 0;
+
+    unsigned m_renderedFrame = 0;
+    double m_throttleInterval = 0.25;
+    size_t m_fullRateAnimations = 0;
+    double m_nextThrottledTick = std::numeric_limits<double>::infinity();
 
-    std::list<TimedAnimation> m_runningAnimations;
-    std::list<TimedAnimation> m_scheduledAnimations;
+    AnimationBatches m_batches;
 };
 
 
@@ -4,6 +4,89 @@ RENGINE_BEGIN_NAMESPACE
 
 
 
+struct TransformNode_setMatrix {
+    void operator()(const mat4 &matrix, TransformNode *node) {
+        node->setMatrix(matrix);
+    }
+};
+
+struct TransformNode_translate2D {
+    void operator()(const vec2 &translation, TransformNode *node) {
+        node->setMatrix(mat4::translate2D(translation.x, translation.y));
+    }
+};
+
+struct TransformNode_translate {
+    void operator()(const vec3 &translation, TransformNode *node) {
+        node->setMatrix(mat4::translate(translation.x, translation.y, translation.z));
+    }
+};
+
+struct TransformNode_scale2D {
+    void operator()(const vec2 &scale, TransformNode *node) {
+        node->setMatrix(mat4::scale2D(scale.x, scale.y));
+    }
+};
+
+struct TransformNode_scale {
+    void operator()(double scale, TransformNode *node) {
+        node->setMatrix(mat4::scale2D(scale, scale));
+    }
+};
+
+struct TransformNode_rotate2D {
+    void operator()(double rotation, TransformNode *node) {
+        node->setMatrix(mat4::rotate2D(rotation));
+    }
+};
+
+/*!
+    Pairs a TransformNode with separate translation, rotation and scale, so
+    they can be animated independently of each other, like the individual
+    CSS transform properties. The node's matrix is
+
+        translate * rotate * scale
+
+    around the origin.
+ */
+struct TransformTarget {
+    TransformTarget(TransformNode *node = 0) : node(node), rotation(0), scale(1, 1) { }
+
+    void update() {
+        node->setMatrix(mat4::translate2D(translation.x, translation.y)
+                        * mat4::rotate2D(rotation)
+                        * mat4::scale2D(scale.x, scale.y));
+    }
+
+    TransformNode *node;
+    vec2 translation;
+    float rotation;
+    vec2 scale;
+};
+
+inline const Node *animationTargetNode(const TransformTarget *target) { return target->node; }
+
+struct TransformTarget_translate {
+    void operator()(const vec2 &translation, TransformTarget *target) {
+        target->translation = translation;
+        target->update();
+    }
+};
+
+struct TransformTarget_rotate {
+    void operator()(double rotation, TransformTarget *target) {
+        target->rotation = rotation;
+        target->update();
+    }
+};
+
+struct TransformTarget_scale {
+    void operator()(const vec2 &scale, TransformTarget *target) {
+        target->scale = scale;
+        target->update();
+    }
+};
+
 struct TransformNode_rotateAroundX {
     void operator()(double rotation, TransformNode *node) {
         node->setMatrix(mat4::rotateAroundX(rotation));
@@ -68,6 +151,25 @@ struct ColorFilterNode_sepia {
     }
 };
 
+/*!
+    Pairs a ColorFilterNode with the chain of filter functions it shows, so
+    the amounts in the chain can be animated with ColorFilterTarget_setAmount.
+ */
+struct ColorFilterTarget {
+    ColorFilter filter;
+    ColorFilterNode *node;
+};
+
+inline const Node *animationTargetNode(const ColorFilterTarget *target) { return target->node; }
+
+template <unsigned Index>
+struct ColorFilterTarget_setAmount {
+    void operator()(double amount, ColorFilterTarget *target) {
+        target->filter.setAmount(Index, amount);
+        target->node->setColorMatrix(target->filter.matrix());
+    }
+};
+
 
 
 struct BlurNode_setRadius {
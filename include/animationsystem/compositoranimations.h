@@ -0,0 +1,293 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Runs animations on the render side of a frame, after the application's
+    update(), much like compositor animations in a browser.
+
+    This is meant for properties the renderer consumes directly: opacity,
+    transforms and color filters, using the appliers in animationappliers.h.
+    Animating them here means they are evaluated for the time of the frame
+    being rendered and win over whatever update() did to the same
+    properties.
+
+    \code
+    double now = animationManager()->currentTime();
+    auto handle = compositorAnimations()->start<double, OpacityNode, OpacityNode_setOpacity>(node, 1, 0, now, 0.3);
+    \endcode
+
+    start() and cancel() may be called from any thread. They post a message
+    which the render side picks up on its next tick(); the handoff is a
+    lock-free list, so the posting thread never waits for a frame in
+    progress. If the surface is idle, request a render after starting an
+    animation.
+
+    Frames in which nothing but compositor animations is running are
+    rendered without the application: StandardSurfaceInterface asks the
+    surface for them with Surface::requestCompositorRender() and renders
+    them in onCompositorRender(), which ticks these animations and renders
+    the scene as it is, without calling update(). So a fade or a scroll
+    started here is not held back by an application which is slow to
+    update(), unless it is also animating or requesting renders itself.
+
+    The values are applied only to the target node itself: the appliers
+    in animationappliers.h set a property of one node and nothing else,
+    which for TransformNode::setMatrix() holds because world transforms
+    are validated lazily rather than pushed into the subtree. Custom
+    appliers used here must do the same, and must not add, remove or
+    destroy nodes, as frames without update() render the scene as it is.
+
+    While an animation is running, the render side owns the animated
+    property of its target and the application should not set it. A target
+    must not be destroyed before its animation has finished or been
+    cancelled.
+ */
+class CompositorAnimations
+{
+public:
+    typedef unsigned long long Handle;
+
+    CompositorAnimations() : m_inbox(0), m_nextHandle(1), m_active(0) { }
+
+    ~CompositorAnimations() {
+        for (Message *m = m_inbox.exchange(0); m; ) {
+            Message *next = m->next;
+            delete m->animation;
+            delete m;
+            m = next;
+        }
+        for (AnimationBase *a : m_animations)
+            delete a;
+    }
+
+    /*!
+        Starts animating \a target from \a from to \a to at \a startTime,
+        running \a iterations times for \a duration seconds each. Times are
+        on the clock passed to tick(). Use -1 for \a iterations to run
+        forever.
+
+        Returns a handle which can be passed to cancel().
+     */
+    template <typename ValueType,
+              typename Target,
+              typename ApplyFunctor,
+              typename TimingFunction = LinearTimingFunction>
+    Handle start(Target *target, const ValueType &from, const ValueType &to,
+                 double startTime, double duration, int iterations = 1,
+                 Animation::Direction direction = Animation::Normal,
+                 const TimingFunction &timingFunction = TimingFunction()) {
+        assert(target);
+        assert(duration > 0);
+        assert(iterations != 0);
+
+        auto *a = new CompositorAnimation<ValueType, Target, ApplyFunctor, TimingFunction>();
+        a->target = target;
+        a->from = InterpolationTraits<ValueType>::store(from);
+        a->to = InterpolationTraits<ValueType>::store(to);
+        a->timingFunction = timingFunction;
+        a->start = startTime;
+        a->rate = 1.0 / duration;
+        a->iterations = iterations;
+        a->direction = direction;
+        a->handle = m_nextHandle.fetch_add(1, std::memory_order_relaxed);
+
+        m_active.fetch_add(1, std::memory_order_relaxed);
+        Message *m = new Message();
+        m->animation = a;
+        m->cancel = 0;
+        post(m);
+        return a->handle;
+    }
+
+    /*!
+        Stops the animation identified by \a handle, leaving its target at
+        the last value applied. Cancelling an animation which has already
+        finished does nothing. The render side finds the animation through a
+        hash of the running ones, so this is O(1).
+     */
+    void cancel(Handle handle) {
+        Message *m = new Message();
+        m->animation = 0;
+        m->cancel = handle;
+        post(m);
+    }
+
+    /*!
+        Returns the number of animations which have been started and have
+        not yet finished or been cancelled. Can be called from any thread.
+     */
+    unsigned activeCount() const { return m_active.load(std::memory_order_relaxed); }
+
+    /*!
+        Called on the render side, before the scene is rendered, to pick up
+        new and cancelled animations and to apply the values for \a time to
+        all running ones.
+     */
+    void tick(double time) {
+        receive();
+
+        m_lastTime = time;
+        m_running = false;
+        m_nextStart = std::numeric_limits<double>::infinity();
+
+        unsigned i = 0;
+        while (i < m_animations.size()) {
+            AnimationBase *a = m_animations[i];
+            double t = (time - a->start) * a->rate;
+            if (t < 0) {
+                m_nextStart = std::min(m_nextStart, a->start);
+                ++i;
+                continue;
+            }
+
+            bool done;
+            a->apply(Animation::iterationProgress(t, a->iterations, (Animation::Direction) a->direction, &done));
+
+            if (done) {
+                removeAt(i);
+            } else {
+                m_running = true;
+                ++i;
+            }
+        }
+    }
+
+    /*!
+        Returns the number of seconds from the last tick() until the next
+        one will do anything: 0 if animations are running or new ones have
+        been posted, the time until the next animation starts, or -1 if there
+        is nothing to wait for. Call this on the render side.
+     */
+    double timeToNextAnimation() const {
+        if (m_running || m_inbox.load(std::memory_order_relaxed))
+            return 0;
+        if (m_nextStart == std::numeric_limits<double>::infinity())
+            return -1;
+        return std::max(m_nextStart - m_lastTime, 0.0);
+    }
+
+private:
+    struct AnimationBase {
+        virtual ~AnimationBase() {}
+        virtual void apply(double progress) = 0;
+
+        Handle handle;
+        unsigned index;     // in m_animations
+        double start;
+        double rate;        // 1 / duration
+        int iterations;
+        unsigned char direction;
+    };
+
+    template <typename ValueType, typename Target, typename ApplyFunctor, typename TimingFunction>
+    struct CompositorAnimation : public AnimationBase {
+        void apply(double progress) override {
+            applyFunctor(InterpolationTraits<ValueType>::interpolate(from, to, timingFunction(progress)), target);
+        }
+
+        Target *target;
+        typename InterpolationTraits<ValueType>::Stored from;
+        typename InterpolationTraits<ValueType>::Stored to;
+        ApplyFunctor applyFunctor;
+        TimingFunction timingFunction;
+    };
+
+    struct Message {
+        Message *next;
+        AnimationBase *animation;
+        Handle cancel;
+    };
+
+    void post(Message *m) {
+        Message *head = m_inbox.load(std::memory_order_relaxed);
+        do {
+            m->next = head;
+        } while (!m_inbox.compare_exchange_weak(head, m, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void receive() {
+        Message *m = m_inbox.exchange(0, std::memory_order_acquire);
+        if (!m)
+            return;
+
+        // The list comes out newest first, so reverse it to process the
+        // messages in the order they were posted.
+        Message *ordered = 0;
+        while (m) {
+            Message *next = m->next;
+            m->next = ordered;
+            ordered = m;
+            m = next;
+        }
+
+        while (ordered) {
+            Message *next = ordered->next;
+            if (ordered->animation) {
+                ordered->animation->index = m_animations.size();
+                m_animations.push_back(ordered->animation);
+                m_handles[ordered->animation->handle] = ordered->animation;
+            } else {
+                auto found = m_handles.find(ordered->cancel);
+                if (found != m_handles.end())
+                    removeAt(found->second->index);
+            }
+            delete ordered;
+            ordered = next;
+        }
+    }
+
+    void removeAt(unsigned i) {
+        AnimationBase *a = m_animations[i];
+        m_animations[i] = m_animations.back();
+        m_animations[i]->index = i;
+        m_animations.pop_back();
+        m_handles.erase(a->handle);
+        delete a;
+        m_active.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<Message *> m_inbox;
+    std::atomic<Handle> m_nextHandle;
+    std::atomic<unsigned> m_active;
+
+    // Only touched on the render side
+    std::vector<AnimationBase *> m_animations;
+    std::unordered_map<Handle, AnimationBase *> m_handles;
+    double m_lastTime = -std::numeric_limits<double>::infinity();
+    double m_nextStart = std::numeric_limits<double>::infinity();
+    bool m_running = false;
+};
+
+RENGINE_END_NAMESPACE
@@ -26,107 +26,940 @@
 #pragma once
 
 #include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <atomic>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 RENGINE_BEGIN_NAMESPACE
 
-template <typename T>
-class AllocationPool
+/*!
+    A snapshot of the counters kept by an allocation pool.
+ */
+struct AllocationPoolStatistics
+{
+    const char *name;           // the pooled type, or 0
+    unsigned capacity;          // objects which fit in the allocated chunks
+    unsigned live;              // objects currently allocated
+    unsigned highWaterMark;     // the highest number of live objects seen
+    unsigned heapFallbacks;     // create() calls served by plain 'new'
+    uint64_t allocations;       // total since the pool was created
+    uint64_t frees;
+    unsigned frameAllocations;  // during the last completed frame
+    unsigned frameFrees;
+};
+
+/*!
+    Common base for AllocationPool and ConcurrentAllocationPool which keeps
+    track of all pools in the process, so their statistics can be queried
+    and dumped without knowing the pooled types.
+
+    A pool registers itself the first time it allocates memory. Frame
+    boundaries are marked with AllocationPoolBase::endFrame(), which the
+    StandardSurfaceInterface calls after each frame has been swapped.
+ */
+class AllocationPoolBase
 {
 public:
-    AllocationPool()
-        : m_memory(0)
-        , m_free(0)
-        , m_nextFree(0)
-        , m_poolSize(0)
+    /*!
+        Returns the current statistics for this pool.
+     */
+    AllocationPoolStatistics statistics() const {
+        AllocationPoolStatistics s;
+        s.name = m_name;
+        counters(&s);
+        s.heapFallbacks = m_heapFallbacks.load(std::memory_order_relaxed);
+        s.frameAllocations = m_frameAllocations;
+        s.frameFrees = m_frameFrees;
+        return s;
+    }
+
+    const char *name() const { return m_name; }
+
+    /*!
+        Called by create() when the pool could not provide memory and the
+        object was allocated on the heap instead.
+     */
+    void noteHeapFallback() {
+        m_heapFallbacks.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*!
+        Returns the first registered pool. Use nextPool() to iterate the
+        rest. The list should not be iterated while other threads are
+        creating new pool types.
+     */
+    static AllocationPoolBase *firstPool() { return registry().load(std::memory_order_acquire); }
+    AllocationPoolBase *nextPool() const { return m_nextPool; }
+
+    /*!
+        Marks the end of a frame for all registered pools, moving the
+        allocations and frees since the previous call into the per frame
+        counters.
+     */
+    static void endFrame() {
+        for (AllocationPoolBase *p = firstPool(); p; p = p->m_nextPool) {
+            AllocationPoolStatistics s;
+            p->counters(&s);
+            p->m_frameAllocations = unsigned(s.allocations - p->m_frameStartAllocations);
+            p->m_frameFrees = unsigned(s.frees - p->m_frameStartFrees);
+            p->m_frameStartAllocations = s.allocations;
+            p->m_frameStartFrees = s.frees;
+        }
+    }
+
+    /*!
+        Writes the statistics of all registered pools to \a out.
+     */
+    static void dumpStatistics(std::ostream &out = std::cout) {
+        out << "AllocationPool statistics:" << std::endl;
+        for (AllocationPoolBase *p = firstPool(); p; p = p->m_nextPool) {
+            AllocationPoolStatistics s = p->statistics();
+            out << " - " << (s.name ? s.name : "(unnamed)")
+                << ": capacity=" << s.capacity
+                << ", live=" << s.live
+                << ", highWaterMark=" << s.highWaterMark
+                << ", heapFallbacks=" << s.heapFallbacks
+                << ", allocations=" << s.allocations
+                << ", frees=" << s.frees
+                << ", lastFrame=+" << s.frameAllocations << "/-" << s.frameFrees
+                << std::endl;
+        }
+    }
+
+protected:
+    constexpr explicit AllocationPoolBase(const char *name)
+        : m_name(name)
+        , m_nextPool(0)
+        , m_registered(false)
+        , m_heapFallbacks(0)
+        , m_frameAllocations(0)
+        , m_frameFrees(0)
+        , m_frameStartAllocations(0)
+        , m_frameStartFrees(0)
     {
     }
 
+    ~AllocationPoolBase() {
+        // Pools are static objects so this only happens at exit, when
+        // there are no other threads around.
+        if (!m_registered.load(std::memory_order_relaxed))
+            return;
+        std::atomic<AllocationPoolBase *> &head = registry();
+        if (head.load(std::memory_order_relaxed) == this) {
+            head.store(m_nextPool, std::memory_order_relaxed);
+            return;
+        }
+        for (AllocationPoolBase *p = head.load(std::memory_order_relaxed); p; p = p->m_nextPool) {
+            if (p->m_nextPool == this) {
+                p->m_nextPool = m_nextPool;
+                return;
+            }
+        }
+    }
+
     /*!
-     * For internal use only, called by setup macroes.
+        Fills in capacity, live, highWaterMark, allocations and frees.
      */
-    void setMemory(void *m, unsigned blockCount) {
-        assert(m_memory == 0);
-        assert(m_free == 0);
-        assert(m_nextFree == 0);
-        assert(m_poolSize == 0);
+    virtual void counters(AllocationPoolStatistics *s) const = 0;
 
-        m_poolSize = blockCount;
-        m_memory = (T *) m;
-        m_free = (unsigned *) (m_memory + blockCount);
-        m_nextFree = 0;
-        for (unsigned i=0; i<blockCount; ++i)
-            m_free[i] = i;
+    void registerPool() {
+        if (m_registered.load(std::memory_order_relaxed) || m_registered.exchange(true))
+            return;
+        std::atomic<AllocationPoolBase *> &head = registry();
+        AllocationPoolBase *first = head.load(std::memory_order_relaxed);
+        do {
+            m_nextPool = first;
+        } while (!head.compare_exchange_weak(first, this, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+private:
+    static std::atomic<AllocationPoolBase *> &registry() {
+        static std::atomic<AllocationPoolBase *> head(0);
+        return head;
+    }
+
+    const char *m_name;
+    AllocationPoolBase *m_nextPool;
+    std::atomic<bool> m_registered;
+    std::atomic<unsigned> m_heapFallbacks;
+    unsigned m_frameAllocations;
+    unsigned m_frameFrees;
+    uint64_t m_frameStartAllocations;
+    uint64_t m_frameStartFrees;
+};
+
+/*!
+    A slab allocator for fixed size objects of type T.
+
+    Memory is allocated from the heap in chunks which are aligned to their
+    own size, so the chunk an object belongs to can be found from its
+    address alone. Each chunk keeps its own list of free slots, and the pool
+    keeps a list of chunks which have free slots, so both allocate() and
+    deallocate() are O(1).
+
+    When a chunk becomes empty it is returned to the system, except for the
+    reserved chunks and one spare chunk which is kept around to avoid
+    thrashing when objects are created and destroyed at a chunk boundary.
+ */
+template <typename T>
+class AllocationPool : public AllocationPoolBase
+{
+public:
+    enum {
+        CacheLineSize = 64,
+        MinimumChunkSize = 16384,
+        MinimumSlotsPerChunk = 16
+    };
+
+    constexpr explicit AllocationPool(const char *name = 0)
+        : AllocationPoolBase(name)
+        , m_partial(0)
+        , m_chunkSize(computeChunkSize())
+        , m_slotSize(computeSlotSize())
+        , m_slotsPerChunk((computeChunkSize() - headerSize()) / computeSlotSize())
+        , m_chunkCount(0)
+        , m_emptyChunks(0)
+        , m_reservedChunks(0)
+        , m_live(0)
+        , m_highWaterMark(0)
+        , m_allocations(0)
+    {
+    }
+
+    ~AllocationPool() {
+        // Only release the chunks which are empty. Objects which are still
+        // alive at this point are simply leaked as the process is exiting
+        // and they may still be referenced from other static objects.
+        compact(true);
+    }
+
+    /*!
+        Makes sure the pool can hold at least \a count objects without
+        allocating more memory. The reserved memory is not returned to the
+        system when it becomes unused.
+     */
+    void reserve(unsigned count) {
+        m_reservedChunks = (count + m_slotsPerChunk - 1) / m_slotsPerChunk;
+        while (m_chunkCount < m_reservedChunks)
+            newChunk();
     }
 
     T *allocate() {
-        assert(!isExhausted());
-        assert(m_memory);
-        assert(m_free);
-        assert(m_free[m_nextFree] < m_poolSize);
+        Chunk *c = m_partial;
+        if (!c)
+            c = newChunk();
+        assert(c->used < m_slotsPerChunk);
 
-        // std::cout << "AllocationPool::allocate: memory=" << m_memory
-        //           << ", free=" << m_free
-        //           << ", nextFree=" << m_nextFree
-        //           << ", free[nextFree]=" << m_free[m_nextFree] << std::endl;
+        void *slot;
+        if (c->free) {
+            slot = c->free;
+            c->free = *(void **) slot;
+        } else {
+            assert(c->bumped < m_slotsPerChunk);
+            slot = slotAt(c, c->bumped++);
+        }
 
-        T *t = m_memory + m_free[m_nextFree++];
-        // std::cout << " --> t=" << (void *) t
-        //           << ", nextFree=" << m_nextFree
-        //           << ", free[nextFree]=" << m_free[m_nextFree] << std::endl;
+        if (c->used++ == 0)
+            --m_emptyChunks;
+        if (c->used == m_slotsPerChunk)
+            unlinkPartial(c);
 
-        return new (t) T();
+        ++m_allocations;
+        if (++m_live > m_highWaterMark)
+            m_highWaterMark = m_live;
+
+        return new (slot) T();
     }
 
     void deallocate(T *t) {
-        assert(m_memory);
-        assert(m_free);
-        assert(m_nextFree > 0);
-        assert(isAlloctated(t));
+        assert(t);
+
+        // Call the destructor first, it might release other objects from
+        // this pool, such as child nodes.
+        t->~T();
+
+        Chunk *c = chunkFor(t);
+        assert(c->used > 0);
+
+        bool wasFull = c->used == m_slotsPerChunk;
+        *(void **) t = c->free;
+        c->free = t;
+        --c->used;
+        --m_live;
+
+        if (wasFull)
+            linkPartial(c);
+
+        if (c->used == 0) {
+            if (m_emptyChunks > 0 && m_chunkCount > m_reservedChunks) {
+                unlinkPartial(c);
+                releaseChunk(c);
+            } else {
+                ++m_emptyChunks;
+            }
+        }
+    }
+
+    /*!
+        Returns all empty chunks beyond the reserved ones to the system. If
+        \a all is true, reserved chunks are released too.
+     */
+    void compact(bool all = false) {
+        Chunk *c = m_partial;
+        while (c && (all || m_chunkCount > m_reservedChunks)) {
+            Chunk *next = c->next;
+            if (c->used == 0) {
+                unlinkPartial(c);
+                releaseChunk(c);
+                --m_emptyChunks;
+            }
+            c = next;
+        }
+    }
+
+    /*!
+        Provided for compatibility with ConcurrentAllocationPool. The
+        statistics of this pool are always up to date.
+     */
+    void flushThreadStatistics() { }
+
+    /*!
+        Returns the number of chunks currently allocated by this pool.
+     */
+    unsigned chunkCount() const { return m_chunkCount; }
+
+    /*!
+        Returns the number of objects which fit in a single chunk.
+     */
+    unsigned slotsPerChunk() const { return m_slotsPerChunk; }
+
+protected:
+    void counters(AllocationPoolStatistics *s) const override {
+        s->capacity = m_chunkCount * m_slotsPerChunk;
+        s->live = m_live;
+        s->highWaterMark = m_highWaterMark;
+        s->allocations = m_allocations;
+        s->frees = m_allocations - m_live;
+    }
+
+private:
+    struct Chunk {
+        Chunk *prev;        // links in the list of chunks with free slots
+        Chunk *next;
+        void *free;         // singly linked list of released slots
+        unsigned used;      // number of live objects in this chunk
+        unsigned bumped;    // slots handed out from the untouched tail
+    };
+
+    // The first slot starts on its own cache line after the header.
+    static constexpr unsigned headerSize() {
+        return (sizeof(Chunk) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+    }
+
+    // Slots hold a T or, while free, the link to the next free slot.
+    static constexpr unsigned slotAlignment() {
+        return alignof(T) > sizeof(void *) ? alignof(T) : sizeof(void *);
+    }
+    static constexpr unsigned computeSlotSize() {
+        return ((sizeof(T) > sizeof(void *) ? sizeof(T) : sizeof(void *)) + slotAlignment() - 1) & ~(slotAlignment() - 1);
+    }
+    static constexpr unsigned computeChunkSize(unsigned size = MinimumChunkSize) {
+        return (size - headerSize()) / computeSlotSize() < MinimumSlotsPerChunk ? computeChunkSize(size * 2) : size;
+    }
+
+    void *slotAt(Chunk *c, unsigned i) const {
+        return (char *) c + headerSize() + i * m_slotSize;
+    }
+
+    Chunk *chunkFor(T *t) const {
+        return (Chunk *) ((size_t) t & ~(size_t(m_chunkSize) - 1));
+    }
+
+    Chunk *newChunk() {
+        void *memory = 0;
+        if (posix_memalign(&memory, m_chunkSize, m_chunkSize) != 0)
+            throw std::bad_alloc();
+        registerPool();
+        Chunk *c = (Chunk *) memory;
+        c->prev = 0;
+        c->next = 0;
+        c->free = 0;
+        c->used = 0;
+        c->bumped = 0;
+        linkPartial(c);
+        ++m_chunkCount;
+        ++m_emptyChunks;
+        return c;
+    }
+
+    void releaseChunk(Chunk *c) {
+        assert(c->used == 0);
+        assert(m_chunkCount > 0);
+        --m_chunkCount;
+        ::free(c);
+    }
+
+    void linkPartial(Chunk *c) {
+        c->prev = 0;
+        c->next = m_partial;
+        if (m_partial)
+            m_partial->prev = c;
+        m_partial = c;
+    }
+
+    void unlinkPartial(Chunk *c) {
+        if (c->prev)
+            c->prev->next = c->next;
+        else
+            m_partial = c->next;
+        if (c->next)
+            c->next->prev = c->prev;
+        c->prev = 0;
+        c->next = 0;
+    }
+
+    Chunk *m_partial;
+    const unsigned m_chunkSize;
+    const unsigned m_slotSize;
+    const unsigned m_slotsPerChunk;
+    unsigned m_chunkCount;
+    unsigned m_emptyChunks;
+    unsigned m_reservedChunks;
+    unsigned m_live;
+    unsigned m_highWaterMark;
+    uint64_t m_allocations;
+};
+
+/*!
+    A thread-safe variant of AllocationPool, for node types which are
+    created or destroyed on other threads than the one rendering, for
+    instance when building subtrees while parsing content.
+
+    Each thread keeps a small cache of free slots, so the common case does
+    not touch shared state at all. When a thread's cache runs empty it
+    refills from a global lock-free free list, and when it overflows it
+    hands half of its slots back in one atomic operation. Objects can be
+    released on a different thread than they were allocated on.
+
+    The global free list links slots by index rather than by pointer and
+    tags the list head with a counter, which protects against the ABA
+    problem using plain 64-bit atomics.
+
+    Allocations and frees are counted in the thread caches and added to the
+    pool's statistics in batches, so the live count and high-water mark can
+    lag behind by up to ThreadCacheSize operations per thread.
+
+    Unlike AllocationPool, chunks are never returned to the system, as
+    other threads may still be reading from them. The pool holds at most
+    MaxChunks chunks; allocate() returns 0 when they are all in use.
+
+    There must only be one instance of this class per type T, which is
+    what RENGINE_CONCURRENT_ALLOCATION_POOL_DECLARATION sets up.
+ */
+template <typename T>
+class ConcurrentAllocationPool : public AllocationPoolBase
+{
+public:
+    enum {
+        CacheLineSize = 64,
+        MinimumChunkSize = 16384,
+        MinimumSlotsPerChunk = 16,
+        MaxChunks = 4096,
+        ThreadCacheSize = 64
+    };
+
+    constexpr explicit ConcurrentAllocationPool(const char *name = 0)
+        : AllocationPoolBase(name)
+        , m_head(0)
+        , m_chunkCount(0)
+        , m_chunkSize(computeChunkSize())
+        , m_slotSize(computeSlotSize())
+        , m_slotsPerChunk((computeChunkSize() - headerSize()) / computeSlotSize())
+        , m_chunks{}
+        , m_allocations(0)
+        , m_frees(0)
+        , m_highWaterMark(0)
+    {
+    }
+
+    ~ConcurrentAllocationPool() {
+        // Memory is deliberately not released here; see AllocationPool.
+    }
 
-        unsigned pos = t - m_memory;
+    /*!
+        Makes sure the pool can hold at least \a count objects without
+        allocating more memory. Should be called before other threads start
+        using the pool.
+     */
+    void reserve(unsigned count) {
+        while (m_chunkCount.load(std::memory_order_acquire) * m_slotsPerChunk < count) {
+            unsigned first, last;
+            if (!newChunk(&first, &last))
+                return;
+            pushList(first, last);
+        }
+    }
 
-        --m_nextFree;
-        m_free[m_nextFree] = pos;
+    T *allocate() {
+        ThreadCache &tc = threadCache();
+        assert(tc.pool == 0 || tc.pool == this);
+        tc.pool = this;
+        if (tc.count == 0 && !refill(tc))
+            return 0;
+        ++tc.allocations;
+        if (++tc.pending == ThreadCacheSize)
+            flushCounters(tc);
+        return new (tc.slots[--tc.count]) T();
+    }
 
-        // Call the destructor...
+    void deallocate(T *t) {
+        assert(t);
         t->~T();
+
+        ThreadCache &tc = threadCache();
+        assert(tc.pool == 0 || tc.pool == this);
+        tc.pool = this;
+        if (tc.count == ThreadCacheSize * 2) {
+            release(tc.slots + ThreadCacheSize, ThreadCacheSize);
+            tc.count = ThreadCacheSize;
+        }
+        tc.slots[tc.count++] = t;
+        ++tc.frees;
+        if (++tc.pending == ThreadCacheSize)
+            flushCounters(tc);
+    }
+
+    /*!
+        Provided for compatibility with AllocationPool. Chunks in a
+        concurrent pool are never released.
+     */
+    void compact(bool all = false) { }
+
+    /*!
+        Adds the calling thread's pending allocation counts to the pool's
+        statistics.
+     */
+    void flushThreadStatistics() {
+        ThreadCache &tc = threadCache();
+        if (tc.pool == this)
+            flushCounters(tc);
+    }
+
+    /*!
+        Returns the number of chunks currently allocated by this pool.
+     */
+    unsigned chunkCount() const { return m_chunkCount.load(std::memory_order_acquire); }
+
+    /*!
+        Returns the number of objects which fit in a single chunk.
+     */
+    unsigned slotsPerChunk() const { return m_slotsPerChunk; }
+
+protected:
+    void counters(AllocationPoolStatistics *s) const override {
+        s->capacity = chunkCount() * m_slotsPerChunk;
+        s->allocations = m_allocations.load(std::memory_order_relaxed);
+        s->frees = m_frees.load(std::memory_order_relaxed);
+        s->live = s->allocations > s->frees ? unsigned(s->allocations - s->frees) : 0;
+        s->highWaterMark = m_highWaterMark.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Chunk {
+        unsigned index;
+    };
+
+    struct ThreadCache {
+        ThreadCache() : pool(0), count(0), pending(0), allocations(0), frees(0) { }
+        ~ThreadCache() {
+            if (pool) {
+                pool->flushCounters(*this);
+                if (count)
+                    pool->release(slots, count);
+            }
+        }
+        ConcurrentAllocationPool *pool;
+        unsigned count;
+        unsigned pending;
+        unsigned allocations;
+        unsigned frees;
+        void *slots[ThreadCacheSize * 2];
+    };
+
+    static ThreadCache &threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+
+    static constexpr unsigned headerSize() {
+        return (sizeof(Chunk) + CacheLineSize - 1) & ~(CacheLineSize - 1);
+    }
+
+    // Slots are numbered from 1, 0 terminates the free list.
+    static uint32_t listIndex(uint64_t head) { return uint32_t(head); }
+    static uint64_t listHead(uint64_t tag, uint32_t index) { return (tag << 32) | index; }
+
+    // The geometry only depends on T. It is fixed when the pool is
+    // constructed, so threads read it without synchronization.
+    static constexpr unsigned slotAlignment() {
+        return alignof(T) > sizeof(uint32_t) ? alignof(T) : sizeof(uint32_t);
+    }
+    static constexpr unsigned computeSlotSize() {
+        return ((sizeof(T) > sizeof(uint32_t) ? sizeof(T) : sizeof(uint32_t)) + slotAlignment() - 1) & ~(slotAlignment() - 1);
+    }
+    static constexpr unsigned computeChunkSize(unsigned size = MinimumChunkSize) {
+        return (size - headerSize()) / computeSlotSize() < MinimumSlotsPerChunk ? computeChunkSize(size * 2) : size;
+    }
+
+    void *slotAt(uint32_t index) const {
+        --index;
+        Chunk *c = m_chunks[index / m_slotsPerChunk].load(std::memory_order_acquire);
+        return (char *) c + headerSize() + (index % m_slotsPerChunk) * m_slotSize;
+    }
+
+    uint32_t indexOf(void *slot) const {
+        Chunk *c = (Chunk *) ((size_t) slot & ~(size_t(m_chunkSize) - 1));
+        return c->index * m_slotsPerChunk + ((char *) slot - (char *) c - headerSize()) / m_slotSize + 1;
+    }
+
+    void flushCounters(ThreadCache &tc) {
+        uint64_t allocations = m_allocations.fetch_add(tc.allocations, std::memory_order_relaxed) + tc.allocations;
+        uint64_t frees = m_frees.fetch_add(tc.frees, std::memory_order_relaxed) + tc.frees;
+        tc.allocations = 0;
+        tc.frees = 0;
+        tc.pending = 0;
+        if (allocations <= frees)
+            return;
+        unsigned live = unsigned(allocations - frees);
+        unsigned highWaterMark = m_highWaterMark.load(std::memory_order_relaxed);
+        while (live > highWaterMark
+               && !m_highWaterMark.compare_exchange_weak(highWaterMark, live, std::memory_order_relaxed))
+            ;
+    }
+
+    static std::atomic<uint32_t> *nextOf(void *slot) { return (std::atomic<uint32_t> *) slot; }
+
+    /*!
+        Allocates a new chunk and links all its slots together. The indices
+        of the first and last slot are written to \a first and \a last.
+     */
+    bool newChunk(unsigned *first, unsigned *last) {
+        unsigned index = m_chunkCount.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= MaxChunks) {
+            m_chunkCount.fetch_sub(1, std::memory_order_acq_rel);
+            return false;
+        }
+
+        void *memory = 0;
+        if (posix_memalign(&memory, m_chunkSize, m_chunkSize) != 0)
+            throw std::bad_alloc();
+        registerPool();
+        Chunk *c = (Chunk *) memory;
+        c->index = index;
+        m_chunks[index].store(c, std::memory_order_release);
+
+        *first = index * m_slotsPerChunk + 1;
+        *last = *first + m_slotsPerChunk - 1;
+        for (unsigned i=*first; i<*last; ++i)
+            nextOf(slotAt(i))->store(i + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /*!
+        Pushes the already linked list of slots from \a first to \a last
+        onto the global free list.
+     */
+    void pushList(uint32_t first, uint32_t last) {
+        std::atomic<uint32_t> *lastNext = nextOf(slotAt(last));
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        do {
+            lastNext->store(listIndex(head), std::memory_order_relaxed);
+        } while (!m_head.compare_exchange_weak(head, listHead((head >> 32) + 1, first),
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    void *pop() {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while (listIndex(head)) {
+            void *slot = slotAt(listIndex(head));
+            // The slot may be handed out by another thread while we read
+            // it, in which case the tag has changed and the CAS fails.
+            uint32_t next = nextOf(slot)->load(std::memory_order_relaxed);
+            if (m_head.compare_exchange_weak(head, listHead((head >> 32) + 1, next),
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire))
+                return slot;
+        }
+        return 0;
     }
 
-    bool isExhausted() const { return m_nextFree >= m_poolSize; }
-    bool isAlloctated(T *t) const { return unsigned(t - m_memory) < m_poolSize; }
+    void release(void **slots, unsigned count) {
+        assert(count > 0);
+        uint32_t first = indexOf(slots[0]);
+        uint32_t prev = first;
+        for (unsigned i=1; i<count; ++i) {
+            uint32_t index = indexOf(slots[i]);
+            nextOf(slots[i-1])->store(index, std::memory_order_relaxed);
+            prev = index;
+        }
+        pushList(first, prev);
+    }
+
+    bool refill(ThreadCache &tc) {
+        while (tc.count < ThreadCacheSize / 2) {
+            void *slot = pop();
+            if (!slot)
+                break;
+            tc.slots[tc.count++] = slot;
+        }
+        if (tc.count > 0)
+            return true;
+
+        // The global list is empty, grab a new chunk. Keep what fits in the
+        // thread cache and share the rest.
+        unsigned first, last;
+        if (!newChunk(&first, &last))
+            return false;
+        unsigned keep = std::min<unsigned>(ThreadCacheSize, last - first + 1);
+        for (unsigned i=0; i<keep; ++i)
+            tc.slots[tc.count++] = slotAt(first + i);
+        if (first + keep <= last)
+            pushList(first + keep, last);
+        return true;
+    }
+
+    std::atomic<uint64_t> m_head;
+    std::atomic<unsigned> m_chunkCount;
+    const unsigned m_chunkSize;
+    const unsigned m_slotSize;
+    const unsigned m_slotsPerChunk;
+    std::atomic<Chunk *> m_chunks[MaxChunks];
+    std::atomic<uint64_t> m_allocations;
+    std::atomic<uint64_t> m_frees;
+    std::atomic<unsigned> m_highWaterMark;
+};
+
+/*!
+    A linear allocator for short-lived objects which are all released at
+    the same time, such as a subtree which is rebuilt every frame.
+
+    While an AllocationArena::Scope is active on a thread, create() on any
+    type declared with one of the RENGINE_ALLOCATION_POOL_DECLARATION macros
+    takes memory from the arena rather than from the type's pool:
+
+        m_arena.reset();
+        AllocationArena::Scope scope(&m_arena);
+        Node *decorations = Node::create();
+        ...
+
+    Allocation is a pointer bump and reset() is O(1): no destructors are
+    run and no memory is returned to the system, the blocks are simply
+    reused. destroy() on an arena allocated object runs its destructor but
+    leaves the memory to the arena, so arena allocated nodes can be mixed
+    with pool allocated ones in a tree. It is an error to reset the arena
+    while any of its objects are still referenced, for instance while an
+    arena allocated subtree is still attached to a live parent.
+ */
+class AllocationArena
+{
+public:
+    enum {
+        DefaultBlockSize = 65536
+    };
+
+    explicit AllocationArena(unsigned blockSize = DefaultBlockSize)
+        : m_blockSize(blockSize)
+        , m_block(0)
+        , m_offset(0)
+    {
+    }
+
+    ~AllocationArena() {
+        assert(current() != this);
+        for (Block &b : m_blocks)
+            ::free(b.memory);
+    }
+
+    /*!
+        Returns \a size bytes of memory aligned to \a align.
+     */
+    void *allocate(size_t size, size_t align) {
+        assert(align > 0 && (align & (align - 1)) == 0);
+        while (m_block < m_blocks.size()) {
+            Block &b = m_blocks[m_block];
+            size_t offset = (m_offset + align - 1) & ~(align - 1);
+            if (offset + size <= b.size) {
+                m_offset = offset + size;
+                return b.memory + offset;
+            }
+            ++m_block;
+            m_offset = 0;
+        }
+
+        // Out of blocks, add one which is large enough for this request.
+        Block b;
+        b.size = std::max<size_t>(m_blockSize, size);
+        void *memory = 0;
+        if (posix_memalign(&memory, std::max<size_t>(align, CacheLineAlignment), b.size) != 0)
+            throw std::bad_alloc();
+        b.memory = (char *) memory;
+        m_blocks.push_back(b);
+        m_block = m_blocks.size() - 1;
+        m_offset = size;
+        return b.memory;
+    }
+
+    /*!
+        Releases all objects allocated from this arena in one go. The
+        objects' destructors are not called.
+     */
+    void reset() {
+        m_block = 0;
+        m_offset = 0;
+    }
+
+    /*!
+        Returns the number of bytes handed out since the last reset,
+        including alignment padding.
+     */
+    size_t bytesUsed() const {
+        size_t bytes = m_offset;
+        for (unsigned i=0; i<m_block && i<m_blocks.size(); ++i)
+            bytes += m_blocks[i].size;
+        return bytes;
+    }
+
+    /*!
+        Returns the total number of bytes held by this arena.
+     */
+    size_t capacity() const {
+        size_t bytes = 0;
+        for (const Block &b : m_blocks)
+            bytes += b.size;
+        return bytes;
+    }
+
+    /*!
+        Returns the arena which create() allocates from on the calling
+        thread, or 0 if there is none.
+     */
+    static AllocationArena *current() { return currentArena(); }
+
+    /*!
+        Makes create() allocate from an arena for as long as the scope
+        object is alive. Scopes can be nested.
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(AllocationArena *arena)
+            : m_previous(currentArena())
+        {
+            currentArena() = arena;
+        }
+        ~Scope() { currentArena() = m_previous; }
+
+    private:
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        AllocationArena *m_previous;
+    };
 
 private:
-    T *m_memory;
-    unsigned *m_free;
-    unsigned m_nextFree;
-    unsigned m_poolSize;
+    enum { CacheLineAlignment = 64 };
+
+    struct Block {
+        char *memory;
+        size_t size;
+    };
+
+    static AllocationArena *&currentArena() {
+        static thread_local AllocationArena *arena = 0;
+        return arena;
+    }
+
+    AllocationArena(const AllocationArena &) = delete;
+    AllocationArena &operator=(const AllocationArena &) = delete;
+
+    std::vector<Block> m_blocks;
+    size_t m_blockSize;
+    unsigned m_block;
+    size_t m_offset;
 };
 
+/*!
+    Reserves room for \a Count objects of \a Type in its allocation pool.
+    This is optional as the pools grow on demand, but it avoids allocating
+    chunks during the first frames.
+ */
 #define RENGINE_ALLOCATION_POOL(Type, Count) \
-    Type::__allocation_pool_##Type.setMemory(alloca(Count * (sizeof(Type) + sizeof(unsigned))), Count)
-
-#define RENGINE_ALLOCATION_POOL_DECLARATION(Type)           \
-    friend class AllocationPool<Type>;                      \
-    static AllocationPool<Type> __allocation_pool_##Type;   \
-    static Type *create() {                                 \
-        if (__allocation_pool_##Type.isExhausted())         \
-            return new Type();                              \
-        else  {                                             \
-            Type *t = __allocation_pool_##Type.allocate();  \
-            t->__mark_as_pool_allocated();                  \
-            return t;                                       \
-        }                                                   \
-    }                                                       \
-    virtual void destroy() {                                \
-        if (__is_pool_allocated())                          \
-            __allocation_pool_##Type.deallocate(this);      \
-        else                                                \
-            delete this;                                    \
+    Type::__allocation_pool_##Type.reserve(Count)
+
+/*!
+    Declares the pool for \a Type along with its create() and destroy()
+    functions. \a PoolType is AllocationPool or ConcurrentAllocationPool.
+
+    When an AllocationArena::Scope is active, create() allocates from the
+    arena instead and destroy() only runs the destructor.
+
+    The pool also serves as a unique key for the type, which is what
+    NodeRecycler uses to sort nodes, and __reinitialize() resets a pooled
+    object to a freshly created state in place.
+ */
+#define RENGINE_ALLOCATION_POOL_DECLARATION_WITH(Type, PoolType)    \
+    friend class PoolType<Type>;                                    \
+    static PoolType<Type> __allocation_pool_##Type;                 \
+    static Type *create() {                                         \
+        if (AllocationArena *arena = AllocationArena::current()) {  \
+            Type *t = new (arena->allocate(sizeof(Type),            \
+                                           alignof(Type))) Type();  \
+            t->__mark_as_arena_allocated();                         \
+            return t;                                               \
+        }                                                           \
+        Type *t = __allocation_pool_##Type.allocate();              \
+        if (!t) {                                                   \
+            __allocation_pool_##Type.noteHeapFallback();            \
+            return new Type();                                      \
+        }                                                           \
+        t->__mark_as_pool_allocated();                              \
+        return t;                                                   \
+    }                                                               \
+    virtual void destroy() {                                        \
+        if (__is_arena_allocated())                                 \
+            this->~Type();                                          \
+        else if (__is_pool_allocated())                             \
+            __allocation_pool_##Type.deallocate(this);              \
+        else                                                        \
+            delete this;                                            \
+    }                                                               \
+    static AllocationPoolBase *__static_allocation_pool() {         \
+        return &__allocation_pool_##Type;                           \
+    }                                                               \
+    virtual AllocationPoolBase *__allocation_pool() const {         \
+        return &__allocation_pool_##Type;                           \
+    }                                                               \
+    static Type *__reinitialize(Type *t) {                          \
+        assert(t->__is_pool_allocated());                           \
+        t->~Type();                                                 \
+        new (t) Type();                                             \
+        t->__mark_as_pool_allocated();                              \
+        return t;                                                   \
     }
 
+#define RENGINE_ALLOCATION_POOL_DECLARATION(Type) \
+    RENGINE_ALLOCATION_POOL_DECLARATION_WITH(Type, AllocationPool)
+
+#define RENGINE_CONCURRENT_ALLOCATION_POOL_DECLARATION(Type) \
+    RENGINE_ALLOCATION_POOL_DECLARATION_WITH(Type, ConcurrentAllocationPool)
+
 #define RENGINE_ALLOCATION_POOL_DEFINITION(Type)             \
-    AllocationPool<Type> Type::__allocation_pool_##Type
+    decltype(Type::__allocation_pool_##Type) Type::__allocation_pool_##Type(#Type)
 
 
-RENGINE_END_NAMESPACE
\ No newline at end of file
+RENGINE_END_NAMESPACE
@@ -26,6 +26,8 @@
 #pragma once
 
 #include <cmath>
+#include <algorithm>
+#include <assert.h>
 
 RENGINE_BEGIN_NAMESPACE
 
@@ -38,7 +40,26 @@ RENGINE_BEGIN_NAMESPACE
 
 namespace ColorMatrix {
 
-inline mat4 hue(float radians)
+/*!
+    The hue rotation turns the gray axis onto z, shears the luminance plane
+    so it is perpendicular to z, rotates around z and undoes the rest. Only
+    the rotation depends on the angle:
+
+        hue(a) = P * rotateAroundZ(a) * Q
+
+    The rotation is linear in cos(a) and sin(a), which gives
+
+        hue(a) = A + cos(a) * B + sin(a) * C
+
+    so the basis is computed once and each call only combines it.
+ */
+struct HueBasis {
+    mat4 a;
+    mat4 b;
+    mat4 c;
+};
+
+inline HueBasis computeHueBasis()
 {
     float mag = sqrt(2.0);
     const float xrs = 1.0 / mag;
@@ -77,10 +98,36 @@ inline mat4 hue(float radians)
              -zsx, -zsy, 1, 0,
              0, 0, 0, 1);
 
-    const mat4 mz = mat4::rotateAroundZ(radians);
+    const mat4 P = imx * imy * isz;
+    const mat4 Q = sz * M;
 
+    const mat4 rz0(0, 0, 0, 0,
+                   0, 0, 0, 0,
+                   0, 0, 1, 0,
+                   0, 0, 0, 1);
+    const mat4 rzc(1, 0, 0, 0,
+                   0, 1, 0, 0,
+                   0, 0, 0, 0,
+                   0, 0, 0, 0);
+    const mat4 rzs(0, -1, 0, 0,
+                   1,  0, 0, 0,
+                   0,  0, 0, 0,
+                   0,  0, 0, 0);
+
+    HueBasis basis = { P * rz0 * Q, P * rzc * Q, P * rzs * Q };
+    return basis;
+}
 
-    return imx * imy * mz * isz * M * sz;
+inline mat4 hue(float radians)
+{
+    static const HueBasis basis = computeHueBasis();
+    const float c = cos(radians);
+    const float s = sin(radians);
+    mat4 m;
+    for (int i=0; i<16; ++i)
+        m.m[i] = basis.a.m[i] + c * basis.b.m[i] + s * basis.c.m[i];
+    m.type = mat4::Generic;
+    return m;
 }
 
 inline mat4 brightness(float v)
@@ -135,6 +182,120 @@ inline mat4 sepia(float v)
                 0, 0, 0, 1);
 }
 
+/*!
+    Returns a * b for color matrices which leave alpha alone, that is
+    where the last row is (0, 0, 0, 1), which is the case for all the
+    functions above. This is about half the work of a full mat4 product.
+ */
+inline mat4 compose(const mat4 &a, const mat4 &b)
+{
+    mat4 r;
+    for (int row=0; row<3; ++row) {
+        const float *ar = a.m + row * 4;
+        float *rr = r.m + row * 4;
+        rr[0] = ar[0] * b.m[0] + ar[1] * b.m[4] + ar[2] * b.m[8];
+        rr[1] = ar[0] * b.m[1] + ar[1] * b.m[5] + ar[2] * b.m[9];
+        rr[2] = ar[0] * b.m[2] + ar[1] * b.m[6] + ar[2] * b.m[10];
+        rr[3] = ar[0] * b.m[3] + ar[1] * b.m[7] + ar[2] * b.m[11] + ar[3];
+    }
+    r.type = mat4::Generic;
+    return r;
+}
+
 }
 
+/*!
+    A chain of CSS filter functions, such as 'hue-rotate(1rad) saturate(2)',
+    combined into a single color matrix. Functions are applied in the order
+    they were added and each has an amount which can be changed, typically
+    from an animation.
+
+    \code
+    ColorFilter filter;
+    unsigned hue = filter.add(ColorFilter::HueRotate, 0);
+    filter.add(ColorFilter::Saturate, 2);
+    ...
+    filter.setAmount(hue, angle);
+    node->setColorMatrix(filter.matrix());
+    \endcode
+
+    The products of the leading functions are kept, so changing the amount
+    of a function only recomputes the chain from that function on. The
+    matrices are composed as 3x4, as none of the functions touch alpha.
+ */
+class ColorFilter
+{
+public:
+    enum Function {
+        Brightness,
+        Contrast,
+        Grayscale,
+        HueRotate,
+        Invert,
+        Saturate,
+        Sepia
+    };
+
+    enum { MaxFunctions = 8 };
+
+    /*!
+        Appends \a function with \a amount to the chain and returns its
+        index.
+     */
+    unsigned add(Function function, float amount) {
+        assert(m_size < MaxFunctions);
+        m_functions[m_size] = function;
+        m_amounts[m_size] = amount;
+        return m_size++;
+    }
+
+    void setAmount(unsigned index, float amount) {
+        assert(index < m_size);
+        if (m_amounts[index] == amount)
+            return;
+        m_amounts[index] = amount;
+        m_valid = std::min(m_valid, index);
+    }
+
+    float amount(unsigned index) const { assert(index < m_size); return m_amounts[index]; }
+    Function function(unsigned index) const { assert(index < m_size); return m_functions[index]; }
+    unsigned size() const { return m_size; }
+
+    /*!
+        Returns the combined matrix for the chain, or the identity if it is
+        empty.
+     */
+    mat4 matrix() {
+        if (m_size == 0)
+            return mat4();
+        for (unsigned i=m_valid; i<m_size; ++i) {
+            mat4 f = matrixFor(m_functions[i], m_amounts[i]);
+            m_products[i] = i == 0 ? f : ColorMatrix::compose(f, m_products[i - 1]);
+        }
+        m_valid = m_size;
+        return m_products[m_size - 1];
+    }
+
+    static mat4 matrixFor(Function function, float amount) {
+        switch (function) {
+        case Brightness: return ColorMatrix::brightness(amount);
+        case Contrast: return ColorMatrix::contrast(amount);
+        case Grayscale: return ColorMatrix::saturation(1 - amount);
+        case HueRotate: return ColorMatrix::hue(amount);
+        case Invert: return ColorMatrix::invert(amount);
+        case Saturate: return ColorMatrix::saturation(amount);
+        case Sepia: return ColorMatrix::sepia(amount);
+        }
+        assert(false);
+        return mat4();
+    }
+
+private:
+    Function m_functions[MaxFunctions];
+    float m_amounts[MaxFunctions];
+    mat4 m_products[MaxFunctions];      // functions 0 to i combined
+    unsigned m_size = 0;
+    unsigned m_valid = 0;               // number of up to date products
+};
+
 RENGINE_END_NAMESPACE
\ No newline at end of file
@@ -37,6 +37,7 @@
 
 #include <math.h>
 #include <cmath>
+#include <algorithm>
 #include <ostream>
 
 RENGINE_BEGIN_NAMESPACE
@@ -88,7 +89,7 @@ struct vec3 {
     vec3 operator*(const vec3 &v) const { return vec3(x*v.x, y*v.y, z*v.z); }
     vec3 operator/(const vec3 &v) const { return vec3(x/v.x, y/v.y, z/v.z); }
     vec3 operator+(const vec3 &o) const { return vec3(x+o.x, y+o.y, z+o.z); }
-    vec3 operator-(const vec3 &o) const { return vec3(x-o.x, y-o.y, z+o.z); }
+    vec3 operator-(const vec3 &o) const { return vec3(x-o.x, y-o.y, z-o.z); }
     vec3 operator-() const { return vec3(-x, -y, -z); }
     vec3 &operator+=(const vec3 &o) {
         x += o.x;
@@ -332,7 +333,7 @@ struct mat4 {
         return mat4(1, 0, 0, dx,
                     0, 1, 0, dy,
                     0, 0, 1, dz,
-                    0, 0, 0, 1, Translation2D);
+                    0, 0, 0, 1, dz == 0 ? Translation2D : Generic);
     }
 
     static mat4 rotateAroundZ(float radians) { return rotate2D(radians); }
@@ -359,11 +360,17 @@ struct mat4 {
         return mat4(sx,  0,  0, 0,
                      0, sy,  0, 0,
                      0,  0, sz, 0,
-                     0   ,   0, 1, Generic);
+                     0,  0,  0, 1, Generic);
     }
 
     bool isIdentity() const { return type == Identity; }
 
+    /*!
+        Returns true if this matrix only operates in the 2D plane and can be
+        represented as an affine2d without loss.
+     */
+    bool is2D() const { return type <= ScaleAndRotate2D; }
+
     float operator()(int c, int r) {
         return m[c*4 + r];
     }
@@ -444,6 +451,147 @@ public:
     vec2 br;
 };
 
+/*!
+    A compact 2x3 affine matrix for the 2D world, laid out in the same row
+    major order as the upper part of mat4:
+
+        m[0] m[1] m[2]      a  b  tx
+        m[3] m[4] m[5]  =   c  d  ty
+
+    This is what the scene graph uses for everything that is not below a 3D
+    projection. It is a quarter of the size of mat4 and multiplying two of
+    them is 12 multiplications rather than 64. The operations are written
+    as straight-line, branch-free code so the compiler can vectorize them.
+ */
+struct affine2d {
+
+    affine2d()
+        : m{ 1, 0, 0,
+             0, 1, 0 }
+    {
+    }
+
+    affine2d(float a, float b, float tx,
+             float c, float d, float ty)
+        : m{ a, b, tx,
+             c, d, ty }
+    {
+    }
+
+    /*!
+        Creates an affine2d from the 2D part of \a o. Any 3D components of
+        \a o are ignored; use mat4::is2D() to check if this is lossless.
+     */
+    explicit affine2d(const mat4 &o)
+        : m{ o.m[0], o.m[1], o.m[3],
+             o.m[4], o.m[5], o.m[7] }
+    {
+    }
+
+    /*!
+        Promotes this matrix to a mat4, for use with 3D and GL.
+     */
+    mat4 toMat4() const {
+        unsigned type = mat4::Identity;
+        if (m[2] != 0 || m[5] != 0)
+            type |= mat4::Translation2D;
+        if (m[1] != 0 || m[3] != 0)
+            type |= mat4::ScaleAndRotate2D;
+        else if (m[0] != 1 || m[4] != 1)
+            type |= mat4::Scale2D;
+        return mat4(m[0], m[1], 0, m[2],
+                    m[3], m[4], 0, m[5],
+                       0,    0, 1,    0,
+                       0,    0, 0,    1,
+                    type);
+    }
+
+    bool operator==(const affine2d &o) const {
+        return    m[0] == o.m[0]
+               && m[1] == o.m[1]
+               && m[2] == o.m[2]
+               && m[3] == o.m[3]
+               && m[4] == o.m[4]
+               && m[5] == o.m[5];
+    }
+
+    affine2d operator*(const affine2d &o) const {
+        return affine2d(m[0] * o.m[0] + m[1] * o.m[3],
+                        m[0] * o.m[1] + m[1] * o.m[4],
+                        m[0] * o.m[2] + m[1] * o.m[5] + m[2],
+                        m[3] * o.m[0] + m[4] * o.m[3],
+                        m[3] * o.m[1] + m[4] * o.m[4],
+                        m[3] * o.m[2] + m[4] * o.m[5] + m[5]);
+    }
+
+    vec2 operator*(const vec2 &v) const {
+        return vec2(m[0] * v.x + m[1] * v.y + m[2],
+                    m[3] * v.x + m[4] * v.y + m[5]);
+    }
+
+    /*!
+        Maps \a count points from \a src into \a dst. \a src and \a dst
+        may be the same.
+     */
+    void map(const vec2 *src, vec2 *dst, unsigned count) const {
+        const float a = m[0], b = m[1], tx = m[2];
+        const float c = m[3], d = m[4], ty = m[5];
+        for (unsigned i=0; i<count; ++i) {
+            const float x = src[i].x;
+            const float y = src[i].y;
+            dst[i].x = a * x + b * y + tx;
+            dst[i].y = c * x + d * y + ty;
+        }
+    }
+
+    /*!
+        Returns the bounding rectangle of \a r after it has been mapped
+        through this matrix.
+     */
+    rect2d mapBounds(const rect2d &r) const {
+        // Each output coordinate is a linear function of x and y, so the
+        // extremes are found by picking the min/max of each term separately.
+        const float ax1 = m[0] * r.tl.x, ax2 = m[0] * r.br.x;
+        const float by1 = m[1] * r.tl.y, by2 = m[1] * r.br.y;
+        const float cx1 = m[3] * r.tl.x, cx2 = m[3] * r.br.x;
+        const float dy1 = m[4] * r.tl.y, dy2 = m[4] * r.br.y;
+        return rect2d(std::min(ax1, ax2) + std::min(by1, by2) + m[2],
+                      std::min(cx1, cx2) + std::min(dy1, dy2) + m[5],
+                      std::max(ax1, ax2) + std::max(by1, by2) + m[2],
+                      std::max(cx1, cx2) + std::max(dy1, dy2) + m[5]);
+    }
+
+    /*!
+        Returns true if this matrix only translates and scales, meaning that
+        rectangles stay axis aligned.
+     */
+    bool isAxisAligned() const { return m[1] == 0 && m[3] == 0; }
+
+    bool isIdentity() const {
+        return m[0] == 1 && m[1] == 0 && m[2] == 0
+            && m[3] == 0 && m[4] == 1 && m[5] == 0;
+    }
+
+    static affine2d translate(float dx, float dy) {
+        return affine2d(1, 0, dx,
+                        0, 1, dy);
+    }
+
+    static affine2d scale(float sx, float sy) {
+        return affine2d(sx,  0, 0,
+                         0, sy, 0);
+    }
+
+    static affine2d rotate(float radians) {
+        float s = sin(radians);
+        float c = cos(radians);
+        return affine2d(c, -s, 0,
+                        s,  c, 0);
+    }
+
+    float m[6];
+};
+
 inline std::ostream &operator<<(std::ostream &o, const vec2 &v) {
     o << "vec2(" << v.x << ", " << v.y << ")";
     return o;
@@ -467,6 +615,14 @@ inline std::ostream &operator<<(std::ostream &o, const mat4 &m) {
     return o;
 }
 
+inline std::ostream &operator<<(std::ostream &o, const affine2d &m) {
+    o << "affine2d(" << m.m[0];
+    for (int i=1; i<6; ++i)
+        o << ", " << m.m[i];
+    o << ")";
+    return o;
+}
+
 inline std::ostream &operator<<(std::ostream &o, const rect2d &r) {
     o << "rect2d(" << r.tl << ", " << r.br << ")";
     return o;
@@ -0,0 +1,271 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Conversions for 32-bit RGBA pixel data, as produced by image decoders,
+    uploaded to textures and read back from the renderer. The pixels are 4
+    bytes each, in R, G, B, A order in memory.
+
+    Every function writes \a count pixels from \a src to \a dst, which may
+    be the same buffer to convert in place, or separate buffers to convert
+    while copying. The buffers need no particular alignment.
+
+    The SSE2 and NEON versions give the same results as the plain C++ ones
+    used elsewhere, or when RENGINE_NO_SIMD is defined.
+ */
+namespace pixels {
+
+/*!
+    Returns round(c * a / 255) without dividing.
+ */
+inline unsigned char multiply255(unsigned c, unsigned a)
+{
+    const unsigned x = c * a + 128;
+    return (unsigned char) ((x + (x >> 8)) >> 8);
+}
+
+/*!
+    Multiplies the color channels with alpha, rounding to nearest.
+ */
+inline void premultiply(unsigned char *dst, const unsigned char *src, unsigned count)
+{
+    unsigned i = 0;
+#if defined(RENGINE_SIMD_SSE)
+    // Channels are widened to 16 bits, where c * a + 128 still fits, and
+    // alpha is multiplied by 255 so it comes out unchanged.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i alpha255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    const __m128i half = _mm_set1_epi16(128);
+    for (; i+4<=count; i+=4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        __m128i halves[2] = { _mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero) };
+        for (__m128i &c : halves) {
+            __m128i a = _mm_shufflelo_epi16(_mm_shufflehi_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            a = _mm_or_si128(_mm_andnot_si128(alphaMask, a), alpha255);
+            const __m128i x = _mm_add_epi16(_mm_mullo_epi16(c, a), half);
+            c = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+        }
+        _mm_storeu_si128((__m128i *) (dst + i * 4), _mm_packus_epi16(halves[0], halves[1]));
+    }
+#elif defined(RENGINE_SIMD_NEON)
+    for (; i+16<=count; i+=16) {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        for (int c=0; c<3; ++c) {
+            const uint16x8_t lo = vmull_u8(vget_low_u8(v.val[c]), vget_low_u8(v.val[3]));
+            const uint16x8_t hi = vmull_u8(vget_high_u8(v.val[c]), vget_high_u8(v.val[3]));
+            v.val[c] = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                                   vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+        }
+        vst4q_u8(dst + i * 4, v);
+    }
+#endif
+    for (; i<count; ++i) {
+        const unsigned char *s = src + i * 4;
+        unsigned char *d = dst + i * 4;
+        const unsigned a = s[3];
+        d[0] = multiply255(s[0], a);
+        d[1] = multiply255(s[1], a);
+        d[2] = multiply255(s[2], a);
+        d[3] = a;
+    }
+}
+
+inline void premultiply(unsigned char *rgba, unsigned count) { premultiply(rgba, rgba, count); }
+
+/*!
+    Divides the color channels by alpha, rounding to nearest and clamping
+    to 255. Fully transparent pixels become 0.
+ */
+inline void unpremultiply(unsigned char *dst, const unsigned char *src, unsigned count)
+{
+    unsigned i = 0;
+#if defined(RENGINE_SIMD_SSE) || (defined(RENGINE_SIMD_NEON) && defined(__aarch64__))
+    // One pixel per float register, with the same float math as below. 32-bit
+    // NEON has no float division, so it uses the plain loop.
+    for (; i+4<=count; i+=4) {
+#if defined(RENGINE_SIMD_SSE)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i p[4] = { _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                         _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero) };
+        for (__m128i &c : p) {
+            const __m128 cf = _mm_cvtepi32_ps(c);
+            const __m128 af = _mm_shuffle_ps(cf, cf, _MM_SHUFFLE(3, 3, 3, 3));
+            // 255 / a for the colors and a / a for alpha; a == 0 gives inf
+            // or nan, which are masked away.
+            __m128 f = _mm_div_ps(_mm_set_ps(0, 255, 255, 255), af);
+            f = _mm_and_ps(f, _mm_cmpgt_ps(af, _mm_setzero_ps()));
+            const __m128 r = _mm_add_ps(_mm_mul_ps(cf, f), _mm_set_ps(0, 0.5f, 0.5f, 0.5f));
+            c = _mm_cvttps_epi32(_mm_min_ps(r, _mm_set1_ps(255)));
+            // Alpha is passed through
+            c = _mm_or_si128(_mm_and_si128(c, _mm_set_epi32(0, -1, -1, -1)),
+                             _mm_and_si128(_mm_cvttps_epi32(cf), _mm_set_epi32(-1, 0, 0, 0)));
+        }
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(p[0], p[1]), _mm_packs_epi32(p[2], p[3]));
+        _mm_storeu_si128((__m128i *) (dst + i * 4), packed);
+#else
+        const uint8x16_t v = vld1q_u8(src + i * 4);
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        const uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        uint32x4_t p[4] = { vmovl_u16(vget_low_u16(lo)), vmovl_u16(vget_high_u16(lo)),
+                            vmovl_u16(vget_low_u16(hi)), vmovl_u16(vget_high_u16(hi)) };
+        const float32x4_t scale = { 255, 255, 255, 0 };
+        const float32x4_t round = { 0.5f, 0.5f, 0.5f, 0 };
+        const uint32x4_t colorMask = { ~0u, ~0u, ~0u, 0 };
+        for (uint32x4_t &c : p) {
+            const float32x4_t cf = vcvtq_f32_u32(c);
+            const float32x4_t af = vdupq_n_f32(vgetq_lane_f32(cf, 3));
+            float32x4_t f = vdivq_f32(scale, af);
+            f = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(f), vcgtq_f32(af, vdupq_n_f32(0))));
+            const float32x4_t r = vminq_f32(vaddq_f32(vmulq_f32(cf, f), round), vdupq_n_f32(255));
+            c = vbslq_u32(colorMask, vcvtq_u32_f32(r), c);
+        }
+        const uint16x8_t plo = vcombine_u16(vmovn_u32(p[0]), vmovn_u32(p[1]));
+        const uint16x8_t phi = vcombine_u16(vmovn_u32(p[2]), vmovn_u32(p[3]));
+        vst1q_u8(dst + i * 4, vcombine_u8(vmovn_u16(plo), vmovn_u16(phi)));
+#endif
+    }
+#endif
+    for (; i<count; ++i) {
+        const unsigned char *s = src + i * 4;
+        unsigned char *d = dst + i * 4;
+        const unsigned char a = s[3];
+        const float f = a > 0 ? 255.0f / a : 0.0f;
+        for (int c=0; c<3; ++c) {
+            const float r = s[c] * f + 0.5f;
+            d[c] = (unsigned char) (r < 255 ? r : 255);
+        }
+        d[3] = a;
+    }
+}
+
+inline void unpremultiply(unsigned char *rgba, unsigned count) { unpremultiply(rgba, rgba, count); }
+
+/*!
+    Swaps the red and blue channels, converting between RGBA and BGRA.
+ */
+inline void swapRedAndBlue(unsigned char *dst, const unsigned char *src, unsigned count)
+{
+    unsigned i = 0;
+#if defined(RENGINE_SIMD_SSE)
+    // Little endian, so each pixel is 0xAABBGGRR in a 32-bit lane
+    const __m128i greenAlpha = _mm_set1_epi32(0xff00ff00);
+    const __m128i low = _mm_set1_epi32(0x000000ff);
+    for (; i+4<=count; i+=4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        const __m128i swapped = _mm_or_si128(_mm_and_si128(v, greenAlpha),
+                                             _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low),
+                                                          _mm_slli_epi32(_mm_and_si128(v, low), 16)));
+        _mm_storeu_si128((__m128i *) (dst + i * 4), swapped);
+    }
+#elif defined(RENGINE_SIMD_NEON)
+    for (; i+16<=count; i+=16) {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        const uint8x16_t r = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = r;
+        vst4q_u8(dst + i * 4, v);
+    }
+#endif
+    for (; i<count; ++i) {
+        const unsigned char *s = src + i * 4;
+        unsigned char *d = dst + i * 4;
+        const unsigned char r = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = r;
+        d[3] = s[3];
+    }
+}
+
+inline void swapRedAndBlue(unsigned char *rgba, unsigned count) { swapRedAndBlue(rgba, rgba, count); }
+
+/*!
+    Sets alpha to 255, turning RGBx data with undefined fourth bytes into
+    opaque RGBA.
+ */
+inline void fillAlpha(unsigned char *dst, const unsigned char *src, unsigned count)
+{
+    unsigned i = 0;
+#if defined(RENGINE_SIMD_SSE) || defined(RENGINE_SIMD_NEON)
+    for (; i+4<=count; i+=4) {
+#if defined(RENGINE_SIMD_SSE)
+        const __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        _mm_storeu_si128((__m128i *) (dst + i * 4), _mm_or_si128(v, _mm_set1_epi32(0xff000000)));
+#else
+        const uint8x16_t alpha = vreinterpretq_u8_u32(vdupq_n_u32(0xff000000));
+        vst1q_u8(dst + i * 4, vorrq_u8(vld1q_u8(src + i * 4), alpha));
+#endif
+    }
+#endif
+    if (dst != src)
+        memcpy(dst + i * 4, src + i * 4, (count - i) * 4);
+    for (; i<count; ++i)
+        dst[i * 4 + 3] = 255;
+}
+
+inline void fillAlpha(unsigned char *rgba, unsigned count) { fillAlpha(rgba, rgba, count); }
+
+/*!
+    Writes the \a height lines of \a bytesPerLine bytes each in \a src to
+    \a dst in reverse order, converting between top-down images and
+    OpenGL's bottom-up framebuffer.
+ */
+inline void flipLines(unsigned char *dst, const unsigned char *src, unsigned bytesPerLine, unsigned height)
+{
+    if (dst == src) {
+        // Swap through a small buffer; memcpy beats swapping byte by byte
+        unsigned char buffer[1024];
+        for (unsigned y=0; y<height/2; ++y) {
+            unsigned char *a = dst + y * bytesPerLine;
+            unsigned char *b = dst + (height - y - 1) * bytesPerLine;
+            for (unsigned x=0; x<bytesPerLine; x+=sizeof(buffer)) {
+                const unsigned n = std::min<unsigned>(sizeof(buffer), bytesPerLine - x);
+                memcpy(buffer, a + x, n);
+                memcpy(a + x, b + x, n);
+                memcpy(b + x, buffer, n);
+            }
+        }
+    } else {
+        for (unsigned y=0; y<height; ++y)
+            memcpy(dst + y * bytesPerLine, src + (height - y - 1) * bytesPerLine, bytesPerLine);
+    }
+}
+
+inline void flipLines(unsigned char *pixels, unsigned bytesPerLine, unsigned height) { flipLines(pixels, pixels, bytesPerLine, height); }
+
+} // pixels
+
+RENGINE_END_NAMESPACE
@@ -0,0 +1,100 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#if !defined(RENGINE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RENGINE_SIMD_SSE
+#include <emmintrin.h>
+#elif !defined(RENGINE_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define RENGINE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Vectorized kernels for the hot loops in the engine, using SSE2 on x86
+    and NEON on ARM, with a plain C++ fallback elsewhere. Define
+    RENGINE_NO_SIMD to always use the fallback.
+
+    The kernels operate on arrays of floats and make no assumptions about
+    alignment.
+ */
+namespace simd {
+
+/*!
+    Blends \a count values of \a components floats each, placed \a stride
+    floats apart:
+
+        out[i] = from[i] + delta[i] * t[i]
+
+    Values of 2 or a multiple of 4 components are vectorized.
+ */
+inline void blend(float *out, const float *from, const float *delta, const float *t,
+                  unsigned count, unsigned components, unsigned stride)
+{
+    unsigned i = 0;
+#if defined(RENGINE_SIMD_SSE) || defined(RENGINE_SIMD_NEON)
+    if (components % 4 == 0) {
+        for (; i<count; ++i) {
+            const unsigned o = i * stride;
+#if defined(RENGINE_SIMD_SSE)
+            const __m128 tv = _mm_set1_ps(t[i]);
+            for (unsigned c=0; c<components; c+=4)
+                _mm_storeu_ps(out + o + c, _mm_add_ps(_mm_loadu_ps(from + o + c),
+                                                      _mm_mul_ps(_mm_loadu_ps(delta + o + c), tv)));
+#else
+            for (unsigned c=0; c<components; c+=4)
+                vst1q_f32(out + o + c, vmlaq_n_f32(vld1q_f32(from + o + c), vld1q_f32(delta + o + c), t[i]));
+#endif
+        }
+        return;
+    }
+    if (components == 2 && stride == 2) {
+        // Two values per register
+        for (; i+1<count; i+=2) {
+            const unsigned o = i * 2;
+#if defined(RENGINE_SIMD_SSE)
+            const __m128 tv = _mm_set_ps(t[i+1], t[i+1], t[i], t[i]);
+            _mm_storeu_ps(out + o, _mm_add_ps(_mm_loadu_ps(from + o),
+                                              _mm_mul_ps(_mm_loadu_ps(delta + o), tv)));
+#else
+            const float32x4_t tv = vcombine_f32(vdup_n_f32(t[i]), vdup_n_f32(t[i+1]));
+            vst1q_f32(out + o, vmlaq_f32(vld1q_f32(from + o), vld1q_f32(delta + o), tv));
+#endif
+        }
+    }
+#endif
+    for (; i<count; ++i) {
+        const unsigned o = i * stride;
+        for (unsigned c=0; c<components; ++c)
+            out[o + c] = from[o + c] + delta[o + c] * t[i];
+    }
+}
+
+} // simd
+
+RENGINE_END_NAMESPACE
@@ -0,0 +1,286 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cmath>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    A transform split into the components CSS uses to interpolate matrices:
+    perspective, translation, rotation, skew and scale, such that
+
+        matrix = perspective * translate * rotate * skew * scale
+
+    The rotation is a unit quaternion (x, y, z, w) and the skew holds the XY,
+    XZ and YZ shear factors.
+
+    Matrices with a singular 3x3 part, such as a zero scale, can't be
+    decomposed; isValid() returns false for those and interpolate() switches
+    from one matrix to the other halfway through instead, as CSS does.
+ */
+struct DecomposedTransform
+{
+    DecomposedTransform()
+        : perspective(0, 0, 0, 1)
+        , translation(0, 0, 0)
+        , quaternion(0, 0, 0, 1)
+        , skew(0, 0, 0)
+        , scale(1, 1, 1)
+        , valid(true)
+    {
+    }
+
+    explicit DecomposedTransform(const mat4 &m)
+        : matrix(m)
+    {
+        valid = decompose(m);
+    }
+
+    bool isValid() const { return valid; }
+
+    inline bool decompose(const mat4 &m);
+    inline mat4 recompose() const;
+
+    static inline mat4 interpolate(const DecomposedTransform &a, const DecomposedTransform &b, double t);
+
+    vec4 perspective;
+    vec3 translation;
+    vec4 quaternion;
+    vec3 skew;
+    vec3 scale;
+
+    mat4 matrix;        // the matrix which was decomposed
+    bool valid;
+};
+
+inline bool DecomposedTransform::decompose(const mat4 &in)
+{
+    if (in.m[15] == 0)
+        return false;
+
+    float m[16];
+    for (int i=0; i<16; ++i)
+        m[i] = in.m[i] / in.m[15];
+
+    // The upper 3x3 part, as columns
+    vec3 c0(m[0], m[4], m[8]);
+    vec3 c1(m[1], m[5], m[9]);
+    vec3 c2(m[2], m[6], m[10]);
+    translation = vec3(m[3], m[7], m[11]);
+
+    auto dot = [] (const vec3 &a, const vec3 &b) { return a.x * b.x + a.y * b.y + a.z * b.z; };
+    auto cross = [] (const vec3 &a, const vec3 &b) {
+        return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    };
+    auto combine = [] (const vec3 &a, const vec3 &b, float s) {
+        return vec3(a.x + b.x * s, a.y + b.y * s, a.z + b.z * s);
+    };
+    auto scaled = [] (const vec3 &a, float s) { return vec3(a.x * s, a.y * s, a.z * s); };
+
+    const float det = dot(c0, cross(c1, c2));
+    if (det == 0)
+        return false;
+
+    // With column vectors the perspective is in the last row. Solve for
+    // the (p, w) which turns the affine part into the full matrix.
+    if (m[12] != 0 || m[13] != 0 || m[14] != 0) {
+        // Row vector times the inverse of the 3x3 part. The rows of the
+        // inverse are the cross products of the columns over det.
+        const vec3 a0 = cross(c1, c2);
+        const vec3 a1 = cross(c2, c0);
+        const vec3 a2 = cross(c0, c1);
+        const float r0 = m[12] / det;
+        const float r1 = m[13] / det;
+        const float r2 = m[14] / det;
+        const vec3 p(r0 * a0.x + r1 * a1.x + r2 * a2.x,
+                     r0 * a0.y + r1 * a1.y + r2 * a2.y,
+                     r0 * a0.z + r1 * a1.z + r2 * a2.z);
+        perspective = vec4(p.x, p.y, p.z, 1 - dot(p, translation));
+    } else {
+        perspective = vec4(0, 0, 0, 1);
+    }
+
+    // Gram-Schmidt on the columns gives rotate * skew * scale
+    scale.x = sqrt(dot(c0, c0));
+    c0 = scaled(c0, 1 / scale.x);
+
+    skew.x = dot(c0, c1);
+    c1 = combine(c1, c0, -skew.x);
+    scale.y = sqrt(dot(c1, c1));
+    c1 = scaled(c1, 1 / scale.y);
+    skew.x /= scale.y;
+
+    skew.y = dot(c0, c2);
+    c2 = combine(c2, c0, -skew.y);
+    skew.z = dot(c1, c2);
+    c2 = combine(c2, c1, -skew.z);
+    scale.z = sqrt(dot(c2, c2));
+    c2 = scaled(c2, 1 / scale.z);
+    skew.y /= scale.z;
+    skew.z /= scale.z;
+
+    // The columns are now orthonormal. If they form a left-handed system,
+    // an axis was flipped. For 2D transforms, flip x back so the rotation
+    // stays around z; otherwise negate the rotation and the scale.
+    if (dot(c0, cross(c1, c2)) < 0) {
+        if (in.is2D()) {
+            scale.x = -scale.x;
+            skew.x = -skew.x;
+            skew.y = -skew.y;
+            c0 = scaled(c0, -1);
+        } else {
+            scale = vec3(-scale.x, -scale.y, -scale.z);
+            c0 = scaled(c0, -1);
+            c1 = scaled(c1, -1);
+            c2 = scaled(c2, -1);
+        }
+    }
+
+    // Rotation matrix to quaternion, R(r, c) is c<c>[r]
+    quaternion.x = 0.5 * sqrt(std::max(1 + c0.x - c1.y - c2.z, 0.0f));
+    quaternion.y = 0.5 * sqrt(std::max(1 - c0.x + c1.y - c2.z, 0.0f));
+    quaternion.z = 0.5 * sqrt(std::max(1 - c0.x - c1.y + c2.z, 0.0f));
+    quaternion.w = 0.5 * sqrt(std::max(1 + c0.x + c1.y + c2.z, 0.0f));
+    if (c1.z < c2.y)
+        quaternion.x = -quaternion.x;
+    if (c2.x < c0.z)
+        quaternion.y = -quaternion.y;
+    if (c0.y < c1.x)
+        quaternion.z = -quaternion.z;
+
+    return true;
+}
+
+inline mat4 DecomposedTransform::recompose() const
+{
+    if (!valid)
+        return matrix;
+
+    const float x = quaternion.x;
+    const float y = quaternion.y;
+    const float z = quaternion.z;
+    const float w = quaternion.w;
+
+    // Columns of the rotation..
+    vec3 r0(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w));
+    vec3 r1(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w));
+    vec3 r2(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y));
+
+    // .. times skew, times scale
+    vec3 c0(r0.x * scale.x,
+            r0.y * scale.x,
+            r0.z * scale.x);
+    vec3 c1((r0.x * skew.x + r1.x) * scale.y,
+            (r0.y * skew.x + r1.y) * scale.y,
+            (r0.z * skew.x + r1.z) * scale.y);
+    vec3 c2((r0.x * skew.y + r1.x * skew.z + r2.x) * scale.z,
+            (r0.y * skew.y + r1.y * skew.z + r2.y) * scale.z,
+            (r0.z * skew.y + r1.z * skew.z + r2.z) * scale.z);
+
+    const vec3 &t = translation;
+    const vec4 &p = perspective;
+    return mat4(c0.x, c1.x, c2.x, t.x,
+                c0.y, c1.y, c2.y, t.y,
+                c0.z, c1.z, c2.z, t.z,
+                p.x * c0.x + p.y * c0.y + p.z * c0.z,
+                p.x * c1.x + p.y * c1.y + p.z * c1.z,
+                p.x * c2.x + p.y * c2.y + p.z * c2.z,
+                p.x * t.x + p.y * t.y + p.z * t.z + p.w);
+}
+
+/*!
+    Interpolates between the transforms \a a and \a b, where \a t is in the
+    range [0, 1]. The rotation is spherically interpolated and takes the
+    shorter way around; the other components are interpolated linearly.
+
+    Transforms which only translate and scale in 2D are interpolated
+    directly, which gives the same result for less work. Interpolating
+    between 2D transforms stays in the plane and keeps their 2D type, so the
+    renderer's fast paths still apply.
+ */
+inline mat4 DecomposedTransform::interpolate(const DecomposedTransform &a, const DecomposedTransform &b, double t)
+{
+    const unsigned type = a.matrix.type | b.matrix.type;
+    if (type <= (mat4::Translation2D | mat4::Scale2D)) {
+        mat4 r;
+        for (int i=0; i<16; ++i)
+            r.m[i] = a.matrix.m[i] + (b.matrix.m[i] - a.matrix.m[i]) * t;
+        r.type = type;
+        return r;
+    }
+
+    if (!a.valid || !b.valid)
+        return t < 0.5 ? a.matrix : b.matrix;
+
+    auto mix3 = [t] (const vec3 &u, const vec3 &v) {
+        return vec3(u.x + (v.x - u.x) * t, u.y + (v.y - u.y) * t, u.z + (v.z - u.z) * t);
+    };
+
+    DecomposedTransform d;
+    d.translation = mix3(a.translation, b.translation);
+    d.scale = mix3(a.scale, b.scale);
+    d.skew = mix3(a.skew, b.skew);
+    d.perspective = a.perspective + (b.perspective - a.perspective) * t;
+
+    // Slerp, flipping b if needed to take the shorter way around
+    vec4 qa = a.quaternion;
+    vec4 qb = b.quaternion;
+    double product = qa.x * qb.x + qa.y * qb.y + qa.z * qb.z + qa.w * qb.w;
+    if (product < 0) {
+        qb = -qb;
+        product = -product;
+    }
+    product = std::min(product, 1.0);
+    double sa = 1 - t;
+    double sb = t;
+    if (product < 0.9999) {
+        const double theta = acos(product);
+        const double s = 1 / sin(theta);
+        sa = sin((1 - t) * theta) * s;
+        sb = sin(t * theta) * s;
+    }
+    d.quaternion = vec4(qa.x * sa + qb.x * sb,
+                        qa.y * sa + qb.y * sb,
+                        qa.z * sa + qb.z * sb,
+                        qa.w * sa + qb.w * sb);
+    const float length = sqrt(d.quaternion.x * d.quaternion.x + d.quaternion.y * d.quaternion.y
+                              + d.quaternion.z * d.quaternion.z + d.quaternion.w * d.quaternion.w);
+    d.quaternion = vec4(d.quaternion.x / length, d.quaternion.y / length,
+                        d.quaternion.z / length, d.quaternion.w / length);
+
+    mat4 r = d.recompose();
+    if (type <= mat4::ScaleAndRotate2D) {
+        // Both rotations are around z, so this only cleans up rounding
+        r.m[2] = r.m[6] = r.m[8] = r.m[9] = r.m[11] = 0;
+        r.m[12] = r.m[13] = r.m[14] = 0;
+        r.m[10] = r.m[15] = 1;
+        r.type = type;
+    }
+    return r;
+}
+
+RENGINE_END_NAMESPACE
@@ -13,6 +13,7 @@ struct vec2;
 struct vec3;
 struct vec4;
 struct mat4;
+struct affine2d;
 
 // 'windowsystem' subdir
 class Surface;
@@ -43,19 +44,26 @@ RENGINE_END_NAMESPACE
 #include "common/mathtypes.h"
 #include "common/allocationpool.h"
 #include "common/colormatrix.h"
+#include "common/simd.h"
+#include "common/pixels.h"
+#include "common/transforminterpolation.h"
 
 #include "windowsystem/surface.h"
 
 #include "scenegraph/opengl.h"
 #include "scenegraph/node.h"
+#include "scenegraph/noderecycler.h"
 #include "scenegraph/texture.h"
+#include "scenegraph/texturecompression.h"
 #include "scenegraph/renderer.h"
 #include "scenegraph/openglshaderprogram.h"
 #include "scenegraph/openglrenderer.h"
 #include "scenegraph/opengltexture.h"
+#include "scenegraph/textureloader.h"
 
 #include "animationsystem/animation.h"
 #include "animationsystem/animationappliers.h"
+#include "animationsystem/compositoranimations.h"
 
 #include "backend.h"
 
@@ -26,12 +26,26 @@
 #pragma once
 
 #include <assert.h>
+#include <atomic>
 #include <vector>
 #include <algorithm>
 #include <iostream>
 
 RENGINE_BEGIN_NAMESPACE
 
+/*!
+    The built-in node types use the single-threaded AllocationPool unless
+    rengine is built with RENGINE_CONCURRENT_NODE_ALLOCATION, in which case
+    they can be created and destroyed from any thread. Custom node types
+    choose per type by using either RENGINE_ALLOCATION_POOL_DECLARATION or
+    RENGINE_CONCURRENT_ALLOCATION_POOL_DECLARATION.
+ */
+#ifdef RENGINE_CONCURRENT_NODE_ALLOCATION
+#define RENGINE_NODE_ALLOCATION_POOL_DECLARATION(Type) RENGINE_CONCURRENT_ALLOCATION_POOL_DECLARATION(Type)
+#else
+#define RENGINE_NODE_ALLOCATION_POOL_DECLARATION(Type) RENGINE_ALLOCATION_POOL_DECLARATION(Type)
+#endif
+
 class Node {
 public:
     enum Type {
@@ -46,14 +60,10 @@ public:
     };
 
     /*!
-     * Searches this node's list of children and returns true if \a child is a
-     * child of this node.
+     * Returns true if \a child is a child of this node.
      */
-    bool hasChild(Node *child) {
-        Node *n = m_child;
-        while (n && n != child)
-            n = n->m_sibling;
-        return n;
+    bool hasChild(Node *child) const {
+        return child && child->m_parent == this;
     }
 
     /*!
@@ -62,21 +72,7 @@ public:
      * It is an error to add a child which already has a parent
      * or is already a child of this node.
      */
-    void append(Node *child) {
-        assert(!hasChild(child));
-        assert(child->m_parent == 0);
-        assert(child->m_sibling == 0);
-        if (!m_lastChild) {
-            assert(!m_child);
-            m_child = child;
-            m_lastChild = child;
-        } else {
-            assert(m_child);
-            m_lastChild->m_sibling = child;
-            m_lastChild = child;
-        }
-        child->setParent(this);
-    }
+    void append(Node *child) { insertAfter(child, m_lastChild); }
 
     Node &operator<<(Node *child) { append(child); return *this; }
 
@@ -86,20 +82,30 @@ public:
      * It is an error to add a child which already has a parent
      * or is already a child of this node.
      */
-    void prepend(Node *child) {
-        assert(!hasChild(child));
-        assert(child->m_parent == 0);
-        assert(child->m_sibling == 0);
-        if (!m_child) {
-            assert(!m_lastChild);
-            m_child = child;
-            m_lastChild = child;
-        } else {
-            assert(m_lastChild);
-            child->m_sibling = m_child;
-            m_child = child;
-        }
-        child->setParent(this);
+    void prepend(Node *child) { insertBefore(child, m_child); }
+
+    /*!
+     * Adds \a child to this node's list of children, right in front of
+     * \a before. If \a before is null, \a child is added at the end.
+     *
+     * It is an error to add a child which already has a parent, or to pass
+     * a \a before which is not a child of this node.
+     */
+    void insertBefore(Node *child, Node *before) {
+        assert(!before || hasChild(before));
+        link(child, before ? before->m_prevSibling : m_lastChild);
+    }
+
+    /*!
+     * Adds \a child to this node's list of children, right after \a after.
+     * If \a after is null, \a child is added at the front.
+     *
+     * It is an error to add a child which already has a parent, or to pass
+     * an \a after which is not a child of this node.
+     */
+    void insertAfter(Node *child, Node *after) {
+        assert(!after || hasChild(after));
+        link(child, after);
     }
 
     /*!
@@ -109,26 +115,28 @@ public:
      * this node.
      */
     void remove(Node *child) {
-        assert(child);
-        assert(hasChild(child));
+        unlink(child);
+    }
 
-        if (m_child == child) {
-            m_child = m_child->m_sibling;
-            if (child == m_lastChild)
-                m_lastChild = 0;
-        } else {
-            Node *n = m_child;
-            while (n->m_sibling != child) {
-                n = n->m_sibling;
-                assert(n);
-            }
-            n->m_sibling = child->m_sibling;
-            if (child == m_lastChild) {
-                m_lastChild = n;
-                assert(n->m_sibling == 0);
-            }
+    /*!
+     * Destroys all children of this node and their subtrees.
+     *
+     * The children are detached in one go, so unlike calling remove() and
+     * destroy() on each of them, no sibling links are updated along the way.
+     */
+    void destroyChildren() {
+        Node *c = m_child;
+        m_child = 0;
+        m_lastChild = 0;
+        m_childCount = 0;
+        while (c) {
+            Node *next = c->m_sibling;
+            c->m_sibling = 0;
+            c->m_prevSibling = 0;
+            c->m_parent = 0;
+            c->destroy();
+            c = next;
         }
-        child->setParent(0);
     }
 
     // /*!
@@ -173,15 +181,7 @@ public:
     /*!
      * Returns the number of children in this node
      */
-    int childCount() const {
-        int c = 0;
-        Node *n = m_child;
-        while (n) {
-            ++c;
-            n = n->m_sibling;
-        }
-        return c;
-    }
+    int childCount() const { return m_childCount; }
 
     /*!
      * Returns this node's parent node.
@@ -189,7 +189,9 @@ public:
     Node *parent() const { return m_parent; }
 
     Node *sibling() const { return m_sibling; }
+    Node *previousSibling() const { return m_prevSibling; }
     Node *child() const { return m_child; }
+    Node *lastChild() const { return m_lastChild; }
 
     /*!
      * Returns this node's type.
@@ -222,6 +224,19 @@ public:
         }
     }
 
+    /*!
+     * Returns the number of the last frame in which the renderer drew this
+     * node or something below it, or 0 if it has never been drawn. Nodes
+     * which are detached, below a fully transparent OpacityNode or outside
+     * the surface are not drawn. See Renderer::frameNumber().
+     */
+    unsigned renderedFrame() const { return m_renderedFrame; }
+
+    /*!
+     * For use by renderers, see renderedFrame().
+     */
+    void setRenderedFrame(unsigned frame) { m_renderedFrame = frame; }
+
     static void dump(Node *n, unsigned level = 0)
     {
         for (unsigned x=0; x<level; ++x) std::cout << " ";
@@ -241,10 +256,12 @@ public:
         }
     }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(Node);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(Node);
 
     void __mark_as_pool_allocated() { m_poolAllocated = true; }
     bool __is_pool_allocated() const { return m_poolAllocated; }
+    void __mark_as_arena_allocated() { m_arenaAllocated = true; }
+    bool __is_arena_allocated() const { return m_arenaAllocated; }
 
 protected:
     virtual void onPreprocess() { }
@@ -257,9 +274,13 @@ protected:
         , m_child(0)
         , m_lastChild(0)
         , m_sibling(0)
+        , m_prevSibling(0)
         , m_type(type)
         , m_preprocess(false)
         , m_poolAllocated(false)
+        , m_arenaAllocated(false)
+        , m_childCount(0)
+        , m_renderedFrame(0)
     {
     }
 
@@ -270,11 +291,60 @@ protected:
      */
     virtual ~Node() {
         if (m_parent)
-            m_parent->remove(this);
-        while (m_child)
-            m_child->destroy();
+            m_parent->unlink(this);
+        destroyChildren();
+    }
+
+    /*!
+     * Removes \a child from this node's list of children without touching
+     * the child's subtree. Used by remove() and by the destructor, where
+     * the child is already partially destroyed.
+     */
+    void unlink(Node *child) {
+        assert(child);
+        assert(hasChild(child));
+
+        if (child->m_prevSibling)
+            child->m_prevSibling->m_sibling = child->m_sibling;
+        else
+            m_child = child->m_sibling;
+        if (child->m_sibling)
+            child->m_sibling->m_prevSibling = child->m_prevSibling;
+        else
+            m_lastChild = child->m_prevSibling;
+        --m_childCount;
+
+        child->m_sibling = 0;
+        child->m_prevSibling = 0;
+        child->setParent(0);
     }
 
+    /*!
+     * Adds \a child to this node's list of children after \a prev, or at
+     * the front if \a prev is null.
+     */
+    void link(Node *child, Node *prev) {
+        assert(child);
+        assert(child != this);
+        assert(child->m_parent == 0);
+        assert(child->m_sibling == 0 && child->m_prevSibling == 0);
+        assert(!prev || prev->m_parent == this);
+
+        Node *next = prev ? prev->m_sibling : m_child;
+        child->m_prevSibling = prev;
+        child->m_sibling = next;
+        if (prev)
+            prev->m_sibling = child;
+        else
+            m_child = child;
+        if (next)
+            next->m_prevSibling = child;
+        else
+            m_lastChild = child;
+        ++m_childCount;
+
+        child->setParent(this);
+    }
 
 
     /*!
@@ -292,10 +362,16 @@ protected:
     Node *m_child;
     Node *m_lastChild;
     Node *m_sibling;
+    Node *m_prevSibling;
+
+    friend class NodeRecycler;
 
     Type m_type : 4;
     unsigned m_preprocess : 1;
     unsigned m_poolAllocated : 1;
+    unsigned m_arenaAllocated : 1;
+    unsigned m_childCount;
+    unsigned m_renderedFrame;
 };
 
 class OpacityNode : public Node {
@@ -305,7 +381,7 @@ public:
     float opacity() const { return m_opacity; }
     void setOpacity(float opacity) { m_opacity = opacity; }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(OpacityNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(OpacityNode);
 
     static OpacityNode *create(float opacity) {
         auto node = create();
@@ -330,12 +406,89 @@ public:
     enum { StaticType = TransformNodeType };
 
     const mat4 &matrix() const { return m_matrix; }
-    void setMatrix(const mat4 &m) { m_matrix = m; }
+    void setMatrix(const mat4 &m) {
+        m_matrix = m;
+        m_worldDirty = true;
+    }
 
     float projectionDepth() const { return m_projectionDepth; }
-    void setProjectionDepth(float d) { m_projectionDepth = d; }
+    void setProjectionDepth(float d) {
+        m_projectionDepth = d;
+        m_worldDirty = true;
+    }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(TransformNode);
+    /*!
+     * Returns the accumulated 2D matrix which applies to this node's
+     * children, relative to the root of the tree. Below a 3D projection,
+     * this is the 2D matrix of the projection's parent and the 3D part is
+     * found in worldMatrix3D().
+     *
+     * Outside a 3D projection subtree, only the 2D part of matrix() is
+     * used. Use setProjectionDepth() to enable 3D.
+     *
+     * The value is cached and only recomputed when this node or one of its
+     * ancestors has changed, so it is cheap to use for hit-testing and
+     * culling. Changes are not pushed down the tree; instead each node
+     * remembers the version of its nearest TransformNode ancestor's world
+     * transform it was computed from and compares it on access. Changing a
+     * matrix or moving a subtree is therefore O(1), and a lookup walks the
+     * ancestors.
+     */
+    const affine2d &worldMatrix() const { updateWorldTransform(); return m_worldMatrix; }
+
+    /*!
+     * Returns the accumulated 3D matrix which applies to this node's
+     * children inside a 3D projection subtree. Identity when the node is
+     * not part of a 3D subtree.
+     */
+    const mat4 &worldMatrix3D() const { updateWorldTransform(); return m_worldMatrix3D; }
+
+    /*!
+     * Returns the far plane of the 3D projection this node is part of, or
+     * 0 if the node is not inside a 3D subtree.
+     */
+    float worldProjectionDepth() const { updateWorldTransform(); return m_worldProjectionDepth; }
+
+    /*!
+     * Returns true if the cached world transform needs to be recomputed
+     * because this node or one of its TransformNode ancestors has changed,
+     * or because the node has been moved.
+     */
+    bool isWorldTransformDirty() const {
+        if (m_worldDirty)
+            return true;
+        const TransformNode *p = transformParent();
+        if (!p)
+            return m_parentWorldVersion != 0;
+        return p->isWorldTransformDirty() || p->m_worldVersion != m_parentWorldVersion;
+    }
+
+    /*!
+     * Recomputes the cached world transform from \a parent, the nearest
+     * TransformNode above this one or 0 if there is none, if either has
+     * changed. \a parent must be up to date. For use by renderers which
+     * already traverse the tree top-down and have the parent at hand.
+     */
+    void updateWorldTransform(const TransformNode *parent) const {
+        const unsigned long long parentVersion = parent ? parent->m_worldVersion : 0;
+        if (!m_worldDirty && m_parentWorldVersion == parentVersion)
+            return;
+        const float parentProjectionDepth = parent ? parent->m_worldProjectionDepth : 0;
+        m_worldMatrix = parent ? parent->m_worldMatrix : affine2d();
+        m_worldMatrix3D = parent ? parent->m_worldMatrix3D : mat4();
+        m_worldProjectionDepth = parentProjectionDepth;
+        if (m_projectionDepth && !parentProjectionDepth)
+            m_worldProjectionDepth = m_projectionDepth;
+        if (m_worldProjectionDepth)
+            m_worldMatrix3D = m_worldMatrix3D * m_matrix;
+        else
+            m_worldMatrix = m_worldMatrix * affine2d(m_matrix);
+        m_parentWorldVersion = parentVersion;
+        m_worldVersion = nextWorldVersion();
+        m_worldDirty = false;
+    }
+
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(TransformNode);
 
     static TransformNode *create(const mat4 &matrix, float projectionDepth = 0) {
         auto node = create();
@@ -348,13 +501,53 @@ protected:
     TransformNode()
         : Node(TransformNodeType)
         , m_projectionDepth(0)
+        , m_worldProjectionDepth(0)
+        , m_worldVersion(0)
+        , m_parentWorldVersion(0)
+        , m_worldDirty(true)
     {
     }
 
+    const TransformNode *transformParent() const {
+        const Node *p = m_parent;
+        while (p && p->type() != TransformNodeType)
+            p = p->parent();
+        return static_cast<const TransformNode *>(p);
+    }
+
+    inline void updateWorldTransform() const;
+
+    // Versions are unique across all nodes, so a node which is moved below
+    // another TransformNode, even one which reuses the memory of its old
+    // parent, never mistakes the new parent's world transform for the one
+    // it was computed from. 0 stands for "no parent".
+    static unsigned long long nextWorldVersion() {
+        static std::atomic<unsigned long long> version(0);
+        return version.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    friend class Node;
+    friend class OpenGLRenderer;
+
     mat4 m_matrix;
     float m_projectionDepth;
+
+    mutable affine2d m_worldMatrix;
+    mutable mat4 m_worldMatrix3D;
+    mutable float m_worldProjectionDepth;
+    mutable unsigned long long m_worldVersion;
+    mutable unsigned long long m_parentWorldVersion;
+    mutable bool m_worldDirty;
 };
 
+inline void TransformNode::updateWorldTransform() const
+{
+    const TransformNode *p = transformParent();
+    if (p)
+        p->updateWorldTransform();
+    updateWorldTransform(p);
+}
+
 
 class RectangleNode : public Node {
 public:
@@ -372,7 +565,7 @@ public:
         m_color.w = std::max(std::min(m_color.w, 1.0f), 0.0f);
     }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(RectangleNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(RectangleNode);
 
     static RectangleNode *create(const rect2d &geometry, const vec4 &color = vec4()) {
         auto node = create();
@@ -399,7 +592,7 @@ public:
     void setGeometry(const rect2d &rect) { m_geometry = rect; }
 
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(TextureNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(TextureNode);
 
     static TextureNode *create(const rect2d &geometry, const Texture *layer) {
         auto node = create();
@@ -426,7 +619,7 @@ public:
     void setColorMatrix(const mat4 &matrix) { m_colorMatrix = matrix; }
     const mat4 &colorMatrix() const { return m_colorMatrix; }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(ColorFilterNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(ColorFilterNode);
 
     ColorFilterNode *create(const mat4 &matrix) {
         auto node = create();
@@ -450,7 +643,7 @@ public:
     void setRadius(unsigned radius) { m_radius = radius; }
     unsigned radius() const { return m_radius; }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(BlurNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(BlurNode);
 
     static BlurNode *create(unsigned radius) {
         auto node = create();
@@ -477,7 +670,7 @@ public:
     void setColor(const vec4 &color) { m_color = color; }
     const vec4 &color() const { return m_color; }
 
-    RENGINE_ALLOCATION_POOL_DECLARATION(ShadowNode);
+    RENGINE_NODE_ALLOCATION_POOL_DECLARATION(ShadowNode);
 
     static ShadowNode *create(unsigned radius, const vec2 &offset, const vec4 &color) {
         auto node = create();
@@ -0,0 +1,156 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Keeps nodes from discarded subtrees around so they can be reused when
+    the next tree is built, rather than being destroyed and created again.
+    This suits code which rebuilds its scene graph every frame:
+
+        Node *update(Node *old) {
+            if (old)
+                m_recycler.recycle(old);
+            Node *root = m_recycler.create<Node>();
+            RectangleNode *rect = m_recycler.create<RectangleNode>();
+            ...
+        }
+
+    Nodes are sorted by type, using the node's allocation pool as the key.
+    A recycled node is reset to its freshly created state when it is handed
+    out again, so create<T>() behaves like T::create().
+
+    Only pool allocated nodes are kept; nodes allocated with plain 'new' or
+    from an arena are destroyed when recycled. Nodes still held by the
+    recycler are destroyed when it is cleared or deleted.
+ */
+class NodeRecycler
+{
+public:
+    ~NodeRecycler() { clear(); }
+
+    /*!
+        Removes \a subtree from its parent and takes ownership of all the
+        nodes in it. The subtree is taken apart without updating any sibling
+        links along the way.
+     */
+    void recycle(Node *subtree) {
+        assert(subtree);
+        if (subtree->m_parent)
+            subtree->m_parent->remove(subtree);
+
+        m_stack.push_back(subtree);
+        while (!m_stack.empty()) {
+            Node *n = m_stack.back();
+            m_stack.pop_back();
+
+            for (Node *c = n->m_child; c; ) {
+                Node *next = c->m_sibling;
+                c->m_sibling = 0;
+                c->m_prevSibling = 0;
+                c->m_parent = 0;
+                m_stack.push_back(c);
+                c = next;
+            }
+            n->m_child = 0;
+            n->m_lastChild = 0;
+            n->m_childCount = 0;
+
+            if (n->__is_pool_allocated())
+                binFor(n->__allocation_pool())->push_back(n);
+            else
+                n->destroy();
+        }
+    }
+
+    /*!
+        Returns a recycled node of type \a T, or a newly created one if there
+        are none left.
+     */
+    template <typename T>
+    T *create() {
+        std::vector<Node *> *bin = binFor(T::__static_allocation_pool());
+        if (bin->empty())
+            return T::create();
+        T *t = static_cast<T *>(bin->back());
+        bin->pop_back();
+        return T::__reinitialize(t);
+    }
+
+    /*!
+        Returns the number of nodes currently held by the recycler.
+     */
+    unsigned size() const {
+        unsigned count = 0;
+        for (const Bin &bin : m_bins)
+            count += bin.nodes.size();
+        return count;
+    }
+
+    /*!
+        Destroys all nodes held by the recycler.
+     */
+    void clear() {
+        for (Bin &bin : m_bins) {
+            for (Node *n : bin.nodes)
+                n->destroy();
+            bin.nodes.clear();
+        }
+    }
+
+private:
+    struct Bin {
+        AllocationPoolBase *pool;
+        std::vector<Node *> nodes;
+    };
+
+    std::vector<Node *> *binFor(AllocationPoolBase *pool) {
+        // There are only a handful of node types in use, and a tree is
+        // mostly made up of long runs of the same one.
+        if (m_lastBin < m_bins.size() && m_bins[m_lastBin].pool == pool)
+            return &m_bins[m_lastBin].nodes;
+        for (unsigned i=0; i<m_bins.size(); ++i) {
+            if (m_bins[i].pool == pool) {
+                m_lastBin = i;
+                return &m_bins[i].nodes;
+            }
+        }
+        m_lastBin = m_bins.size();
+        m_bins.push_back(Bin());
+        m_bins.back().pool = pool;
+        return &m_bins.back().nodes;
+    }
+
+    std::vector<Bin> m_bins;
+    std::vector<Node *> m_stack;
+    unsigned m_lastBin = 0;
+};
+
+RENGINE_END_NAMESPACE
@@ -95,6 +95,8 @@ public:
     ~OpenGLRenderer();
 
     Texture *createTextureFromImageData(const vec2 &size, Texture::Format format, void *data);
+    std::vector<Texture::Format> compressedFormats() const override { return m_compressedFormats; }
+    int maxTextureSize() const override { return std::min<int>(m_maxTextureSize, texturecompression::maxImageSize); }
     void initialize();
     bool render() override;
     void frameSwapped() override { m_texturePool.compact(); }
@@ -102,6 +104,7 @@ public:
 
     void prepass(Node *n);
     void build(Node *n);
+    void buildChildren(Node *n);
     void drawColorQuad(unsigned bufferOffset, const vec4 &color);
     void drawTextureQuad(unsigned bufferOffset, GLuint texId, float opacity = 1.0);
     void drawColorFilterQuad(unsigned bufferOffset, GLuint texId, const mat4 &cm);
@@ -149,13 +152,16 @@ public:
     vec2 *m_vertices;
     Element *m_elements;
     mat4 m_proj;
-    mat4 m_m2d;    // for the 2d world
+    affine2d m_m2d; // for the 2d world
     mat4 m_m3d;    // below a 3d projection subtree
     float m_farPlane;
+    const TransformNode *m_transform; // the nearest TransformNode being built
     rect2d m_layerBoundingBox;
     vec2 m_surfaceSize;
 
     TexturePool m_texturePool;
+    std::vector<Texture::Format> m_compressedFormats;
+    GLint m_maxTextureSize = 0;
 
     const Program *m_activeShader;
     GLuint m_texCoordBuffer;
@@ -166,6 +172,7 @@ public:
 
     bool m_render3d : 1;
     bool m_layered : 1;
+    bool m_drawn : 1;       // set by build() when something in the current subtree was drawn
 
 };
 
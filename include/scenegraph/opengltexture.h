@@ -67,7 +67,12 @@ public:
             glBindTexture(GL_TEXTURE_2D, m_id);
         }
         m_size = vec2(width, height);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        if (m_format & CompressedFormatMask) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, texturecompression::glInternalFormat(m_format), width, height, 0,
+                                   texturecompression::dataSize(m_format, width, height), data);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        }
     }
 
 private:
@@ -34,6 +34,7 @@ public:
         : m_sceneRoot(0)
         , m_surface(0)
         , m_fillColor(0, 0, 0, 1)
+        , m_frameNumber(0)
     {
     }
 
@@ -41,10 +42,27 @@ public:
 
     /*!
         Creates a texture from image data which is compatible with this
-        renderer. The image data is 32-bit RGBA or RGBx, tightly packed.
+        renderer. The image data is 32-bit RGBA or RGBx, tightly packed, or
+        blocks of one of the compressed formats, see texturecompression.h.
+
+        Compressed formats which are not in compressedFormats() are
+        decompressed on the CPU. Returns 0 if that is not possible either,
+        or if the size exceeds maxTextureSize().
      */
     virtual Texture *createTextureFromImageData(const vec2 &size, Texture::Format format, void *data) = 0;
 
+    /*!
+        Returns the compressed texture formats which the GPU can sample
+        from directly.
+     */
+    virtual std::vector<Texture::Format> compressedFormats() const { return std::vector<Texture::Format>(); }
+
+    /*!
+        Returns the largest width or height of the textures this renderer
+        can create, at most texturecompression::maxImageSize.
+     */
+    virtual int maxTextureSize() const { return texturecompression::maxImageSize; }
+
     Node *sceneRoot() const { return m_sceneRoot; }
     void setSceneRoot(Node *root) { m_sceneRoot = root; }
 
@@ -83,10 +101,25 @@ public:
     void setFillColor(const vec4 &c) { m_fillColor = c; }
     const vec4 &fillColor() const { return m_fillColor; }
 
+    /*!
+        Returns the number of the last frame rendered, counting from 1. The
+        nodes which were drawn in that frame have it as their
+        Node::renderedFrame().
+     */
+    unsigned frameNumber() const { return m_frameNumber; }
+
+protected:
+    /*!
+        Called by implementations at the start of render() to advance
+        frameNumber().
+     */
+    unsigned beginFrame() { return ++m_frameNumber; }
+
 private:
     Node *m_sceneRoot;
     Surface *m_surface;
     vec4 m_fillColor;
+    unsigned m_frameNumber;
 };
 
 RENGINE_END_NAMESPACE
\ No newline at end of file
@@ -36,8 +36,16 @@ public:
 
     enum Format {
         AlphaFormatMask = 0x1000,
+        CompressedFormatMask = 0x2000,
         RGBA_32 = 1 | AlphaFormatMask,
         RGBx_32 = 2,
+
+        // Block compressed, see texturecompression.h
+        ETC2_RGB8 = 3 | CompressedFormatMask,
+        ETC2_RGBA8 = 4 | CompressedFormatMask | AlphaFormatMask,
+        S3TC_DXT1 = 5 | CompressedFormatMask,
+        S3TC_DXT5 = 6 | CompressedFormatMask | AlphaFormatMask,
+        ASTC_4x4 = 7 | CompressedFormatMask | AlphaFormatMask,
     };
 
     /*!
@@ -55,6 +63,11 @@ public:
      */
     bool hasAlpha() const { return (format() & AlphaFormatMask) != 0; }
 
+    /*!
+        Returns true if the surface is block compressed
+     */
+    bool isCompressed() const { return (format() & CompressedFormatMask) != 0; }
+
     /*!
         Returns the texture id of the surface
      */
@@ -0,0 +1,853 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#endif
+
+RENGINE_BEGIN_NAMESPACE
+
+/*!
+    Block compressed texture formats, which store each 4x4 block of pixels
+    in 8 bytes (ETC2_RGB8, S3TC_DXT1) or 16 bytes (ETC2_RGBA8, S3TC_DXT5,
+    ASTC_4x4). That is 4 or 8 bits per pixel rather than 32, in memory and
+    in bandwidth while sampling.
+
+    Renderer::createTextureFromImageData() and TextureLoader upload these
+    as they are when the GPU supports them and decompress() them to RGBA
+    otherwise. There is no CPU decoder for ASTC, so ASTC images only load
+    where the GPU can sample them. Like the rest of rengine, compressed
+    images are expected to have premultiplied alpha.
+
+    compress() and writeKTX() are for offline conversion, see
+    tools/ktxconvert.cpp. The encoders aim for reasonable quality rather
+    than the best possible one; ETC2_RGB8 is encoded with the ETC1 subset
+    of it.
+
+    Pixels are 32-bit RGBA, tightly packed and top-down, as elsewhere.
+    Blocks are stored left to right, top to bottom; images whose size is
+    not a multiple of 4 have partial blocks along the right and bottom.
+ */
+namespace texturecompression {
+
+/*!
+    Returns the number of bytes in one 4x4 block of \a format, or 0 if it
+    is not compressed.
+ */
+inline unsigned blockSize(Texture::Format format)
+{
+    switch (format) {
+    case Texture::ETC2_RGB8:
+    case Texture::S3TC_DXT1:
+        return 8;
+    case Texture::ETC2_RGBA8:
+    case Texture::S3TC_DXT5:
+    case Texture::ASTC_4x4:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/*!
+    The largest width or height accepted for image data. Textures beyond it
+    are larger than most GPUs can sample, and sizes computed from untrusted
+    headers are kept far from overflowing.
+ */
+const int maxImageSize = 16384;
+
+inline bool isValidSize(int width, int height)
+{
+    return width > 0 && height > 0 && width <= maxImageSize && height <= maxImageSize;
+}
+
+/*!
+    Returns the number of bytes in a \a width x \a height image of \a format,
+    or 0 if the size is not valid according to isValidSize().
+ */
+inline size_t dataSize(Texture::Format format, int width, int height)
+{
+    if (!isValidSize(width, height))
+        return 0;
+    if (!(format & Texture::CompressedFormatMask))
+        return size_t(width) * size_t(height) * 4;
+    return size_t((width + 3) / 4) * size_t((height + 3) / 4) * blockSize(format);
+}
+
+inline GLenum glInternalFormat(Texture::Format format)
+{
+    switch (format) {
+    case Texture::ETC2_RGB8: return GL_COMPRESSED_RGB8_ETC2;
+    case Texture::ETC2_RGBA8: return GL_COMPRESSED_RGBA8_ETC2_EAC;
+    case Texture::S3TC_DXT1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case Texture::S3TC_DXT5: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case Texture::ASTC_4x4: return GL_COMPRESSED_RGBA_ASTC_4x4_KHR;
+    default: return GL_RGBA;
+    }
+}
+
+/*!
+    Maps an OpenGL compressed internal format to a Texture::Format,
+    returning false if rengine does not know it.
+ */
+inline bool formatFromGLInternalFormat(GLenum internalFormat, Texture::Format *format)
+{
+    switch (internalFormat) {
+    case GL_COMPRESSED_RGB8_ETC2: *format = Texture::ETC2_RGB8; return true;
+    case GL_COMPRESSED_RGBA8_ETC2_EAC: *format = Texture::ETC2_RGBA8; return true;
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: *format = Texture::S3TC_DXT1; return true;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: *format = Texture::S3TC_DXT5; return true;
+    case GL_COMPRESSED_RGBA_ASTC_4x4_KHR: *format = Texture::ASTC_4x4; return true;
+    default: return false;
+    }
+}
+
+inline unsigned char clamp255(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+inline unsigned long long readBigEndian64(const unsigned char *b)
+{
+    unsigned long long v = 0;
+    for (int i=0; i<8; ++i)
+        v = (v << 8) | b[i];
+    return v;
+}
+
+inline void writeBigEndian64(unsigned long long v, unsigned char *b)
+{
+    for (int i=7; i>=0; --i, v >>= 8)
+        b[i] = (unsigned char) v;
+}
+
+static const int etc1Modifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+static const int etc2Distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int eacModifiers[16][8] = {
+    { -3, -6,  -9, -15, 2, 5, 8, 14 },
+    { -3, -7, -10, -13, 2, 6, 9, 12 },
+    { -2, -5,  -8, -13, 1, 4, 7, 12 },
+    { -2, -4,  -6, -13, 1, 3, 5, 12 },
+    { -3, -6,  -8, -12, 2, 5, 7, 11 },
+    { -3, -7,  -9, -11, 2, 6, 8, 10 },
+    { -4, -7,  -8, -11, 3, 6, 7, 10 },
+    { -3, -5,  -8, -11, 2, 4, 7, 10 },
+    { -2, -6,  -8, -10, 1, 5, 7,  9 },
+    { -2, -5,  -8, -10, 1, 4, 7,  9 },
+    { -2, -4,  -8, -10, 1, 3, 7,  9 },
+    { -2, -5,  -7, -10, 1, 4, 6,  9 },
+    { -3, -4,  -7, -10, 2, 3, 6,  9 },
+    { -1, -2,  -3, -10, 0, 1, 2,  9 },
+    { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+    { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+// ETC1 pixel indices: 0 and 1 add the table's small and large modifier,
+// 2 and 3 subtract them.
+inline int etc1Modifier(int table, int index)
+{
+    const int m = etc1Modifiers[table][index & 1];
+    return (index & 2) ? -m : m;
+}
+
+/*!
+    Decodes an 8 byte ETC2 RGB block, in any of its modes, into 16 RGBA
+    pixels with alpha set to 255.
+ */
+inline void decodeETC2Block(const unsigned char *block, unsigned char *rgba)
+{
+    const unsigned long long bits = readBigEndian64(block);
+    auto field = [bits] (int highBit, int count) { return int((bits >> (highBit - count + 1)) & ((1u << count) - 1)); };
+    // The index of pixel (x, y) is split into a high bit in the upper 16
+    // bits and a low bit in the lower 16, in column-major order.
+    auto pixelIndex = [bits] (int x, int y) {
+        const int p = x * 4 + y;
+        return int(((bits >> (p + 16)) & 1) << 1 | ((bits >> p) & 1));
+    };
+    auto extend4 = [] (int v) { return v * 17; };
+    auto extend5 = [] (int v) { return (v << 3) | (v >> 2); };
+    auto extend6 = [] (int v) { return (v << 2) | (v >> 4); };
+    auto extend7 = [] (int v) { return (v << 1) | (v >> 6); };
+    auto signExtend3 = [] (int v) { return v >= 4 ? v - 8 : v; };
+
+    for (int i=0; i<16; ++i)
+        rgba[i * 4 + 3] = 255;
+
+    int base[2][3];
+    if (field(33, 1) == 0) {
+        // Individual mode, two 4-bit colors
+        for (int c=0; c<3; ++c) {
+            base[0][c] = extend4(field(63 - c * 8, 4));
+            base[1][c] = extend4(field(59 - c * 8, 4));
+        }
+    } else {
+        // Differential mode, a 5-bit color and 3-bit signed offsets to the
+        // second one. Offsets that overflow select the ETC2 modes.
+        int first[3], second[3];
+        for (int c=0; c<3; ++c) {
+            first[c] = field(63 - c * 8, 5);
+            second[c] = first[c] + signExtend3(field(58 - c * 8, 3));
+        }
+
+        if (second[0] < 0 || second[0] > 31 || second[1] < 0 || second[1] > 31) {
+            int c1[3], c2[3], d;
+            if (second[0] < 0 || second[0] > 31) {
+                // T mode
+                c1[0] = extend4((field(60, 2) << 2) | field(57, 2));
+                c1[1] = extend4(field(55, 4));
+                c1[2] = extend4(field(51, 4));
+                c2[0] = extend4(field(47, 4));
+                c2[1] = extend4(field(43, 4));
+                c2[2] = extend4(field(39, 4));
+                d = etc2Distances[(field(35, 2) << 1) | field(32, 1)];
+            } else {
+                // H mode
+                c1[0] = extend4(field(62, 4));
+                c1[1] = extend4((field(58, 3) << 1) | field(52, 1));
+                c1[2] = extend4((field(51, 1) << 3) | field(49, 3));
+                c2[0] = extend4(field(46, 4));
+                c2[1] = extend4(field(42, 4));
+                c2[2] = extend4(field(38, 4));
+                const bool order = ((c1[0] << 16) | (c1[1] << 8) | c1[2]) >= ((c2[0] << 16) | (c2[1] << 8) | c2[2]);
+                d = etc2Distances[(field(34, 1) << 2) | (field(32, 1) << 1) | (order ? 1 : 0)];
+            }
+            const bool tMode = second[0] < 0 || second[0] > 31;
+            unsigned char paint[4][3];
+            for (int c=0; c<3; ++c) {
+                if (tMode) {
+                    paint[0][c] = c1[c];
+                    paint[1][c] = clamp255(c2[c] + d);
+                    paint[2][c] = c2[c];
+                    paint[3][c] = clamp255(c2[c] - d);
+                } else {
+                    paint[0][c] = clamp255(c1[c] + d);
+                    paint[1][c] = clamp255(c1[c] - d);
+                    paint[2][c] = clamp255(c2[c] + d);
+                    paint[3][c] = clamp255(c2[c] - d);
+                }
+            }
+            for (int y=0; y<4; ++y)
+                for (int x=0; x<4; ++x)
+                    memcpy(rgba + (y * 4 + x) * 4, paint[pixelIndex(x, y)], 3);
+            return;
+        }
+
+        if (second[2] < 0 || second[2] > 31) {
+            // Planar mode, a color at the origin and at the horizontal and
+            // vertical ends, interpolated across the block.
+            const int o[3] = { extend6(field(62, 6)),
+                               extend7((field(56, 1) << 6) | field(54, 6)),
+                               extend6((field(48, 1) << 5) | (field(44, 2) << 3) | field(41, 3)) };
+            const int h[3] = { extend6((field(38, 5) << 1) | field(32, 1)),
+                               extend7(field(31, 7)),
+                               extend6(field(24, 6)) };
+            const int v[3] = { extend6(field(18, 6)),
+                               extend7(field(12, 7)),
+                               extend6(field(5, 6)) };
+            for (int y=0; y<4; ++y)
+                for (int x=0; x<4; ++x)
+                    for (int c=0; c<3; ++c)
+                        rgba[(y * 4 + x) * 4 + c] = clamp255((x * (h[c] - o[c]) + y * (v[c] - o[c]) + 4 * o[c] + 2) >> 2);
+            return;
+        }
+
+        for (int c=0; c<3; ++c) {
+            base[0][c] = extend5(first[c]);
+            base[1][c] = extend5(second[c]);
+        }
+    }
+
+    const int tables[2] = { field(39, 3), field(36, 3) };
+    const bool flip = field(32, 1);
+    for (int y=0; y<4; ++y) {
+        for (int x=0; x<4; ++x) {
+            const int half = flip ? y / 2 : x / 2;
+            const int m = etc1Modifier(tables[half], pixelIndex(x, y));
+            for (int c=0; c<3; ++c)
+                rgba[(y * 4 + x) * 4 + c] = clamp255(base[half][c] + m);
+        }
+    }
+}
+
+/*!
+    Decodes an 8 byte EAC alpha block into the alpha channel of 16 RGBA
+    pixels, leaving the colors alone.
+ */
+inline void decodeEACAlphaBlock(const unsigned char *block, unsigned char *rgba)
+{
+    const unsigned long long bits = readBigEndian64(block);
+    const int base = int(bits >> 56);
+    const int multiplier = int(bits >> 52) & 0xf;
+    const int *modifiers = eacModifiers[(bits >> 48) & 0xf];
+    for (int p=0; p<16; ++p) {
+        const int index = int(bits >> (45 - 3 * p)) & 7;
+        const int x = p / 4, y = p % 4;
+        rgba[(y * 4 + x) * 4 + 3] = clamp255(base + modifiers[index] * multiplier);
+    }
+}
+
+// The four colors of an S3TC color block, as RGB. GPUs round the
+// interpolated ones differently; this is the reference decoder's way.
+inline void s3tcPalette(const unsigned char *block, bool fourColors, unsigned char palette[4][3])
+{
+    const unsigned c0 = block[0] | (block[1] << 8);
+    const unsigned c1 = block[2] | (block[3] << 8);
+    for (int i=0; i<2; ++i) {
+        const unsigned c = i == 0 ? c0 : c1;
+        const unsigned r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+        palette[i][0] = (r << 3) | (r >> 2);
+        palette[i][1] = (g << 2) | (g >> 4);
+        palette[i][2] = (b << 3) | (b >> 2);
+    }
+    for (int c=0; c<3; ++c) {
+        if (fourColors || c0 > c1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+/*!
+    Decodes an 8 byte S3TC color block into 16 RGBA pixels with alpha set
+    to 255. DXT1 picks between four and three colors from the order of the
+    endpoints, while the color blocks in DXT5 always have four, so pass
+    true for \a fourColors there.
+ */
+inline void decodeS3TCColorBlock(const unsigned char *block, unsigned char *rgba, bool fourColors = false)
+{
+    unsigned char palette[4][3];
+    s3tcPalette(block, fourColors, palette);
+    const unsigned indices = block[4] | (block[5] << 8) | (block[6] << 16) | (unsigned(block[7]) << 24);
+    for (int p=0; p<16; ++p) {
+        memcpy(rgba + p * 4, palette[(indices >> (2 * p)) & 3], 3);
+        rgba[p * 4 + 3] = 255;
+    }
+}
+
+// The eight alpha values of a DXT5 alpha block
+inline void dxt5AlphaPalette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i=1; i<7; ++i)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    } else {
+        for (int i=1; i<5; ++i)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+/*!
+    Decodes an 8 byte DXT5 alpha block into the alpha channel of 16 RGBA
+    pixels, leaving the colors alone.
+ */
+inline void decodeDXT5AlphaBlock(const unsigned char *block, unsigned char *rgba)
+{
+    int palette[8];
+    dxt5AlphaPalette(block[0], block[1], palette);
+    unsigned long long indices = 0;
+    for (int i=7; i>=2; --i)
+        indices = (indices << 8) | block[i];
+    for (int p=0; p<16; ++p)
+        rgba[p * 4 + 3] = palette[(indices >> (3 * p)) & 7];
+}
+
+/*!
+    Decompresses a \a width x \a height image in \a format from \a data
+    into \a rgba. Returns false if the format cannot be decoded on the CPU
+    or the size is not valid.
+ */
+inline bool decompress(Texture::Format format, int width, int height, const unsigned char *data, unsigned char *rgba)
+{
+    const unsigned size = blockSize(format);
+    if (size == 0 || format == Texture::ASTC_4x4 || !isValidSize(width, height))
+        return false;
+
+    unsigned char pixels[16 * 4];
+    for (int by=0; by<height; by+=4) {
+        for (int bx=0; bx<width; bx+=4, data += size) {
+            switch (format) {
+            case Texture::ETC2_RGB8:
+                decodeETC2Block(data, pixels);
+                break;
+            case Texture::ETC2_RGBA8:
+                decodeETC2Block(data + 8, pixels);
+                decodeEACAlphaBlock(data, pixels);
+                break;
+            case Texture::S3TC_DXT1:
+                decodeS3TCColorBlock(data, pixels);
+                break;
+            default: // S3TC_DXT5
+                decodeS3TCColorBlock(data + 8, pixels, true);
+                decodeDXT5AlphaBlock(data, pixels);
+                break;
+            }
+            const int w = std::min(4, width - bx);
+            for (int y=0; y<4 && by + y<height; ++y)
+                memcpy(rgba + ((by + y) * width + bx) * 4, pixels + y * 16, w * 4);
+        }
+    }
+    return true;
+}
+
+/*!
+    Encodes 16 RGBA pixels into an 8 byte block with ETC1's individual or
+    differential mode, which are valid ETC2 RGB. Alpha is ignored.
+ */
+inline void encodeETC1Block(const unsigned char *rgba, unsigned char *block)
+{
+    // Finds the table and indices for one half of the block around base,
+    // returning the squared error.
+    auto fitHalf = [rgba] (bool flip, int half, const int *base, int *bestTable, unsigned *indices) {
+        int bestError = 0x7fffffff;
+        for (int t=0; t<8; ++t) {
+            int error = 0;
+            unsigned chosen = 0;
+            for (int i=0; i<8; ++i) {
+                const int x = flip ? i % 4 : half * 2 + i % 2;
+                const int y = flip ? half * 2 + i / 4 : i / 2;
+                const unsigned char *p = rgba + (y * 4 + x) * 4;
+                int best = 0x7fffffff, bestIndex = 0;
+                for (int index=0; index<4; ++index) {
+                    const int m = etc1Modifier(t, index);
+                    int e = 0;
+                    for (int c=0; c<3; ++c) {
+                        const int d = clamp255(base[c] + m) - p[c];
+                        e += d * d;
+                    }
+                    if (e < best) {
+                        best = e;
+                        bestIndex = index;
+                    }
+                }
+                error += best;
+                chosen |= bestIndex << (2 * (x * 4 + y));
+            }
+            if (error < bestError) {
+                bestError = error;
+                *bestTable = t;
+                *indices = chosen;
+            }
+        }
+        return bestError;
+    };
+
+    int bestError = 0x7fffffff;
+    unsigned long long bestBits = 0;
+    for (int flip=0; flip<2; ++flip) {
+        float average[2][3] = { { 0, 0, 0 }, { 0, 0, 0 } };
+        for (int y=0; y<4; ++y)
+            for (int x=0; x<4; ++x)
+                for (int c=0; c<3; ++c)
+                    average[flip ? y / 2 : x / 2][c] += rgba[(y * 4 + x) * 4 + c] / 8.0f;
+
+        for (int differential=0; differential<2; ++differential) {
+            int quantized[2][3], base[2][3];
+            bool representable = true;
+            for (int h=0; h<2; ++h) {
+                for (int c=0; c<3; ++c) {
+                    if (differential) {
+                        quantized[h][c] = int(average[h][c] * 31 / 255 + 0.5f);
+                        base[h][c] = (quantized[h][c] << 3) | (quantized[h][c] >> 2);
+                    } else {
+                        quantized[h][c] = int(average[h][c] / 17 + 0.5f);
+                        base[h][c] = quantized[h][c] * 17;
+                    }
+                }
+            }
+            if (differential) {
+                for (int c=0; c<3; ++c) {
+                    const int delta = quantized[1][c] - quantized[0][c];
+                    representable = representable && delta >= -4 && delta <= 3;
+                }
+            }
+            if (!representable)
+                continue;
+
+            int tables[2] = { 0, 0 };
+            unsigned indices[2] = { 0, 0 };
+            const int error = fitHalf(flip, 0, base[0], &tables[0], &indices[0])
+                            + fitHalf(flip, 1, base[1], &tables[1], &indices[1]);
+            if (error >= bestError)
+                continue;
+            bestError = error;
+
+            unsigned long long bits = 0;
+            for (int c=0; c<3; ++c) {
+                if (differential) {
+                    bits |= (unsigned long long) quantized[0][c] << (59 - c * 8);
+                    bits |= (unsigned long long) ((quantized[1][c] - quantized[0][c]) & 7) << (56 - c * 8);
+                } else {
+                    bits |= (unsigned long long) quantized[0][c] << (60 - c * 8);
+                    bits |= (unsigned long long) quantized[1][c] << (56 - c * 8);
+                }
+            }
+            bits |= (unsigned long long) tables[0] << 37;
+            bits |= (unsigned long long) tables[1] << 34;
+            bits |= (unsigned long long) differential << 33;
+            bits |= (unsigned long long) flip << 32;
+            const unsigned combined = indices[0] | indices[1];
+            for (int p=0; p<16; ++p) {
+                const unsigned index = (combined >> (2 * p)) & 3;
+                bits |= (unsigned long long) (index >> 1) << (16 + p);
+                bits |= (unsigned long long) (index & 1) << p;
+            }
+            bestBits = bits;
+        }
+    }
+    writeBigEndian64(bestBits, block);
+}
+
+/*!
+    Encodes the alpha of 16 RGBA pixels into an 8 byte EAC alpha block.
+ */
+inline void encodeEACAlphaBlock(const unsigned char *rgba, unsigned char *block)
+{
+    int low = 255, high = 0;
+    for (int p=0; p<16; ++p) {
+        low = std::min<int>(low, rgba[p * 4 + 3]);
+        high = std::max<int>(high, rgba[p * 4 + 3]);
+    }
+
+    // A constant alpha is exact with table 13, which has a 0 modifier
+    int bestError = 0x7fffffff, bestBase = low, bestMultiplier = 1, bestTable = 13;
+    unsigned long long bestIndices = 0;
+    for (int p=0; p<16; ++p)
+        bestIndices |= 4ull << (45 - 3 * (p % 4 * 4 + p / 4));
+    if (low != high) {
+        for (int t=0; t<16; ++t) {
+            for (int m=1; m<16; ++m) {
+                // Center the table's range on the block's range
+                const int base = clamp255(int(floorf(((low + high) - (eacModifiers[t][3] + eacModifiers[t][7]) * m) / 2.0f + 0.5f)));
+                int error = 0;
+                unsigned long long indices = 0;
+                for (int p=0; p<16 && error < bestError; ++p) {
+                    const int a = rgba[p * 4 + 3];
+                    int best = 0x7fffffff, bestIndex = 0;
+                    for (int i=0; i<8; ++i) {
+                        const int d = clamp255(base + eacModifiers[t][i] * m) - a;
+                        if (d * d < best) {
+                            best = d * d;
+                            bestIndex = i;
+                        }
+                    }
+                    error += best;
+                    indices |= (unsigned long long) bestIndex << (45 - 3 * (p % 4 * 4 + p / 4));
+                }
+                if (error < bestError) {
+                    bestError = error;
+                    bestBase = base;
+                    bestMultiplier = m;
+                    bestTable = t;
+                    bestIndices = indices;
+                }
+            }
+        }
+    }
+    const unsigned long long bits = (unsigned long long) bestBase << 56
+                                  | (unsigned long long) bestMultiplier << 52
+                                  | (unsigned long long) bestTable << 48
+                                  | bestIndices;
+    writeBigEndian64(bits, block);
+}
+
+/*!
+    Encodes 16 RGBA pixels into an 8 byte S3TC color block, with endpoints
+    along the principal axis of the colors. \a fourColors is as for
+    decodeS3TCColorBlock().
+ */
+inline void encodeS3TCColorBlock(const unsigned char *rgba, unsigned char *block, bool fourColors = false)
+{
+    float mean[3] = { 0, 0, 0 };
+    for (int p=0; p<16; ++p)
+        for (int c=0; c<3; ++c)
+            mean[c] += rgba[p * 4 + c] / 16.0f;
+    float covariance[3][3] = { { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 } };
+    for (int p=0; p<16; ++p)
+        for (int i=0; i<3; ++i)
+            for (int j=0; j<3; ++j)
+                covariance[i][j] += (rgba[p * 4 + i] - mean[i]) * (rgba[p * 4 + j] - mean[j]);
+
+    // Power iteration for the principal axis
+    float axis[3] = { 1, 1, 1 };
+    for (int iteration=0; iteration<8; ++iteration) {
+        float next[3];
+        for (int i=0; i<3; ++i)
+            next[i] = covariance[i][0] * axis[0] + covariance[i][1] * axis[1] + covariance[i][2] * axis[2];
+        const float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break;
+        for (int i=0; i<3; ++i)
+            axis[i] = next[i] / length;
+    }
+
+    float lowest = 0, highest = 0;
+    for (int p=0; p<16; ++p) {
+        float t = 0;
+        for (int c=0; c<3; ++c)
+            t += (rgba[p * 4 + c] - mean[c]) * axis[c];
+        lowest = std::min(lowest, t);
+        highest = std::max(highest, t);
+    }
+    auto to565 = [&] (float t) {
+        int v[3];
+        for (int c=0; c<3; ++c)
+            v[c] = clamp255(int(mean[c] + axis[c] * t + 0.5f));
+        return unsigned(((v[0] * 31 + 127) / 255) << 11 | ((v[1] * 63 + 127) / 255) << 5 | ((v[2] * 31 + 127) / 255));
+    };
+    unsigned c0 = to565(highest), c1 = to565(lowest);
+    // Four colors need c0 > c1 in DXT1. Three colors would only add black.
+    if (c0 < c1)
+        std::swap(c0, c1);
+    block[0] = c0 & 0xff;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xff;
+    block[3] = c1 >> 8;
+
+    unsigned char palette[4][3];
+    s3tcPalette(block, fourColors, palette);
+    // With equal endpoints, DXT1 is in three color mode and index 3 is
+    // black, so only use the first three there.
+    const int choices = (fourColors || c0 > c1) ? 4 : 3;
+    unsigned indices = 0;
+    for (int p=0; p<16; ++p) {
+        int best = 0x7fffffff, bestIndex = 0;
+        for (int i=0; i<choices; ++i) {
+            int e = 0;
+            for (int c=0; c<3; ++c) {
+                const int d = palette[i][c] - rgba[p * 4 + c];
+                e += d * d;
+            }
+            if (e < best) {
+                best = e;
+                bestIndex = i;
+            }
+        }
+        indices |= bestIndex << (2 * p);
+    }
+    for (int i=0; i<4; ++i)
+        block[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+/*!
+    Encodes the alpha of 16 RGBA pixels into an 8 byte DXT5 alpha block.
+ */
+inline void encodeDXT5AlphaBlock(const unsigned char *rgba, unsigned char *block)
+{
+    int low = 255, high = 0;
+    for (int p=0; p<16; ++p) {
+        low = std::min<int>(low, rgba[p * 4 + 3]);
+        high = std::max<int>(high, rgba[p * 4 + 3]);
+    }
+    int palette[8];
+    dxt5AlphaPalette(high, low, palette);
+    unsigned long long indices = 0;
+    for (int p=0; p<16; ++p) {
+        int best = 0x7fffffff, bestIndex = 0;
+        for (int i=0; i<8; ++i) {
+            const int d = palette[i] - rgba[p * 4 + 3];
+            if (d * d < best) {
+                best = d * d;
+                bestIndex = i;
+            }
+        }
+        indices |= (unsigned long long) bestIndex << (3 * p);
+    }
+    block[0] = high;
+    block[1] = low;
+    for (int i=0; i<6; ++i)
+        block[2 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+/*!
+    Compresses a \a width x \a height RGBA image into \a data, which must
+    hold dataSize() bytes. Returns false for ASTC_4x4, which there is no
+    encoder for, and for sizes which are not valid.
+ */
+inline bool compress(Texture::Format format, int width, int height, const unsigned char *rgba, unsigned char *data)
+{
+    const unsigned size = blockSize(format);
+    if (size == 0 || format == Texture::ASTC_4x4 || !isValidSize(width, height))
+        return false;
+
+    unsigned char pixels[16 * 4];
+    for (int by=0; by<height; by+=4) {
+        for (int bx=0; bx<width; bx+=4, data += size) {
+            // Partial blocks repeat the last row and column
+            for (int y=0; y<4; ++y) {
+                for (int x=0; x<4; ++x) {
+                    const int sx = std::min(bx + x, width - 1);
+                    const int sy = std::min(by + y, height - 1);
+                    memcpy(pixels + (y * 4 + x) * 4, rgba + (sy * width + sx) * 4, 4);
+                }
+            }
+            switch (format) {
+            case Texture::ETC2_RGB8:
+                encodeETC1Block(pixels, data);
+                break;
+            case Texture::ETC2_RGBA8:
+                encodeEACAlphaBlock(pixels, data);
+                encodeETC1Block(pixels, data + 8);
+                break;
+            case Texture::S3TC_DXT1:
+                encodeS3TCColorBlock(pixels, data);
+                break;
+            default: // S3TC_DXT5
+                encodeDXT5AlphaBlock(pixels, data);
+                encodeS3TCColorBlock(pixels, data + 8, true);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/*!
+    The first mipmap level of a KTX file, pointing into the file's data.
+ */
+struct KTXImage
+{
+    Texture::Format format = Texture::RGBA_32;
+    int width = 0;
+    int height = 0;
+    const unsigned char *data = 0;
+    size_t size = 0;
+};
+
+static const unsigned char ktxIdentifier[12] = { 0xab, 'K', 'T', 'X', ' ', '1', '1', 0xbb, '\r', '\n', 0x1a, '\n' };
+
+/*!
+    Reads a KTX 1.1 file holding a 2D texture in one of the compressed
+    formats. ETC1 files are read as ETC2_RGB8, which they are a subset of.
+    Returns false if the file is not one rengine can use.
+ */
+inline bool parseKTX(const unsigned char *file, size_t size, KTXImage *image)
+{
+    if (size < 64 + 4 || memcmp(file, ktxIdentifier, sizeof(ktxIdentifier)) != 0)
+        return false;
+
+    unsigned header[13];
+    memcpy(header, file + 12, sizeof(header));
+    if (header[0] == 0x01020304) {
+        for (unsigned &v : header)
+            v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+    } else if (header[0] != 0x04030201) {
+        return false;
+    }
+    enum { Endianness, Type, TypeSize, Format, InternalFormat, BaseInternalFormat,
+           Width, Height, Depth, ArrayElements, Faces, MipmapLevels, KeyValueBytes };
+
+    // Compressed data has no type or format, and only 2D textures are used
+    if (header[Type] != 0 || header[Format] != 0 || header[Depth] != 0 || header[ArrayElements] > 1
+        || header[Faces] != 1 || header[Width] == 0 || header[Height] == 0
+        || header[Width] > unsigned(maxImageSize) || header[Height] > unsigned(maxImageSize))
+        return false;
+    Texture::Format format;
+    if (header[InternalFormat] == GL_ETC1_RGB8_OES)
+        format = Texture::ETC2_RGB8;
+    else if (!formatFromGLInternalFormat(header[InternalFormat], &format))
+        return false;
+
+    const size_t offset = 64 + size_t(header[KeyValueBytes]);
+    if (offset + 4 > size)
+        return false;
+    unsigned imageSize;
+    memcpy(&imageSize, file + offset, 4);
+    if (header[Endianness] == 0x01020304)
+        imageSize = (imageSize >> 24) | ((imageSize >> 8) & 0xff00) | ((imageSize << 8) & 0xff0000) | (imageSize << 24);
+
+    const size_t expected = dataSize(format, header[Width], header[Height]);
+    if (imageSize < expected || expected > size - offset - 4)
+        return false;
+
+    image->format = format;
+    image->width = header[Width];
+    image->height = header[Height];
+    image->data = file + offset + 4;
+    image->size = expected;
+    return true;
+}
+
+/*!
+    Returns a KTX 1.1 file holding \a data, a \a width x \a height image in
+    compressed \a format, as a single mipmap level with top-down rows.
+ */
+inline std::vector<unsigned char> writeKTX(Texture::Format format, int width, int height, const unsigned char *data)
+{
+    static const char orientation[] = "KTXorientation\0S=r,T=d";
+    const unsigned keyValueSize = sizeof(orientation);
+    const unsigned keyValuePadded = (4 + keyValueSize + 3) & ~3u;
+    const unsigned size = unsigned(dataSize(format, width, height));
+    const unsigned header[13] = {
+        0x04030201, 0, 1, 0, glInternalFormat(format),
+        unsigned((format & Texture::AlphaFormatMask) ? GL_RGBA : GL_RGB),
+        unsigned(width), unsigned(height), 0, 0, 1, 1, keyValuePadded
+    };
+
+    std::vector<unsigned char> file(12 + sizeof(header) + keyValuePadded + 4 + ((size + 3) & ~3u));
+    unsigned char *out = file.data();
+    memcpy(out, ktxIdentifier, 12);
+    memcpy(out + 12, header, sizeof(header));
+    out += 12 + sizeof(header);
+    memcpy(out, &keyValueSize, 4);
+    memcpy(out + 4, orientation, keyValueSize);
+    out += keyValuePadded;
+    memcpy(out, &size, 4);
+    memcpy(out + 4, data, size);
+    return file;
+}
+
+} // texturecompression
+
+RENGINE_END_NAMESPACE
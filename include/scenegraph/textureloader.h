@@ -0,0 +1,543 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <assert.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+RENGINE_BEGIN_NAMESPACE
+
+class TextureLoader;
+
+/*!
+    The result of decoding an image, see TextureLoader::Decoder.
+ */
+struct DecodedImage
+{
+    int width = 0;
+    int height = 0;
+
+    /*!
+        RGBA_32 for images with an alpha channel, RGBx_32 for opaque ones.
+        The fourth byte of RGBx_32 pixels may be anything; the loader sets
+        it to 255.
+     */
+    Texture::Format format = Texture::RGBA_32;
+
+    /*!
+        32-bit RGBA pixels, tightly packed, or the blocks of a compressed
+        format, see texturecompression.h. They are released with
+        freePixels once they have been uploaded.
+     */
+    unsigned char *pixels = 0;
+    void (*freePixels)(void *) = ::free;
+
+    /*!
+        Set this if the decoder already premultiplied the pixels. Otherwise
+        the loader does it on the worker thread. Compressed images are
+        always taken to be premultiplied.
+     */
+    bool premultiplied = false;
+};
+
+/*!
+    A texture which is filled in by a TextureLoader. It can be given to
+    TextureNode right away. Until the image has been decoded and uploaded in
+    full, its textureId() is 0 and the renderer draws nothing for it.
+
+    The state, size and format are updated on the render thread, in
+    TextureLoader::upload(). An AsyncTexture must be deleted on the render
+    thread.
+ */
+class AsyncTexture : public Texture
+{
+public:
+    enum State {
+        Loading,
+        Ready,
+        Failed
+    };
+
+    inline ~AsyncTexture();
+
+    vec2 size() const { return m_size; }
+    Format format() const { return m_format; }
+    GLuint textureId() const { return m_state == Ready ? m_id : 0; }
+
+    State state() const { return m_state; }
+    const std::string &source() const { return m_source; }
+
+private:
+    friend class TextureLoader;
+    struct Job;
+
+    AsyncTexture(TextureLoader *loader, const std::string &source)
+        : m_loader(loader)
+        , m_job(0)
+        , m_id(0)
+        , m_format(RGBA_32)
+        , m_state(Loading)
+        , m_source(source)
+    {
+    }
+
+    TextureLoader *m_loader;
+    Job *m_job;
+    GLuint m_id;
+    vec2 m_size;
+    Format m_format;
+    State m_state;
+    std::string m_source;
+};
+
+struct AsyncTexture::Job
+{
+    AsyncTexture *texture;      // 0 once the texture is deleted
+    std::string source;
+    DecodedImage image;
+    bool decoded = false;
+    int uploadedRows = 0;
+};
+
+/*!
+    Loads textures without blocking the render thread.
+
+    load() returns an AsyncTexture right away and queues the image for
+    decoding. Worker threads decode and premultiply the pixels, and
+    upload(), called once per frame on the render thread, moves them into
+    the textures. Large images are uploaded a few rows at a time so that
+    no frame spends more than uploadBudget() bytes on it. Where the GL
+    headers provide pixel buffer objects, the rows go through one, so the
+    driver can copy them while the frame is rendered.
+
+    Decoders may also return compressed images, for instance from KTX
+    files, see texturecompression::parseKTX(). They are uploaded whole if
+    their format is one of compressedFormats() and decompressed on the
+    worker thread if not.
+
+    StandardSurfaceInterface owns a loader and calls upload() before each
+    frame, see StandardSurfaceInterface::textureLoader(). The application
+    provides the decoder:
+
+    \code
+    textureLoader()->setDecoder([] (const std::string &file, DecodedImage *image) {
+        int n;
+        image->pixels = stbi_load(file.c_str(), &image->width, &image->height, &n, 4);
+        image->format = n == 4 ? Texture::RGBA_32 : Texture::RGBx_32;
+        return image->pixels != 0;
+    });
+    m_texture = textureLoader()->load("images/walker.png");
+    \endcode
+ */
+class TextureLoader
+{
+public:
+    /*!
+        Decodes the image at \a source into \a image, returning false if it
+        could not. Called on the worker threads. Images larger than
+        maxTextureSize() fail to load.
+     */
+    typedef std::function<bool (const std::string &source, DecodedImage *image)> Decoder;
+
+    /*!
+        Called on a worker thread when an image has been decoded and is
+        waiting for upload(). It is called with the loader's lock held, so
+        it must not call back into the loader.
+     */
+    typedef std::function<void ()> DecodedCallback;
+
+    /*!
+        Creates a loader which decodes on \a threadCount worker threads. The
+        default is one less than the number of cores, but at least one and
+        at most four. The threads are started on the first load().
+     */
+    TextureLoader(unsigned threadCount = 0)
+        : m_threadCount(threadCount)
+        , m_uploadBudget(4 * 1024 * 1024)
+        , m_quit(false)
+        , m_uploading(0)
+        , m_pixelBuffer(0)
+    {
+        if (m_threadCount == 0)
+            m_threadCount = std::max(1u, std::min(4u, std::thread::hardware_concurrency() - 1));
+    }
+
+    /*!
+        Stops the worker threads. Textures which have not been uploaded yet
+        are left as Failed.
+     */
+    ~TextureLoader() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wakeup.notify_all();
+        for (std::thread &t : m_threads)
+            t.join();
+        if (m_uploading)
+            m_decoded.push_back(m_uploading);
+        for (auto jobs : { &m_queue, &m_decoded }) {
+            for (AsyncTexture::Job *job : *jobs) {
+                if (job->texture) {
+                    job->texture->m_state = AsyncTexture::Failed;
+                    job->texture->m_job = 0;
+                }
+                drop(job);
+            }
+        }
+#ifdef GL_PIXEL_UNPACK_BUFFER
+        if (m_pixelBuffer)
+            glDeleteBuffers(1, &m_pixelBuffer);
+#endif
+    }
+
+    /*!
+        Sets the function used to decode images. It must be set before the
+        first load().
+     */
+    void setDecoder(const Decoder &decoder) {
+        assert(m_threads.empty());
+        m_decoder = decoder;
+    }
+
+    /*!
+        Sets the function which is called when an image has been decoded,
+        so the render thread can be woken up to upload it.
+        StandardSurfaceInterface uses this to request a render instead of
+        rendering continuously while images are being decoded.
+     */
+    void setDecodedCallback(const DecodedCallback &callback) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decodedCallback = callback;
+    }
+
+    /*!
+        Contains the compressed formats which can be uploaded as they are,
+        usually the renderer's Renderer::compressedFormats(). Images in
+        other compressed formats are decompressed before they are uploaded.
+        StandardSurfaceInterface sets this when it creates the renderer.
+     */
+    std::vector<Texture::Format> compressedFormats() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_compressedFormats;
+    }
+    void setCompressedFormats(const std::vector<Texture::Format> &formats) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_compressedFormats = formats;
+    }
+
+    /*!
+        Contains the largest width or height of the images which are loaded,
+        usually the renderer's Renderer::maxTextureSize(). Larger images
+        fail to load. StandardSurfaceInterface sets this along with the
+        compressed formats.
+     */
+    int maxTextureSize() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_maxTextureSize;
+    }
+    void setMaxTextureSize(int size) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxTextureSize = std::min(size, texturecompression::maxImageSize);
+    }
+
+    /*!
+        Contains the number of bytes upload() may send to the GPU in one
+        call. At least one row of an image is uploaded per call regardless.
+        Compressed images are uploaded whole.
+
+        The default is 4 MB.
+     */
+    unsigned uploadBudget() const { return m_uploadBudget; }
+    void setUploadBudget(unsigned bytes) { m_uploadBudget = bytes; }
+
+    /*!
+        Queues \a source for decoding and returns the texture it will be
+        uploaded to. The caller owns the texture. Deleting it before it is
+        ready cancels the load.
+     */
+    AsyncTexture *load(const std::string &source) {
+        assert(m_decoder);
+        AsyncTexture *texture = new AsyncTexture(this, source);
+        AsyncTexture::Job *job = new AsyncTexture::Job();
+        job->texture = texture;
+        job->source = source;
+        texture->m_job = job;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_threads.empty()) {
+                for (unsigned i=0; i<m_threadCount; ++i)
+                    m_threads.push_back(std::thread(&TextureLoader::decodeJobs, this));
+            }
+            m_queue.push_back(job);
+        }
+        m_wakeup.notify_one();
+        return texture;
+    }
+
+    /*!
+        Uploads decoded images to their textures, at most uploadBudget()
+        bytes of them. Call this on the render thread, with the GL context
+        current, once per frame.
+
+        Returns true if there are decoded images left to upload, in which
+        case another frame should be scheduled. Images which are still
+        being decoded do not count; see setDecodedCallback() for how to
+        hear about those.
+     */
+    bool upload() {
+        unsigned budget = m_uploadBudget;
+        bool first = true;
+        while (true) {
+            if (!m_uploading) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_decoded.empty())
+                    break;
+                m_uploading = m_decoded.front();
+                m_decoded.pop_front();
+            }
+
+            AsyncTexture::Job *job = m_uploading;
+            AsyncTexture *texture = job->texture;
+            if (!texture || !job->decoded) {
+                if (texture) {
+                    texture->m_state = AsyncTexture::Failed;
+                    texture->m_job = 0;
+                }
+                drop(job);
+                m_uploading = 0;
+                continue;
+            }
+
+            const DecodedImage &image = job->image;
+            if (image.format & Texture::CompressedFormatMask) {
+                const unsigned size = unsigned(texturecompression::dataSize(image.format, image.width, image.height));
+                if (size > budget && !first)
+                    break;
+                first = false;
+                uploadCompressed(job);
+                budget -= std::min(budget, size);
+            } else {
+                const unsigned stride = image.width * 4;
+                unsigned rows = std::min<unsigned>(budget / stride, image.height - job->uploadedRows);
+                if (rows == 0) {
+                    if (!first)
+                        break;
+                    rows = 1;
+                }
+                first = false;
+                uploadRows(job, rows);
+                budget -= std::min(budget, rows * stride);
+            }
+
+            if (job->uploadedRows == image.height) {
+                texture->m_state = AsyncTexture::Ready;
+                texture->m_job = 0;
+                drop(job);
+                m_uploading = 0;
+            }
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_uploading || !m_decoded.empty();
+    }
+
+    /*!
+        Returns true while there are images waiting to be decoded or
+        uploaded.
+     */
+    bool isLoading() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_uploading || m_decoding > 0 || !m_queue.empty() || !m_decoded.empty();
+    }
+
+private:
+    friend class AsyncTexture;
+
+    void decodeJobs() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_wakeup.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+            if (m_quit)
+                return;
+            AsyncTexture::Job *job = m_queue.front();
+            m_queue.pop_front();
+            ++m_decoding;
+            const std::vector<Texture::Format> compressedFormats = m_compressedFormats;
+            const int maxTextureSize = m_maxTextureSize;
+            lock.unlock();
+
+            DecodedImage &image = job->image;
+            job->decoded = m_decoder(job->source, &image)
+                           && image.pixels && texturecompression::isValidSize(image.width, image.height)
+                           && image.width <= maxTextureSize && image.height <= maxTextureSize;
+            if (job->decoded && (image.format & Texture::CompressedFormatMask)) {
+                if (std::find(compressedFormats.begin(), compressedFormats.end(), image.format) == compressedFormats.end())
+                    job->decoded = decompress(&image);
+            } else if (job->decoded) {
+                const unsigned count = image.width * image.height;
+                if (!(image.format & Texture::AlphaFormatMask))
+                    pixels::fillAlpha(image.pixels, count);
+                else if (!image.premultiplied)
+                    pixels::premultiply(image.pixels, count);
+            }
+
+            lock.lock();
+            --m_decoding;
+            if (job->texture) {
+                m_decoded.push_back(job);
+                if (m_decodedCallback)
+                    m_decodedCallback();
+            } else {
+                drop(job);
+            }
+        }
+    }
+
+    void uploadCompressed(AsyncTexture::Job *job) {
+        AsyncTexture *texture = job->texture;
+        const DecodedImage &image = job->image;
+        if (texture->m_id == 0)
+            glGenTextures(1, &texture->m_id);
+        glBindTexture(GL_TEXTURE_2D, texture->m_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, texturecompression::glInternalFormat(image.format),
+                               image.width, image.height, 0,
+                               texturecompression::dataSize(image.format, image.width, image.height), image.pixels);
+        texture->m_size = vec2(image.width, image.height);
+        texture->m_format = image.format;
+        job->uploadedRows = image.height;
+    }
+
+    void uploadRows(AsyncTexture::Job *job, unsigned rows) {
+        AsyncTexture *texture = job->texture;
+        const DecodedImage &image = job->image;
+        if (job->uploadedRows == 0) {
+            if (texture->m_id == 0)
+                glGenTextures(1, &texture->m_id);
+            glBindTexture(GL_TEXTURE_2D, texture->m_id);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            texture->m_size = vec2(image.width, image.height);
+            texture->m_format = image.format;
+        } else {
+            glBindTexture(GL_TEXTURE_2D, texture->m_id);
+        }
+
+        const unsigned stride = image.width * 4;
+        const unsigned char *bits = image.pixels + job->uploadedRows * stride;
+#ifdef GL_PIXEL_UNPACK_BUFFER
+        // Respecifying the buffer's storage each time lets the driver hand
+        // out fresh memory rather than wait for the previous copy.
+        if (m_pixelBuffer == 0)
+            glGenBuffers(1, &m_pixelBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, rows * stride, bits, GL_STREAM_DRAW);
+        bits = 0;
+#endif
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job->uploadedRows, image.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, bits);
+#ifdef GL_PIXEL_UNPACK_BUFFER
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+        job->uploadedRows += rows;
+    }
+
+    // Replaces a compressed image with its RGBA pixels
+    static bool decompress(DecodedImage *image) {
+        unsigned char *pixels = (unsigned char *) malloc(texturecompression::dataSize(Texture::RGBA_32, image->width, image->height));
+        if (!pixels)
+            return false;
+        if (!texturecompression::decompress(image->format, image->width, image->height, image->pixels, pixels)) {
+            ::free(pixels);
+            return false;
+        }
+        image->freePixels(image->pixels);
+        image->pixels = pixels;
+        image->freePixels = ::free;
+        image->format = (image->format & Texture::AlphaFormatMask) ? Texture::RGBA_32 : Texture::RGBx_32;
+        return true;
+    }
+
+    // Called from ~AsyncTexture(). Jobs which are being decoded or uploaded
+    // are dropped once that is done.
+    void cancel(AsyncTexture *texture) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        AsyncTexture::Job *job = texture->m_job;
+        if (!job)
+            return;
+        job->texture = 0;
+        texture->m_job = 0;
+        auto queued = std::find(m_queue.begin(), m_queue.end(), job);
+        if (queued != m_queue.end()) {
+            m_queue.erase(queued);
+            drop(job);
+        }
+    }
+
+    static void drop(AsyncTexture::Job *job) {
+        if (job->image.pixels)
+            job->image.freePixels(job->image.pixels);
+        delete job;
+    }
+
+    Decoder m_decoder;
+    DecodedCallback m_decodedCallback;
+    unsigned m_threadCount;
+    unsigned m_uploadBudget;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::vector<std::thread> m_threads;
+    std::deque<AsyncTexture::Job *> m_queue;
+    std::deque<AsyncTexture::Job *> m_decoded;
+    std::vector<Texture::Format> m_compressedFormats;
+    int m_maxTextureSize = texturecompression::maxImageSize;
+    unsigned m_decoding = 0;
+    bool m_quit;
+
+    // Only touched on the render thread
+    AsyncTexture::Job *m_uploading;
+    GLuint m_pixelBuffer;
+};
+
+inline AsyncTexture::~AsyncTexture()
+{
+    // Only loading textures are known to the loader, which may be gone by
+    // the time the ready ones are deleted.
+    if (m_job)
+        m_loader->cancel(this);
+    if (m_id)
+        glDeleteTextures(1, &m_id);
+}
+
+RENGINE_END_NAMESPACE
@@ -11,6 +11,9 @@ int rengine_main(int argc, char **argv) {
     Surface *surface = backend->createSurface(&iface);
     surface->show();
     backend->run();
+#ifdef RENGINE_LOG_ALLOCATION_POOLS
+    AllocationPoolBase::dumpStatistics();
+#endif
     return 0;
 }
 
@@ -12,6 +12,7 @@ public:
 
     ~StandardSurfaceInterface()
     {
+        m_textureLoader.setDecodedCallback(TextureLoader::DecodedCallback());
         if (m_renderer->sceneRoot())
             m_renderer->sceneRoot()->destroy();
         delete m_renderer;
@@ -22,17 +23,53 @@ public:
     virtual void beforeRender() { }
     virtual void afterRender() { }
 
-    void onRender() {
+    void onRender() override { renderFrame(true); }
+
+    /*!
+        Renders a frame for the compositor animations without calling
+        update(), so an application which is slow to update() does not
+        hold them back. The first frame always goes through update().
+     */
+    void onCompositorRender() override { renderFrame(m_renderer == 0); }
+
+    Renderer *renderer() const { return m_renderer; }
+
+    AnimationManager *animationManager() { return &m_animationManager; }
+
+    /*!
+        Animations which are applied on the render side of the frame, see
+        CompositorAnimations. Their times are on the animationManager()'s
+        currentTime() clock.
+     */
+    CompositorAnimations *compositorAnimations() { return &m_compositorAnimations; }
+
+    /*!
+        Loads textures on worker threads and uploads them before each frame,
+        see TextureLoader. Set a decoder before loading anything.
+     */
+    TextureLoader *textureLoader() { return &m_textureLoader; }
+
+private:
+    void renderFrame(bool updateScene) {
         surface()->makeCurrent();
 
         // Initialize the renderer if this is the first time around
         if (!m_renderer) {
             m_renderer = Backend::get()->createRenderer(surface());
+            m_textureLoader.setCompressedFormats(m_renderer->compressedFormats());
+            m_textureLoader.setMaxTextureSize(m_renderer->maxTextureSize());
+            Surface *s = surface();
+            m_textureLoader.setDecodedCallback([s] { s->requestRenderFromAnyThread(); });
             m_animationManager.start();
         }
 
         // Create the scene graph; update if it already exists..
-        m_renderer->setSceneRoot(update(m_renderer->sceneRoot()));
+        if (updateScene)
+            m_renderer->setSceneRoot(update(m_renderer->sceneRoot()));
+
+        // Move decoded images into their textures, a few at a time. Images
+        // which are still being decoded request a render when they are done.
+        bool texturesUploading = m_textureLoader.upload();
 
         if (!m_renderer->sceneRoot())
             return;
@@ -41,31 +78,40 @@ public:
         m_animationManager.tick();
 
 
+        // Compositor animations are applied last, so they win over whatever
+        // update() did to the same properties.
+        m_compositorAnimations.tick(m_animationManager.currentTime());
+
         // And then render the stuff
         beforeRender();
         m_renderer->render();
         afterRender();
 
         surface()->swapBuffers();
+        m_animationManager.framePresented();
+        m_animationManager.setRenderedFrame(m_renderer->frameNumber());
         m_renderer->frameSwapped();
-
-        // Schedule a repaint again if there are animations running...
-
-        // ### TODO: Optimize waiting for scheduled animations. Rather than
-        // just keep on rendering, we should figure out how long we need to
-        // wait and schedule an update at that time.
-        if (m_animationManager.animationsRunning() || m_animationManager.animationsScheduled()) {
+        AllocationPoolBase::endFrame();
+
+        // Schedule a repaint again if there are animations running, or
+        // sleep until the next scheduled animation is due. When only the
+        // compositor animations are running, the application is left out.
+        double next = m_animationManager.timeToNextAnimation();
+        double compositorNext = m_compositorAnimations.timeToNextAnimation();
+        if (next == 0 || texturesUploading)
             surface()->requestRender();
-        }
+        else if (compositorNext == 0)
+            surface()->requestCompositorRender();
+        else if (compositorNext > 0 && (next < 0 || compositorNext < next))
+            surface()->scheduleRender(compositorNext);
+        else if (next > 0)
+            surface()->scheduleRender(next);
     }
 
-    Renderer *renderer() const { return m_renderer; }
-
-    AnimationManager *animationManager() { return &m_animationManager; }
-
-private:
     Renderer *m_renderer;
     AnimationManager m_animationManager;
+    CompositorAnimations m_compositorAnimations;
+    TextureLoader m_textureLoader;
 };
 
 RENGINE_END_NAMESPACE
@@ -71,6 +71,33 @@ public:
 
     virtual void requestRender() = 0;
 
+    /*!
+        Called by the application to request a render \a delay seconds from
+        now, for instance when the next animation is scheduled to start.
+        Until then, the surface can stay idle.
+
+        The default implementation requests a render right away; backends
+        should reimplement this with a timer.
+     */
+    virtual void scheduleRender(double delay) { requestRender(); }
+
+    /*!
+        Requests a render like requestRender(), but may be called from any
+        thread, for instance when a worker thread has produced something
+        for the next frame. Unlike requestRender(), it leaves a pending
+        scheduleRender() in place.
+     */
+    virtual void requestRenderFromAnyThread() = 0;
+
+    /*!
+        Requests a render which only needs to advance animations running
+        on the render side, see SurfaceInterface::onCompositorRender().
+        Calling requestRender() as well still gets the scene updated.
+
+        The default implementation calls requestRender().
+     */
+    virtual void requestCompositorRender() { requestRender(); }
+
 protected:
     void setSurfaceToInterface(SurfaceInterface *iface);
 };
@@ -87,6 +114,16 @@ public:
      */
     virtual void onRender() { };
 
+    /*!
+        Reimplement this function to render a frame in which only the
+        animations on the render side have changed, without updating the
+        rest of the scene. Called in response to
+        Surface::requestCompositorRender().
+
+        The default implementation calls onRender().
+     */
+    virtual void onCompositorRender() { onRender(); }
+
     /*!
         Reimplement this function to get notified when the surface's
         size has changed.
@@ -27,6 +27,7 @@
 #include <QWindow>
 #include <QOpenGLContext>
 #include <QTimer>
+#include <QEvent>
 
 #include "rengine.h"
 
@@ -72,17 +73,27 @@ class QtWindow : public QWindow
 public:
     QtWindow(QtSurface *s)
     : s(s)
+    , updateScene(true)
 #ifndef QWINDOW_HAS_REQUEST_UPDATE
     , updateTimer(0)
 #endif
     {
+        scheduleTimer.setSingleShot(true);
+        QObject::connect(&scheduleTimer, &QTimer::timeout, [this] { updateScene = true; requestUpdate(); });
     }
 
+    static const QEvent::Type RenderRequestEvent = QEvent::User;
+
     bool event(QEvent *e);
     void exposeEvent(QExposeEvent *e);
     void resizeEvent(QResizeEvent *e);
+    void render();
 
     QtSurface *s;
+    QTimer scheduleTimer;
+
+    // Set by all requests except requestCompositorRender(), see render()
+    bool updateScene;
 
 #ifndef QWINDOW_HAS_REQUEST_UPDATE
     void requestUpdate() {
@@ -136,8 +147,22 @@ public:
         return vec2(window.width() * dpr, window.height() * dpr);
     }
     void requestRender() {
+        window.scheduleTimer.stop();
+        window.updateScene = true;
+        window.requestUpdate();
+    }
+    void requestCompositorRender() {
+        window.scheduleTimer.stop();
         window.requestUpdate();
     }
+    void scheduleRender(double delay) {
+        window.scheduleTimer.start(int(std::ceil(delay * 1000)));
+    }
+    // postEvent() is thread-safe; the window calls requestUpdate() when it
+    // gets the event on the gui thread.
+    void requestRenderFromAnyThread() {
+        QCoreApplication::postEvent(&window, new QEvent(QtWindow::RenderRequestEvent));
+    }
 
     QOpenGLContext context;
     QtWindow window;
@@ -191,21 +216,38 @@ Renderer *QtBackend::createRenderer(Surface *surface)
 
 bool QtWindow::event(QEvent *e)
 {
+    if (e->type() == RenderRequestEvent) {
+        updateScene = true;
+        requestUpdate();
+        return true;
+    }
 #ifdef QWINDOW_HAS_REQUEST_UPDATE
     if (e->type() == QEvent::UpdateRequest) {
-        s->iface->onRender();
+        render();
         return true;
     }
 #else
     if (e->type() == QEvent::Timer) {
         killTimer(updateTimer);
         updateTimer = 0;
-        s->iface->onRender();
+        render();
     }
 #endif
     return QWindow::event(e);
 }
 
+// Requests are coalesced into one update, which only leaves out the scene
+// if all of them came from requestCompositorRender().
+void QtWindow::render()
+{
+    if (updateScene) {
+        updateScene = false;
+        s->iface->onRender();
+    } else {
+        s->iface->onCompositorRender();
+    }
+}
+
 void QtWindow::exposeEvent(QExposeEvent *e)
 {
     if (isExposed() && isVisible())
@@ -190,6 +190,7 @@ OpenGLRenderer::OpenGLRenderer()
     , m_vertices(0)
     , m_elements(0)
     , m_farPlane(0)
+    , m_transform(0)
     , m_activeShader(0)
     , m_texCoordBuffer(0)
     , m_vertexBuffer(0)
@@ -197,6 +198,7 @@ OpenGLRenderer::OpenGLRenderer()
     , m_matrixState(UpdateAllPrograms)
     , m_render3d(false)
     , m_layered(false)
+    , m_drawn(false)
 {
     std::memset(&prog_layer, 0, sizeof(prog_layer));
     std::memset(&prog_solid, 0, sizeof(prog_solid));
@@ -213,16 +215,31 @@ OpenGLRenderer::~OpenGLRenderer()
 
 bool OpenGLRenderer::readPixels(int x, int y, int w, int h, unsigned *bytes)
 {
-    // Read line-by-line and flip it so we get what we want out..
-    // Slow as hell, but this is used for autotesting, so who cares..
-    for (int i=0; i<h; ++i)
-        glReadPixels(x, h - i - 1, w, 1, GL_RGBA, GL_UNSIGNED_BYTE, bytes + i * w);
+    // Read it all in one go, then flip it from OpenGL's bottom-up order
+    // so the first line is y..
+    const int surfaceHeight = targetSurface()->size().y;
+    glReadPixels(x, surfaceHeight - y - h, w, h, GL_RGBA, GL_UNSIGNED_BYTE, bytes);
+    pixels::flipLines((unsigned char *) bytes, w * sizeof(unsigned), h);
     return true;
 }
 
 Texture *OpenGLRenderer::createTextureFromImageData(const vec2 &size, Texture::Format format, void *data)
 {
+    if (!texturecompression::isValidSize(size.x, size.y) || size.x > maxTextureSize() || size.y > maxTextureSize())
+        return 0;
     OpenGLTexture *layer = new OpenGLTexture();
+    if ((format & Texture::CompressedFormatMask)
+        && std::find(m_compressedFormats.begin(), m_compressedFormats.end(), format) == m_compressedFormats.end()) {
+        // Not supported by the GPU, so decompress it..
+        std::vector<unsigned char> pixels(texturecompression::dataSize(Texture::RGBA_32, size.x, size.y));
+        if (!texturecompression::decompress(format, size.x, size.y, (const unsigned char *) data, pixels.data())) {
+            delete layer;
+            return 0;
+        }
+        layer->setFormat((format & Texture::AlphaFormatMask) ? Texture::RGBA_32 : Texture::RGBx_32);
+        layer->upload(size.x, size.y, pixels.data());
+        return layer;
+    }
     layer->setFormat(format);
     layer->upload(size.x, size.y, data);
     return layer;
@@ -284,6 +301,22 @@ void OpenGLRenderer::initialize()
     prog_shadow.dir = prog_shadow.resolve("dir");
     prog_shadow.color = prog_shadow.resolve("color");
 
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+
+    {   // Find out which of the compressed formats we can upload as is
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+        std::vector<GLint> glFormats(std::max(count, 0));
+        if (count > 0)
+            glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, glFormats.data());
+        m_compressedFormats.clear();
+        for (GLint glFormat : glFormats) {
+            Texture::Format format;
+            if (texturecompression::formatFromGLInternalFormat(glFormat, &format))
+                m_compressedFormats.push_back(format);
+        }
+    }
+
 #ifdef RENGINE_LOG_INFO
     static bool logged = false;
     if (!logged) {
@@ -305,6 +338,7 @@ void OpenGLRenderer::initialize()
         cout << " - Depth/Stencil ....: " << d << " " << s << endl;
         cout << " - Samples ..........: " << samples << endl;
         cout << " - Max Texture Size .: " << maxTexSize << endl;
+        cout << " - Compressed .......: " << m_compressedFormats.size() << " of rengine's formats" << endl;
         cout << " - Extensions .......: " << glGetString(GL_EXTENSIONS) << endl;
     }
 #endif
@@ -441,6 +475,13 @@ void OpenGLRenderer::prepass(Node *n)
             ++m_numLayeredNodes;
         break;
     case Node::OpacityNodeType:
+        // Fully transparent subtrees are skipped by build() as well. The
+        // node itself counts as drawn so that animations fading it back in
+        // keep running at full rate.
+        if (static_cast<OpacityNode *>(n)->opacity() <= 0) {
+            n->setRenderedFrame(frameNumber());
+            return;
+        }
         if (static_cast<OpacityNode *>(n)->opacity() < 1)
             ++m_numLayeredNodes;
         break;
@@ -486,13 +527,19 @@ void OpenGLRenderer::build(Node *n)
             e->z = (m_m3d * vec3((p1 + p2) / 2.0f)).z;
             projectQuad(p1, p2, v);
 
-        } else {
+        } else if (m_m2d.isAxisAligned()) {
             vec2 a = m_m2d * p1;
             vec2 b = m_m2d * p2;
             v[0] = vec2(a.x, a.y);
             v[1] = vec2(a.x, b.y);
             v[2] = vec2(b.x, a.y);
             v[3] = vec2(b.x, b.y);
+        } else {
+            v[0] = p1;
+            v[1] = vec2(p1.x, p2.y);
+            v[2] = vec2(p2.x, p1.y);
+            v[3] = p2;
+            m_m2d.map(v, v, 4);
         }
         m_vertexIndex += 4;
         m_elementIndex += 1;
@@ -504,6 +551,21 @@ void OpenGLRenderer::build(Node *n)
             // cout << " ----> bounds: " << m_layerBoundingBox << endl;
         }
 
+        // Only flat quads are checked against the surface. Layers and 3D
+        // can pull content in from the outside, so those count as drawn.
+        bool drawn = true;
+        if (!m_render3d && !m_layered) {
+            rect2d bounds(v[0], v[0]);
+            for (int i=1; i<4; ++i)
+                bounds |= v[i];
+            drawn = bounds.right() > 0 && bounds.bottom() > 0
+                    && bounds.left() < m_surfaceSize.x && bounds.top() < m_surfaceSize.y;
+        }
+        if (drawn) {
+            n->setRenderedFrame(frameNumber());
+            m_drawn = true;
+        }
+
     } break;
 
     case Node::TransformNodeType: {
@@ -520,15 +582,22 @@ void OpenGLRenderer::build(Node *n)
             e->projection = true;
         }
 
-        mat4 *m = m_render3d ? &m_m3d : &m_m2d;
-        mat4 old = *m;
-        *m = *m * tn->matrix();
+        // The accumulated matrices are cached in the node and only
+        // recomputed when it or one of its ancestors have changed.
+        tn->updateWorldTransform(m_transform);
+        const TransformNode *oldTransform = m_transform;
+        affine2d old2d = m_m2d;
+        mat4 old3d = m_m3d;
+        m_transform = tn;
+        m_m2d = tn->m_worldMatrix;
+        m_m3d = tn->m_worldMatrix3D;
 
-        for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+        buildChildren(n);
 
         // restore previous state
-        *m = old;
+        m_transform = oldTransform;
+        m_m2d = old2d;
+        m_m3d = old3d;
         if (e) {
             m_render3d = false;
             m_farPlane = 0;
@@ -542,6 +611,10 @@ void OpenGLRenderer::build(Node *n)
     case Node::ColorFilterNodeType:
     case Node::OpacityNodeType: {
 
+        // Marked as drawn in prepass()
+        if (n->type() == Node::OpacityNodeType && static_cast<OpacityNode *>(n)->opacity() <= 0)
+            return;
+
         bool useTexture =
             (n->type() == Node::OpacityNodeType && static_cast<OpacityNode *>(n)->opacity() < 1.0f)
             || (n->type() == Node::ColorFilterNodeType && !static_cast<ColorFilterNode *>(n)->colorMatrix().isIdentity())
@@ -563,14 +636,23 @@ void OpenGLRenderer::build(Node *n)
         }
         // cout << " -- building layered node into " << e << endl;
 
-        for (Node *c = n->child(); c; c = c->sibling())
-            build(c);
+        buildChildren(n);
 
         if (e) {
             m_layered = storedTextureed;
             e->groupSize = (m_elements + m_elementIndex) - e - 1;
             // cout << "groupSize of " << e << " is " << e->groupSize << " based on: " << m_elements << " " << m_elementIndex << " " << e << endl;
             e->vboOffset = m_vertexIndex;
+
+            // Everything below a layer can be skipped when it is fully
+            // transparent, and then there is nothing to draw.
+            const bool empty = e->groupSize == 0;
+            if (empty) {
+                e->layered = false;
+                e->completed = true;
+                m_layerBoundingBox = rect2d(0, 0, 0, 0);
+            }
+
             rect2d box = m_layerBoundingBox.aligned();
             vec2 *v = m_vertices + m_vertexIndex;
             v[0] = box.tl;
@@ -607,11 +689,11 @@ void OpenGLRenderer::build(Node *n)
 
             // We're a nested layer, accumulate the layered bounding box into
             // the stored one..
-            if (storedTextureed)
+            if (storedTextureed && !empty)
                 storedBox |= m_layerBoundingBox;
 
             m_layerBoundingBox = storedBox;
-            if (m_render3d) {
+            if (m_render3d && !empty) {
                 // Let the opacity layer's z be the average of all its children..
                 float z = 0;
                 for (unsigned i=0; i<=e->groupSize; ++i)
@@ -626,10 +708,22 @@ void OpenGLRenderer::build(Node *n)
         break;
     }
 
+    buildChildren(n);
+}
+
+/*!
+    Builds the children of \a n and marks \a n as drawn in this frame if any
+    of them were.
+ */
+void OpenGLRenderer::buildChildren(Node *n)
+{
+    bool storedDrawn = m_drawn;
+    m_drawn = false;
     for (Node *c = n->child(); c; c = c->sibling())
         build(c);
-
-
+    if (m_drawn)
+        n->setRenderedFrame(frameNumber());
+    m_drawn = m_drawn || storedDrawn;
 }
 
 static void rengine_create_texture(int id, int w, int h)
@@ -794,7 +888,10 @@ void OpenGLRenderer::render(Element *first, Element *last)
             drawColorQuad(e->vboOffset, static_cast<RectangleNode *>(e->node)->color());
         } else if (e->node->type() == Node::TextureNodeType) {
             // cout << space << "---> texture quad, vbo=" << e->vboOffset << endl;
-            drawTextureQuad(e->vboOffset, static_cast<TextureNode *>(e->node)->layer()->textureId());
+            // Textures which are still loading have no id yet, see AsyncTexture
+            const Texture *texture = static_cast<TextureNode *>(e->node)->layer();
+            if (texture && texture->textureId())
+                drawTextureQuad(e->vboOffset, texture->textureId());
         } else if (e->node->type() == Node::OpacityNodeType && e->layered) {
             // cout << space << "---> layered texture quad, vbo=" << e->vboOffset << " texture=" << e->texture << endl;
             drawTextureQuad(e->vboOffset, e->texture, static_cast<OpacityNode *>(e->node)->opacity());
@@ -843,6 +940,8 @@ bool OpenGLRenderer::render()
         return false;
     }
 
+    beginFrame();
+
     m_numLayeredNodes = 0;
     m_numTextureNodes = 0;
     m_numRectangleNodes = 0;
@@ -857,6 +956,13 @@ bool OpenGLRenderer::render()
                             + m_numLayeredNodes
                             + m_numRectangleNodes
                             + m_additionalQuads) * 4;
+
+    // Clear even when there is nothing to draw, as the surface is swapped
+    // regardless, for instance when the whole scene is faded out.
+    vec4 c = fillColor();
+    glClearColor(c.x, c.y, c.z, c.w);
+    glClear(GL_COLOR_BUFFER_BIT);
+
     if (vertexCount == 0)
         return true;
 
@@ -872,6 +978,8 @@ bool OpenGLRenderer::render()
     //                    << vertexCount * sizeof(vec2) << " bytes (" << vertexCount << " vertices), "
     //                    << elementCount * sizeof(Element) << " bytes (" << elementCount << " elements)"
     //                    << endl;
+    m_surfaceSize = targetSurface()->size();
+    m_drawn = false;
     build(sceneRoot());
     assert(elementCount > 0);
     assert(m_elementIndex == elementCount);
@@ -894,12 +1002,6 @@ bool OpenGLRenderer::render()
     glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(vec2), m_vertices, GL_STATIC_DRAW);
 
-    m_surfaceSize = targetSurface()->size();
-
-    vec4 c = fillColor();
-    glClearColor(c.x, c.y, c.z, c.w);
-    glClear(GL_COLOR_BUFFER_BIT);
-
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_STENCIL_TEST);
     glDepthMask(false);
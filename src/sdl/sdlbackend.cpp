@@ -47,7 +47,7 @@ class SdlBackend : public Backend
 public:
     SdlBackend()
     {
-        if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0)
             sdldie("Unable to initialize SDL");
 #ifdef RENGINE_LOG_INFO
         cout << "SdlBackend: created..." << endl;
@@ -59,6 +59,10 @@ public:
     void processEvents();
     Surface *createSurface(SurfaceInterface *iface);
     Renderer *createRenderer(Surface *surface);
+
+    SdlSurface *scheduledSurface(unsigned serial) const;
+
+    std::vector<SdlSurface *> surfaces;
 };
 
 class SdlWindow
@@ -93,6 +97,8 @@ public:
     SdlSurface(SurfaceInterface *iface)
     : window(this)
     , iface(iface)
+    , scheduleTimer(0)
+    , scheduleSerial(0)
     {
         setSurfaceToInterface(iface);
 #ifdef RENGINE_LOG_INFO
@@ -101,6 +107,12 @@ public:
         requestRender();
     }
 
+    ~SdlSurface() {
+        cancelScheduledRender();
+        std::vector<SdlSurface *> &surfaces = static_cast<SdlBackend *>(Backend::get())->surfaces;
+        surfaces.erase(std::find(surfaces.begin(), surfaces.end(), this));
+    }
+
     bool makeCurrent() {
         static bool warned = false;
         if (!warned) {
@@ -130,7 +142,59 @@ public:
         return vec2(w, h);
     }
 
+    // The code of the SDL_USEREVENTs which trigger a render
+    enum RenderEventCode {
+        RenderRequestCode,
+        ScheduledRenderCode,
+        CompositorRenderCode
+    };
+
     void requestRender() {
+        // An immediate render supersedes a scheduled one.
+        cancelScheduledRender();
+        pushRenderEvent(RenderRequestCode);
+    }
+
+    void requestCompositorRender() {
+        cancelScheduledRender();
+        pushRenderEvent(CompositorRenderCode);
+    }
+
+    // SDL_PushEvent() is thread-safe, so the event can be posted directly;
+    // scheduleTimer is left alone as it belongs to the event loop's thread.
+    void requestRenderFromAnyThread() {
+        pushRenderEvent(RenderRequestCode);
+    }
+
+    // Each schedule gets a serial which its timer posts with the event, so
+    // events from timers which have been replaced or cancelled in the
+    // meantime can be told apart and dropped, see SdlBackend::run().
+    void scheduleRender(double delay) {
+        static unsigned lastSerial = 0;
+        cancelScheduledRender();
+        scheduleSerial = ++lastSerial;
+        if (scheduleSerial == 0)
+            scheduleSerial = ++lastSerial;
+        scheduleTimer = SDL_AddTimer(Uint32(std::ceil(delay * 1000)), &SdlSurface::onScheduleTimer,
+                                     reinterpret_cast<void *>(uintptr_t(scheduleSerial)));
+    }
+
+    // Removing a timer which has already fired is harmless, as SDL does not
+    // reuse timer ids. Its event may still be queued though; clearing the
+    // serial makes sure it is ignored.
+    void cancelScheduledRender() {
+        if (scheduleTimer) {
+            SDL_RemoveTimer(scheduleTimer);
+            scheduleTimer = 0;
+        }
+        scheduleSerial = 0;
+    }
+
+    void pushRenderEvent(RenderEventCode code) {
+        pushRenderEvent(this, code, NULL);
+    }
+
+    static void pushRenderEvent(SdlSurface *surface, RenderEventCode code, void *data) {
         // we can't trigger the render synchronously. we need to give a chance
         // to process input, animations, whatever -- so push an event onto the
         // queue and we'll get back to this later.
@@ -138,9 +202,9 @@ public:
 
         SDL_UserEvent renderev;
         renderev.type = SDL_USEREVENT;
-        renderev.code = 0;
-        renderev.data1 = this;
-        renderev.data2 = NULL;
+        renderev.code = code;
+        renderev.data1 = surface;
+        renderev.data2 = data;
 
         event.type = SDL_USEREVENT;
         event.user = renderev;
@@ -148,10 +212,28 @@ public:
         SDL_PushEvent(&event);
     }
 
+    // Runs on SDL's timer thread, so only post the schedule's serial from
+    // here and leave finding the surface to the event loop's thread.
+    static Uint32 onScheduleTimer(Uint32 interval, void *param) {
+        pushRenderEvent(0, ScheduledRenderCode, param);
+        return 0;
+    }
+
     SdlWindow window;
     SurfaceInterface *iface;
+    SDL_TimerID scheduleTimer;
+    unsigned scheduleSerial;
 };
 
+SdlSurface *SdlBackend::scheduledSurface(unsigned serial) const
+{
+    for (SdlSurface *s : surfaces) {
+        if (s->scheduleSerial == serial)
+            return s;
+    }
+    return 0;
+}
+
 Backend *Backend::get()
 {
     static SdlBackend *singleton = new SdlBackend();
@@ -175,9 +257,19 @@ void SdlBackend::run()
     while (!done && SDL_WaitEvent(&event)) {
         switch (event.type) {
             case SDL_USEREVENT: {
-                // process the asynchronous render request
+                // process the asynchronous render request. A scheduled render
+                // whose schedule was cancelled or replaced in the meantime is
+                // dropped; whatever did that has asked for its own render.
                 SdlSurface *surface = static_cast<SdlSurface *>(event.user.data1);
-                surface->iface->onRender();
+                if (event.user.code == SdlSurface::ScheduledRenderCode) {
+                    surface = scheduledSurface(unsigned(uintptr_t(event.user.data2)));
+                    if (!surface)
+                        break;
+                }
+                if (event.user.code == SdlSurface::CompositorRenderCode)
+                    surface->iface->onCompositorRender();
+                else
+                    surface->iface->onRender();
                 break;
             }
             case SDL_QUIT: {
@@ -199,6 +291,7 @@ Surface *SdlBackend::createSurface(SurfaceInterface *iface)
 {
     assert(iface);
     SdlSurface *s = new SdlSurface(iface);
+    surfaces.push_back(s);
     return s;
 }
 
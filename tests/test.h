@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <cmath>
 #include <iostream>
+#include <list>
 #include <string>
 #include "rengine.h"
 
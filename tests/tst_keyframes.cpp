@@ -27,6 +27,7 @@
 #include "test.h"
 
 #include <vector>
+#include <thread>
 
 struct Thing
 {
@@ -59,9 +60,1016 @@ void tst_keyframes_basic()
     cout << __FUNCTION__ << ": ok" << endl;
 }
 
+void tst_keyframes_longTrack()
+{
+    // Width follows t^2 over a track with many keyframes, so every segment
+    // has a different slope and picking the wrong one shows.
+    const int keys = 500;
+    KeyFrames<Thing> keyFrames;
+    std::vector<double> times;
+    for (int i=0; i<keys; ++i) {
+        double t = i / double(keys - 1);
+        times.push_back(t);
+        keyFrames.times() << t;
+    }
+    auto &widths = keyFrames.addValues<double, Thing_setWidth>();
+    for (int i=0; i<keys; ++i)
+        widths << times[i] * times[i];
+
+    auto expected = [&times] (double t) {
+        if (t <= 0)
+            return 0.0;
+        if (t >= 1)
+            return 1.0;
+        size_t i1 = std::lower_bound(times.begin() + 1, times.end(), t) - times.begin();
+        double t0 = times[i1 - 1];
+        double t1 = times[i1];
+        double v0 = t0 * t0;
+        double v1 = t1 * t1;
+        return v0 + (v1 - v0) * (t - t0) / (t1 - t0);
+    };
+
+    Thing thing;
+    for (int dir=Animation::Normal; dir<=Animation::Reverse; ++dir) {
+        Animation animation;
+        animation.setDuration(1);
+        animation.setDirection((Animation::Direction) dir);
+        animation.setRunning(true);
+
+        // Monotonic ticks, both on and between keyframes
+        for (int i=0; i<3000; ++i) {
+            double t = i / 3000.0;
+            animation.tick(t, &thing, &keyFrames);
+            check_fuzzyEqual(thing.width, expected(dir == Animation::Normal ? t : 1 - t));
+        }
+
+        // Seeks back and forth
+        double seeks[] = { 0.9, 0.1, 0.5, 0.5, 0.0, 0.999, 0.25, 0.2505, 0.75 };
+        for (double t : seeks) {
+            animation.tick(t, &thing, &keyFrames);
+            check_fuzzyEqual(thing.width, expected(dir == Animation::Normal ? t : 1 - t));
+        }
+
+        animation.tick(1, &thing, &keyFrames);
+        check_fuzzyEqual(thing.width, (dir == Animation::Normal ? 1 : 0));
+        check_true(!animation.isRunning());
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// Reference solution by plain bisection on the curve parameter
+static double bezierReference(double x1, double y1, double x2, double y2, double x)
+{
+    auto bezier = [] (double p1, double p2, double s) {
+        return 3 * (1 - s) * (1 - s) * s * p1 + 3 * (1 - s) * s * s * p2 + s * s * s;
+    };
+    double lo = 0, hi = 1;
+    for (int i=0; i<100; ++i) {
+        double mid = (lo + hi) / 2;
+        if (bezier(x1, x2, mid) < x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return bezier(y1, y2, (lo + hi) / 2);
+}
+
+void tst_timingFunctions()
+{
+    const double curves[][4] = {
+        { 0.25, 0.1, 0.25, 1.0 },   // ease
+        { 0.42, 0.0, 1.0, 1.0 },    // ease-in
+        { 0.0, 0.0, 0.58, 1.0 },    // ease-out
+        { 0.42, 0.0, 0.58, 1.0 },   // ease-in-out
+        { 0.1, 0.8, 0.9, -0.5 },    // overshooting y
+        { 1.0, 0.0, 0.0, 1.0 },     // flat in the middle
+    };
+    for (auto &c : curves) {
+        CubicBezierTimingFunction f(c[0], c[1], c[2], c[3]);
+        check_equal(f(0), 0);
+        check_equal(f(1), 1);
+        for (int i=1; i<1000; ++i) {
+            double t = i / 1000.0;
+            check_true(std::abs(f(t) - bezierReference(c[0], c[1], c[2], c[3], t)) < 1e-4);
+        }
+    }
+
+    // Linear curve, presets and the preset types
+    CubicBezierTimingFunction linear(0.3, 0.3, 0.7, 0.7);
+    check_equal(linear(0.123), 0.123);
+    check_equal(CubicBezierTimingFunction()(0.5), EaseTimingFunction()(0.5));
+    check_equal(CubicBezierTimingFunction::easeIn()(0.3), EaseInTimingFunction()(0.3));
+    check_equal(CubicBezierTimingFunction::easeOut()(0.3), EaseOutTimingFunction()(0.3));
+    check_equal(CubicBezierTimingFunction::easeInOut()(0.3), EaseInOutTimingFunction()(0.3));
+    check_fuzzyEqual(EaseInOutTimingFunction()(0.5), 0.5);
+    check_true(EaseInTimingFunction()(0.25) < 0.25);
+    check_true(EaseOutTimingFunction()(0.25) > 0.25);
+
+    // steps()
+    StepsTimingFunction end(4);
+    check_equal(end(0), 0);
+    check_equal(end(0.24), 0);
+    check_equal(end(0.25), 0.25);
+    check_equal(end(0.99), 0.75);
+    check_equal(end(1), 1);
+    StepsTimingFunction start(4, StepsTimingFunction::Start);
+    check_equal(start(0), 0.25);
+    check_equal(start(0.24), 0.25);
+    check_equal(start(0.5), 0.75);
+    check_equal(start(0.99), 1);
+    check_equal(start(1), 1);
+
+    // Plugs into AnimationClosure and AnimationBatch
+    Thing thing;
+    AnimationClosure<Thing, EaseInTimingFunction> closure(&thing);
+    closure.keyFrames.times() << 0 << 1;
+    closure.keyFrames.addValues<double, Thing_setWidth>() << 0 << 100;
+    closure.setRunning(true);
+    closure.tick(0.3);
+    check_fuzzyEqual(thing.width, 100 * EaseInTimingFunction()(0.3));
+
+    AnimationClosure<Thing, StepsTimingFunction> stepped(&thing, StepsTimingFunction(2));
+    stepped.keyFrames.times() << 0 << 1;
+    stepped.keyFrames.addValues<double, Thing_setWidth>() << 0 << 100;
+    stepped.setRunning(true);
+    stepped.tick(0.7);
+    check_fuzzyEqual(thing.width, 50);
+
+    AnimationBatches batches;
+    auto *batch = batches.batch<double, Thing, Thing_setHeight, CubicBezierTimingFunction>();
+    batch->setTimingFunction(CubicBezierTimingFunction::easeOut());
+    batch->add(&thing, 0, 10, 0, 1);
+    batches.tick(0.4);
+    check_fuzzyEqual(thing.height, 10 * EaseOutTimingFunction()(0.4));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_animationBatch()
+{
+    const int count = 10000;
+    std::vector<Thing> things(count);
+
+    AnimationBatches batches;
+    auto *widths = batches.batch<double, Thing, Thing_setWidth>();
+    auto *heights = batches.batch<double, Thing, Thing_setHeight>();
+    check_true((void *) widths != (void *) heights);
+    check_true((batches.batch<double, Thing, Thing_setWidth>() == widths));
+
+    std::vector<AnimationBatch<double, Thing, Thing_setWidth>::Handle> handles;
+    for (int i=0; i<count; ++i) {
+        things[i].width = -1;
+        things[i].height = -1;
+        handles.push_back(widths->add(&things[i], 0, 100, 0, 10));
+    }
+    heights->add(&things[0], 0, 10, 0, 1, 2, Animation::Alternate);
+    heights->add(&things[1], 0, 10, 5, 1);                  // delayed
+    check_equal(batches.size(), unsigned(count + 2));
+
+    batches.tick(0.5);
+    check_fuzzyEqual(things[0].width, 5);
+    check_fuzzyEqual(things[count-1].width, 5);
+    check_fuzzyEqual(things[0].height, 5);
+    check_fuzzyEqual(things[1].height, -1);
+
+    // Removal swaps with the last and keeps the other handles valid
+    widths->remove(handles[0]);
+    check_true(!widths->isActive(handles[0]));
+    check_true(widths->isActive(handles[count-1]));
+    widths->remove(handles[count-1]);
+    check_equal(widths->size(), unsigned(count - 2));
+
+    batches.tick(1.5);                                      // second iteration runs backwards
+    check_fuzzyEqual(things[0].width, 5);
+    check_fuzzyEqual(things[1].width, 15);
+    check_fuzzyEqual(things[count-1].width, 5);
+    check_fuzzyEqual(things[0].height, 5);
+
+    batches.tick(5.5);
+    check_fuzzyEqual(things[0].height, 0);                       // alternated back to the start
+    check_fuzzyEqual(things[1].height, 5);
+    check_equal(heights->size(), 1u);
+
+    batches.tick(20);
+    check_fuzzyEqual(things[1].width, 100);
+    check_fuzzyEqual(things[1].height, 10);
+    check_equal(batches.size(), 0u);
+    check_true(!widths->isActive(handles[1]));
+
+    // Slots are reused once their animation is gone, but old handles stay
+    // inactive, also when removed while running
+    auto reused = widths->add(&things[0], 0, 1, 0, 1);
+    check_true((reused & 0xffffffff) < unsigned(count));
+    check_true(widths->isActive(reused));
+    for (int i=0; i<count; ++i)
+        check_true(handles[i] != reused && !widths->isActive(handles[i]));
+    widths->remove(reused);
+    check_true(!widths->isActive(reused));
+    auto again = widths->add(&things[0], 0, 1, 0, 1);
+    check_equal((again & 0xffffffff), (reused & 0xffffffff));
+    check_true(again != reused);
+    check_true(!widths->isActive(reused));
+    check_true(widths->isActive(again));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+struct Particle
+{
+    vec2 position;
+    vec4 color;
+    mat4 matrix;
+};
+
+struct Particle_setPosition { void operator()(const vec2 &v, Particle *p) { p->position = v; } };
+struct Particle_setColor { void operator()(const vec4 &v, Particle *p) { p->color = v; } };
+struct Particle_setMatrix { void operator()(const mat4 &m, Particle *p) { p->matrix = m; } };
+
+void tst_animationBatch_vectors()
+{
+    // Odd count, so the pairwise vec2 kernel has a tail
+    const int count = 1001;
+    std::vector<Particle> particles(count);
+
+    AnimationBatches batches;
+    auto *positions = batches.batch<vec2, Particle, Particle_setPosition>();
+    auto *colors = batches.batch<vec4, Particle, Particle_setColor, SmoothedTimingFunction>();
+    auto *matrices = batches.batch<mat4, Particle, Particle_setMatrix>();
+    for (int i=0; i<count; ++i) {
+        positions->add(&particles[i], vec2(i, 0), vec2(i + 10, 20), 0, 1);
+        colors->add(&particles[i], vec4(0, 0, 0, 1), vec4(1, 0.5, 0.25, 0), 0, 1);
+        matrices->add(&particles[i], mat4::translate2D(i, 0), mat4::translate2D(i, 0) * mat4::scale2D(3, 5), i % 2 ? 0 : 10, 1);
+    }
+
+    batches.tick(0.25);
+    const double s = SmoothedTimingFunction()(0.25);
+    for (int i=0; i<count; ++i) {
+        const Particle &p = particles[i];
+        check_fuzzyEqual(p.position, vec2(i + 2.5, 5));
+        check_fuzzyEqual(p.color, vec4(s, 0.5 * s, 0.25 * s, 1 - s));
+        if (i % 2) {
+            check_equal(p.matrix, mat4(1.5, 0, 0, i,
+                                       0, 2, 0, 0,
+                                       0, 0, 1, 0,
+                                       0, 0, 0, 1));
+            check_true(p.matrix.type <= mat4::ScaleAndRotate2D);
+        } else {
+            check_true(p.matrix.isIdentity());
+        }
+    }
+
+    batches.tick(2);
+    check_equal(positions->size(), 0u);
+    check_equal(particles[count-1].position, vec2(count + 9, 20));
+    check_equal(matrices->size(), unsigned(count / 2 + 1));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_transformAppliers()
+{
+    TransformNode *node = TransformNode::create();
+
+    // Full matrices are interpolated as rotations, not component by component
+    KeyFrames<TransformNode> keyFrames;
+    keyFrames.times() << 0 << 1;
+    keyFrames.addValues<mat4, TransformNode_setMatrix>()
+        << mat4::rotate2D(0) * mat4::scale2D(1, 1)
+        << mat4::rotate2D(M_PI * 0.75) * mat4::scale2D(3, 3);
+    Animation animation;
+    animation.setRunning(true);
+    animation.tick(0.5, node, &keyFrames);
+    mat4 expected = mat4::rotate2D(M_PI * 0.375) * mat4::scale2D(2, 2);
+    for (int i=0; i<16; ++i)
+        check_true(std::abs(node->matrix().m[i] - expected.m[i]) < 0.0001);
+    check_true(node->matrix().is2D());
+
+    // .. also in batches
+    AnimationBatches batches;
+    batches.batch<mat4, TransformNode, TransformNode_setMatrix>()->add(node, mat4::rotate2D(0), mat4::rotate2D(M_PI / 2), 0, 1);
+    batches.tick(0.5);
+    expected = mat4::rotate2D(M_PI / 4);
+    for (int i=0; i<16; ++i)
+        check_true(std::abs(node->matrix().m[i] - expected.m[i]) < 0.0001);
+
+    // Translation, rotation and scale animated separately
+    TransformTarget target(node);
+    auto *translations = batches.batch<vec2, TransformTarget, TransformTarget_translate>();
+    auto *rotations = batches.batch<double, TransformTarget, TransformTarget_rotate>();
+    auto *scales = batches.batch<vec2, TransformTarget, TransformTarget_scale>();
+    translations->add(&target, vec2(0, 0), vec2(100, 50), 1, 1);
+    rotations->add(&target, 0, M_PI, 1, 2);
+    scales->add(&target, vec2(1, 1), vec2(3, 2), 1, 1);
+    batches.tick(1.5);
+    expected = mat4::translate2D(50, 25) * mat4::rotate2D(M_PI / 4) * mat4::scale2D(2, 1.5);
+    for (int i=0; i<16; ++i)
+        check_true(std::abs(node->matrix().m[i] - expected.m[i]) < 0.0001);
+
+    // The simple appliers
+    TransformNode_translate2D()(vec2(1, 2), node);
+    check_equal(node->matrix(), mat4::translate2D(1, 2));
+    TransformNode_translate()(vec3(1, 2, 3), node);
+    check_equal(node->matrix(), mat4::translate(1, 2, 3));
+    TransformNode_scale2D()(vec2(2, 3), node);
+    check_equal(node->matrix(), mat4::scale2D(2, 3));
+    TransformNode_scale()(4, node);
+    check_equal(node->matrix(), mat4::scale2D(4, 4));
+    TransformNode_rotate2D()(0.5, node);
+    check_equal(node->matrix(), mat4::rotate2D(0.5));
+
+    node->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_animationManager_nextAnimation()
+{
+    Thing thing;
+    AnimationManager manager;
+    manager.start();
+    check_true(!manager.animationsRunning());
+    check_true(!manager.animationsScheduled());
+    check_equal(manager.timeToNextAnimation(), -1);
+
+    // An animation scheduled in the future means we can sleep until then
+    AnimationClosure<Thing> closure(&thing);
+    closure.keyFrames.times() << 0 << 1;
+    closure.keyFrames.addValues<double, Thing_setWidth>() << 0 << 100;
+    manager.scheduleAnimation(5, &closure);
+    manager.tick();
+    check_true(!manager.animationsRunning());
+    check_true(manager.animationsScheduled());
+    double next = manager.timeToNextAnimation();
+    check_true(next > 4.5 && next <= 5);
+
+    // Delayed batch animations count too, and the earliest one wins
+    auto *batch = manager.batches()->batch<double, Thing, Thing_setHeight>();
+    batch->add(&thing, 0, 1, manager.currentTime() + 2, 1);
+    check_true(!manager.animationsRunning());
+    next = manager.timeToNextAnimation();
+    check_true(next > 1.5 && next < 2.1);
+
+    // Once something runs, there is no time to wait
+    batch->add(&thing, 0, 1, manager.currentTime(), 1);
+    check_true(manager.animationsRunning());
+    check_equal(manager.timeToNextAnimation(), 0);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+struct OrderRecordingAnimation : public Animation
+{
+    OrderRecordingAnimation(int id, std::vector<int> *started) : id(id), started(started) { }
+    void tick(double time) override {
+        if (time == 0)
+            started->push_back(id);
+        setRunning(false);
+    }
+    int id;
+    std::vector<int> *started;
+};
+
+void tst_animationManager_scheduleOrder()
+{
+    AnimationManager manager;
+    manager.start();
+
+    std::vector<int> started;
+    std::vector<OrderRecordingAnimation *> animations;
+    for (int i=0; i<10; ++i)
+        animations.push_back(new OrderRecordingAnimation(i, &started));
+
+    // Scheduled out of order. 0 and 5 share a delay, but as each call
+    // reads the clock, 0 is due a little earlier rather than tied with 5.
+    int delays[] = { 20, 45, 35, 10, 25, 20, 15, 40, 30, 1000 };
+    for (int i=0; i<10; ++i)
+        manager.scheduleAnimation(delays[i] / 1000.0, animations[i]);
+    check_true(manager.animationsScheduled());
+    double next = manager.timeToNextAnimation();
+    check_true(next > 0 && next <= 0.010);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    manager.tick();
+
+    std::vector<int> expected = { 3, 6, 0, 5, 4, 8, 2, 7, 1 };
+    check_true(started == expected);
+    check_true(manager.animationsScheduled());
+    next = manager.timeToNextAnimation();
+    check_true(next > 0.5 && next <= 1);
+
+    // An animation which was cancelled below the top of the schedule is
+    // not waited for once it comes to the top
+    manager.scheduleAnimation(0.010, animations[0]);
+    manager.cancel(manager.scheduleAnimation(0.050, animations[1]));
+    check_true(manager.timeToNextAnimation() <= 0.010);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    manager.tick();
+    next = manager.timeToNextAnimation();
+    check_true(next > 0.5 && next <= 1);
+
+    for (OrderRecordingAnimation *a : animations)
+        delete a;
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_framePacer()
+{
+    auto at = [] (double seconds) {
+        return time_point() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+    };
+    auto seconds = [] (time_point t) {
+        return std::chrono::duration<double>(t.time_since_epoch()).count();
+    };
+
+    FramePacer pacer;
+    check_true(pacer.nextPresentation(at(1)) == at(1));
+
+    // 60Hz
+    double t = 0;
+    for (int i=0; i<100; ++i, t += 1 / 60.0)
+        pacer.framePresented(at(t));
+    t -= 1 / 60.0;
+    check_true(std::abs(pacer.frameInterval() - 1 / 60.0) < 1e-6);
+    check_true(pacer.jitter() < 1e-6);
+    check_equal(pacer.droppedFrames(), 0u);
+    check_true(std::abs(seconds(pacer.nextPresentation(at(t + 0.001))) - (t + 1 / 60.0)) < 1e-6);
+
+    // Rendering late predicts the next vsync after now, in phase
+    check_true(std::abs(seconds(pacer.nextPresentation(at(t + 0.02))) - (t + 2 / 60.0)) < 1e-6);
+
+    // A dropped frame is not a rate change
+    t += 2 / 60.0;
+    pacer.framePresented(at(t));
+    check_equal(pacer.droppedFrames(), 1u);
+    check_true(std::abs(pacer.frameInterval() - 1 / 60.0) < 1e-6);
+
+    // An idle gap is ignored
+    t += 5;
+    pacer.framePresented(at(t));
+    check_true(std::abs(pacer.frameInterval() - 1 / 60.0) < 1e-6);
+
+    // Variable refresh, the display goes to 144Hz
+    for (int i=0; i<100; ++i) {
+        t += 1 / 144.0;
+        pacer.framePresented(at(t));
+    }
+    check_true(std::abs(pacer.frameInterval() - 1 / 144.0) < 1e-5);
+
+    // ... and to 72Hz, exactly half, which is first taken as dropped frames
+    for (int i=0; i<10; ++i) {
+        t += 1 / 72.0;
+        pacer.framePresented(at(t));
+    }
+    check_true(std::abs(pacer.frameInterval() - 1 / 72.0) < 1e-5);
+
+    // Noisy intervals show up as jitter
+    pacer.resetStatistics();
+    for (int i=0; i<100; ++i) {
+        t += 1 / 72.0 + ((i % 2) ? 0.001 : -0.001);
+        pacer.framePresented(at(t));
+    }
+    check_true(pacer.jitter() > 0.0005);
+    check_true(pacer.maxJitter() >= 0.001);
+    check_equal(pacer.droppedFrames(), 0u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_compositorAnimations()
+{
+    Thing thing = { 0, 0 };
+    CompositorAnimations compositor;
+    check_equal(compositor.timeToNextAnimation(), -1);
+
+    // Nothing happens until the render side has ticked
+    auto width = compositor.start<double, Thing, Thing_setWidth>(&thing, 0, 100, 1, 2);
+    compositor.start<double, Thing, Thing_setHeight>(&thing, 10, 20, 5, 1);
+    check_equal(compositor.activeCount(), 2u);
+    check_equal(compositor.timeToNextAnimation(), 0);
+    check_equal(thing.width, 0);
+
+    compositor.tick(0);
+    check_equal(thing.width, 0);
+    check_equal(compositor.timeToNextAnimation(), 1);
+
+    compositor.tick(2);
+    check_fuzzyEqual(thing.width, 50);
+    check_equal(thing.height, 0);
+    check_equal(compositor.timeToNextAnimation(), 0);
+
+    // Cancelling leaves the last value
+    compositor.cancel(width);
+    compositor.tick(2.5);
+    check_fuzzyEqual(thing.width, 50);
+    check_equal(compositor.activeCount(), 1u);
+    check_equal(compositor.timeToNextAnimation(), 2.5);
+
+    // Finishing applies the final value
+    compositor.tick(7);
+    check_equal(thing.height, 20);
+    check_equal(compositor.activeCount(), 0u);
+    check_equal(compositor.timeToNextAnimation(), -1);
+
+    // Cancelling something which is gone is harmless
+    compositor.cancel(width);
+    compositor.tick(8);
+
+    // Cancelling finds the right one among many, wherever it is
+    Thing many[4] = { { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    CompositorAnimations::Handle handles[4];
+    for (int i=0; i<4; ++i)
+        handles[i] = compositor.start<double, Thing, Thing_setWidth>(&many[i], 0, 100, 10, 1);
+    compositor.tick(10.5);
+    compositor.cancel(handles[0]);
+    compositor.cancel(handles[2]);
+    compositor.tick(10.75);
+    check_fuzzyEqual(many[0].width, 50);
+    check_fuzzyEqual(many[1].width, 75);
+    check_fuzzyEqual(many[2].width, 50);
+    check_fuzzyEqual(many[3].width, 75);
+    check_equal(compositor.activeCount(), 2u);
+    compositor.cancel(handles[3]);
+    compositor.tick(11);
+    check_equal(many[1].width, 100);
+    check_fuzzyEqual(many[3].width, 75);
+    check_equal(compositor.activeCount(), 0u);
+
+    // Matrices go through the same appliers as the rest of the system
+    TransformNode *node = TransformNode::create();
+    compositor.start<mat4, TransformNode, TransformNode_setMatrix>(node, mat4::translate2D(0, 0), mat4::translate2D(10, 20), 0, 1);
+    compositor.tick(0.5);
+    check_equal(node->matrix(), mat4::translate2D(5, 10));
+    check_true(node->matrix().type <= mat4::Translation2D);
+
+    // and are interpolated decomposed, like keyframes
+    compositor.start<mat4, TransformNode, TransformNode_setMatrix>(node, mat4::rotate2D(0), mat4::rotate2D(M_PI * 0.75) * mat4::scale2D(3, 3), 1, 1);
+    compositor.tick(1.5);
+    const mat4 expected = mat4::rotate2D(M_PI * 0.375) * mat4::scale2D(2, 2);
+    for (int i=0; i<16; ++i)
+        check_true(std::abs(node->matrix().m[i] - expected.m[i]) < 0.0001);
+    node->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_compositorAnimations_threaded()
+{
+    // Application threads start and cancel animations while the render
+    // side keeps ticking.
+    const int threadCount = 4;
+    const int perThread = 1000;
+    std::vector<Thing> things(threadCount * perThread);
+    CompositorAnimations compositor;
+
+    std::atomic<int> finishedThreads(0);
+    std::vector<std::thread> threads;
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([&, t] () {
+            for (int i=0; i<perThread; ++i) {
+                Thing *thing = &things[t * perThread + i];
+                auto handle = compositor.start<double, Thing, Thing_setWidth>(thing, 0, 1, 0, 1);
+                if (i % 2)
+                    compositor.cancel(handle);
+            }
+            ++finishedThreads;
+        }));
+    }
+
+    while (finishedThreads < threadCount)
+        compositor.tick(0.5);
+    for (std::thread &t : threads)
+        t.join();
+
+    compositor.tick(0.5);
+    check_equal(compositor.activeCount(), unsigned(threadCount * perThread / 2));
+    compositor.tick(1);
+    check_equal(compositor.activeCount(), 0u);
+    for (int t=0; t<threadCount; ++t) {
+        for (int i=0; i<perThread; i += 2)
+            check_equal(things[t * perThread + i].width, 1);
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_sharedKeyFrames()
+{
+    KeyFrames<Thing> keyFrames;
+    keyFrames.times() << 0 << 0.5 << 1;
+    keyFrames.addValues<double, Thing_setWidth>() << 0 << 10 << 100;
+    keyFrames.addValues<double, Thing_setHeight>() << 1 << 2 << 3;
+
+    // Instances carry no keyframe storage of their own
+    check_true(sizeof(SharedAnimationClosure<Thing>) < sizeof(AnimationClosure<Thing>));
+
+    const int count = 2000;
+    std::vector<Thing> things(count);
+    std::vector<SharedAnimationClosure<Thing>> animations;
+    animations.reserve(count);
+    for (int i=0; i<count; ++i) {
+        animations.push_back(SharedAnimationClosure<Thing>(&things[i], &keyFrames, i * 0.01));
+        animations.back().setDuration(2);
+        animations.back().setRunning(true);
+    }
+
+    // Staggered by 10ms each and running for 2 seconds. The manager starts
+    // each one startDelay() later, so at t=10 the first 800 are done,
+    // number 900 is halfway and the ones after 1000 haven't started.
+    for (auto &a : animations) {
+        if (a.startDelay() <= 10)
+            a.tick(10 - a.startDelay());
+    }
+    check_equal(things[0].width, 100);
+    check_true(!animations[0].isRunning());
+    check_equal(things[800].width, 100);
+    check_true(!animations[800].isRunning());
+    check_true(animations[801].isRunning());
+    check_fuzzyEqual(things[900].width, 10);
+    check_fuzzyEqual(things[900].height, 2);
+    check_fuzzyEqual(animations[1500].startDelay(), 15);
+    check_equal(things[1500].width, 0);
+    check_equal(things[1500].height, 0);
+
+    // Each instance keeps its own playback state
+    SharedAnimationClosure<Thing, SmoothedTimingFunction> reversed(&things[0], &keyFrames);
+    reversed.setDirection(Animation::Reverse);
+    reversed.setRunning(true);
+    reversed.tick(0);
+    check_equal(things[0].width, 100);
+
+    // And they can be driven by the manager like any other animation. The
+    // offset is waited out as a scheduled start, so it doesn't keep frames
+    // coming, and the target is left alone until then.
+    AnimationManager manager;
+    manager.start();
+    Thing thing = { -1, -1 };
+    SharedAnimationClosure<Thing> delayed(&thing, &keyFrames, 0.06);
+    manager.startAnimation(&delayed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    manager.tick();
+    check_true(!manager.animationsRunning());
+    check_true(manager.animationsScheduled());
+    double next = manager.timeToNextAnimation();
+    check_true(next > 0.04 && next <= 0.06);
+    check_equal(thing.width, -1);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(70));
+    manager.tick();
+    check_true(manager.animationsRunning());
+    check_true(thing.width >= 0 && thing.width < 10);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+struct NodeTickCounter : public Animation
+{
+    NodeTickCounter(Node *node) : node(node), ticks(0), lastTime(-1) { setIterations(-1); }
+    void tick(double time) override { ++ticks; lastTime = time; }
+    const Node *targetNode() const override { return node; }
+    Node *node;
+    int ticks;
+    double lastTime;
+};
+
+void tst_animationManager_throttling()
+{
+    // Closures report their target when it is, or wraps, a node
+    Thing thing;
+    OpacityNode *opacityNode = OpacityNode::create();
+    TransformTarget transformTarget(TransformNode::create());
+    check_true(AnimationClosure<Thing>(&thing).targetNode() == 0);
+    check_true(AnimationClosure<OpacityNode>(opacityNode).targetNode() == opacityNode);
+    check_true(SharedAnimationClosure<TransformTarget>(&transformTarget).targetNode() == transformTarget.node);
+
+    Node *visibleNode = Node::create();
+    Node *hiddenNode = Node::create();
+    NodeTickCounter visible(visibleNode);
+    NodeTickCounter hidden(hiddenNode);
+    NodeTickCounter noNode(0);
+
+    AnimationManager manager;
+    manager.setThrottleInterval(0.05);
+    manager.start();
+
+    // Without frames from a renderer, nothing is throttled
+    manager.startAnimation(&visible);
+    manager.startAnimation(&hidden);
+    manager.startAnimation(&noNode);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    manager.tick();
+    check_equal(visible.ticks, 2);
+    check_equal(hidden.ticks, 2);
+    check_equal(noNode.ticks, 2);
+    check_true(!manager.animationsThrottled());
+
+    // Only what was drawn in the last frame keeps the full rate
+    visibleNode->setRenderedFrame(1);
+    manager.setRenderedFrame(1);
+    for (int i=0; i<5; ++i)
+        manager.tick();
+    check_equal(visible.ticks, 7);
+    check_equal(noNode.ticks, 7);
+    check_true(hidden.ticks < 7);
+    check_true(manager.animationsThrottled());
+    check_equal(manager.timeToNextAnimation(), 0);
+
+    // Throttled ticks are on the same timeline as the full rate ones
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    int hiddenTicks = hidden.ticks;
+    manager.tick();
+    check_equal(hidden.ticks, hiddenTicks + 1);
+    check_equal(hidden.lastTime, visible.lastTime);
+
+    // And the node is back at full rate once it is drawn again
+    visibleNode->setRenderedFrame(2);
+    hiddenNode->setRenderedFrame(2);
+    manager.setRenderedFrame(2);
+    manager.tick();
+    check_equal(hidden.ticks, hiddenTicks + 2);
+    check_equal(hidden.lastTime, visible.lastTime);
+    check_true(!manager.animationsThrottled());
+
+    // With only throttled animations left, the next frame can wait
+    Node *offscreenNode = Node::create();
+    NodeTickCounter offscreen(offscreenNode);
+    AnimationManager idle;
+    idle.setThrottleInterval(0.05);
+    idle.start();
+    idle.setRenderedFrame(1);
+    idle.startAnimation(&offscreen);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    idle.tick();
+    idle.tick();
+    check_equal(offscreen.ticks, 1);
+    double next = idle.timeToNextAnimation();
+    check_true(next > 0 && next <= 0.05);
+
+    // An infinite interval suspends them
+    idle.setThrottleInterval(std::numeric_limits<double>::infinity());
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    idle.tick();
+    check_equal(offscreen.ticks, 1);
+    check_equal(idle.timeToNextAnimation(), -1);
+
+    opacityNode->destroy();
+    transformTarget.node->destroy();
+    visibleNode->destroy();
+    hiddenNode->destroy();
+    offscreenNode->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_animationManager_handles()
+{
+    Thing thing = { -1, -1 };
+    AnimationClosure<Thing> closure(&thing);
+    closure.keyFrames.times() << 0 << 1;
+    closure.keyFrames.addValues<double, Thing_setWidth>() << 0 << 100;
+
+    AnimationManager manager;
+    manager.start();
+    check_equal(manager.state(0), AnimationManager::Stopped);
+    check_true(!manager.cancel(0));
+
+    // Paused animations hold their value, and seeking them applies the new
+    // one right away
+    AnimationManager::Handle handle = manager.startAnimation(&closure);
+    check_true(handle != 0);
+    check_equal(manager.state(handle), AnimationManager::Scheduled);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    check_equal(manager.state(handle), AnimationManager::Running);
+    check_true(thing.width >= 0 && thing.width < 50);
+    check_true(manager.pause(handle));
+    check_equal(manager.state(handle), AnimationManager::Paused);
+    check_true(!manager.animationsRunning());
+    check_true(manager.seek(handle, 0.5));
+    check_equal(thing.width, 50);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    manager.tick();
+    check_equal(thing.width, 50);
+
+    // Resuming continues from where it was, on the manager's clock
+    check_true(manager.resume(handle));
+    check_equal(manager.state(handle), AnimationManager::Running);
+    manager.tick();
+    check_true(thing.width >= 50 && thing.width < 60);
+    check_true(manager.seek(handle, 0.25));
+    manager.tick();
+    check_true(thing.width >= 25 && thing.width < 35);
+
+    // Cancelling stops it where it is and invalidates the handle, even when
+    // the animation and its slot are reused
+    check_true(manager.cancel(handle));
+    check_true(!closure.isRunning());
+    check_equal(manager.state(handle), AnimationManager::Stopped);
+    check_true(!manager.cancel(handle));
+    check_true(!manager.pause(handle));
+    check_true(!manager.resume(handle));
+    check_true(!manager.seek(handle, 0));
+    double width = thing.width;
+    manager.tick();
+    check_equal(thing.width, width);
+    AnimationManager::Handle restarted = manager.startAnimation(&closure);
+    check_true(restarted != handle);
+    check_equal(manager.state(handle), AnimationManager::Stopped);
+    check_equal(manager.state(restarted), AnimationManager::Scheduled);
+
+    // Finished animations are stopped too
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    check_true(manager.seek(restarted, 2));
+    manager.tick();
+    check_equal(thing.width, 100);
+    check_equal(manager.state(restarted), AnimationManager::Stopped);
+    check_true(!manager.animationsRunning());
+
+    // Also when a paused animation is seeked past its end
+    handle = manager.startAnimation(&closure);
+    manager.pause(handle);
+    thing.width = -1;
+    check_true(manager.seek(handle, 1));
+    check_equal(thing.width, 100);
+    check_equal(manager.state(handle), AnimationManager::Stopped);
+    check_true(!closure.isRunning());
+
+    // Scheduled animations can be cancelled, paused and seeked before they
+    // start
+    handle = manager.scheduleAnimation(5, &closure);
+    check_true(manager.animationsScheduled());
+    check_true(manager.cancel(handle));
+    check_true(!manager.animationsScheduled());
+    check_equal(manager.timeToNextAnimation(), -1);
+
+    handle = manager.scheduleAnimation(5, &closure);
+    check_true(manager.pause(handle));
+    check_true(!manager.animationsScheduled());
+    check_true(manager.resume(handle));
+    manager.tick();
+    check_true(thing.width >= 0 && thing.width < 10);
+    manager.cancel(handle);
+
+    handle = manager.scheduleAnimation(5, &closure);
+    check_true(manager.seek(handle, 0.75));
+    check_equal(manager.state(handle), AnimationManager::Running);
+    manager.tick();
+    check_true(thing.width >= 75 && thing.width < 85);
+
+    // stop() cancels everything
+    Thing other = { 0, 0 };
+    AnimationClosure<Thing> paused(&other);
+    paused.keyFrames.times() << 0 << 1;
+    paused.keyFrames.addValues<double, Thing_setHeight>() << 0 << 1;
+    AnimationManager::Handle pausedHandle = manager.scheduleAnimation(1, &paused);
+    manager.pause(pausedHandle);
+    manager.stop();
+    check_equal(manager.state(handle), AnimationManager::Stopped);
+    check_equal(manager.state(pausedHandle), AnimationManager::Stopped);
+    check_true(!closure.isRunning());
+    check_true(!paused.isRunning());
+    check_true(!manager.animationsRunning());
+    check_true(!manager.animationsScheduled());
+
+    // Many animations restarted over and over, as on hover changes
+    const int count = 100;
+    std::vector<Thing> things(count);
+    std::vector<SharedAnimationClosure<Thing>> animations;
+    std::vector<AnimationManager::Handle> handles(count, 0);
+    for (int i=0; i<count; ++i)
+        animations.push_back(SharedAnimationClosure<Thing>(&things[i], &closure.keyFrames));
+    for (int round=0; round<10; ++round) {
+        for (int i=0; i<count; ++i) {
+            manager.cancel(handles[i]);
+            handles[i] = manager.startAnimation(&animations[i]);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        manager.tick();
+    }
+    for (int i=0; i<count; ++i)
+        check_equal(manager.state(handles[i]), AnimationManager::Running);
+    manager.stop();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// Cancels or pauses itself, or cancels another animation, on its second tick
+struct SelfControl : public Animation
+{
+    enum Action { None, CancelSelf, PauseSelf, CancelOther };
+    SelfControl(AnimationManager *manager, Action action = None)
+        : manager(manager), action(action), handle(0), other(0), ticks(0) { setIterations(-1); }
+    void tick(double) override {
+        if (++ticks != 2)
+            return;
+        bool ok = true;
+        if (action == CancelSelf)
+            ok = manager->cancel(handle);
+        else if (action == PauseSelf)
+            ok = manager->pause(handle);
+        else if (action == CancelOther)
+            ok = manager->cancel(other);
+        check_true(ok);
+    }
+    AnimationManager *manager;
+    Action action;
+    AnimationManager::Handle handle;
+    AnimationManager::Handle other;
+    int ticks;
+};
+
+void tst_animationManager_selfControl()
+{
+    // The middle of three cancels itself; the one after it still ticks
+    AnimationManager manager;
+    manager.start();
+    SelfControl first(&manager);
+    SelfControl middle(&manager, SelfControl::CancelSelf);
+    SelfControl last(&manager);
+    first.handle = manager.startAnimation(&first);
+    middle.handle = manager.startAnimation(&middle);
+    last.handle = manager.startAnimation(&last);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    manager.tick();
+    check_equal(first.ticks, 2);
+    check_equal(middle.ticks, 2);
+    check_equal(last.ticks, 2);
+    check_equal(manager.state(middle.handle), AnimationManager::Stopped);
+    check_true(!middle.isRunning());
+    manager.tick();
+    check_equal(first.ticks, 3);
+    check_equal(middle.ticks, 2);
+    check_equal(last.ticks, 3);
+
+    // Its slot is free for the next one
+    SelfControl reused(&manager);
+    reused.handle = manager.startAnimation(&reused);
+    check_true(reused.handle != middle.handle);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    check_equal(reused.ticks, 1);
+    check_equal(last.ticks, 4);
+    manager.stop();
+
+    // Pausing itself holds it without ending the tick for the others
+    SelfControl pausing(&manager, SelfControl::PauseSelf);
+    SelfControl after(&manager);
+    pausing.handle = manager.startAnimation(&pausing);
+    after.handle = manager.startAnimation(&after);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    manager.tick();
+    check_equal(pausing.ticks, 2);
+    check_equal(after.ticks, 2);
+    check_equal(manager.state(pausing.handle), AnimationManager::Paused);
+    manager.tick();
+    check_equal(pausing.ticks, 2);
+    check_equal(after.ticks, 3);
+    check_true(manager.resume(pausing.handle));
+    manager.tick();
+    check_equal(pausing.ticks, 3);
+    check_equal(after.ticks, 4);
+    manager.stop();
+
+    // Cancelling the next animation in line skips it
+    SelfControl canceller(&manager, SelfControl::CancelOther);
+    SelfControl victim(&manager);
+    SelfControl bystander(&manager);
+    canceller.handle = manager.startAnimation(&canceller);
+    victim.handle = canceller.other = manager.startAnimation(&victim);
+    bystander.handle = manager.startAnimation(&bystander);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    manager.tick();
+    manager.tick();
+    check_equal(victim.ticks, 1);
+    check_equal(bystander.ticks, 2);
+    check_equal(manager.state(victim.handle), AnimationManager::Stopped);
+    manager.stop();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
 int main(int argc, char **argv)
 {
 
     tst_keyframes_basic();
+    tst_keyframes_longTrack();
+    tst_timingFunctions();
+    tst_animationBatch();
+    tst_animationBatch_vectors();
+    tst_transformAppliers();
+    tst_animationManager_nextAnimation();
+    tst_animationManager_scheduleOrder();
+    tst_framePacer();
+    tst_compositorAnimations();
+    tst_compositorAnimations_threaded();
+    tst_sharedKeyFrames();
+    tst_animationManager_throttling();
+    tst_animationManager_handles();
+    tst_animationManager_selfControl();
 
 }
\ No newline at end of file
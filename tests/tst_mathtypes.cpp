@@ -24,6 +24,7 @@
 */
 
 #include <iostream>
+#include <vector>
 
 #include "rengine.h"
 #include "test.h"
@@ -186,6 +187,63 @@ void tst_mat4_vecx()
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
+void tst_affine2d()
+{
+    { // identity and conversion
+        affine2d a;
+        check_true(a.isIdentity());
+        check_true(a.toMat4().isIdentity());
+        check_true(affine2d(mat4()).isIdentity());
+    }
+
+    { // round trip through mat4
+        mat4 m = mat4::translate2D(4, 5) * mat4::scale2D(2, 3) * mat4::rotate2D(0.3);
+        check_true(m.is2D());
+        affine2d a(m);
+        check_equal(a.toMat4(), m);
+        check_true(a.toMat4().is2D());
+        check_true(!mat4::rotateAroundX(0.3).is2D());
+        check_true(!mat4::translate(1, 2, 3).is2D());
+        check_true(mat4::translate(1, 2, 0).is2D());
+    }
+
+    { // multiplication matches mat4
+        mat4 m1 = mat4::scale2D(2, 3) * mat4::rotate2D(M_PI/2.0);
+        mat4 m2 = mat4::translate2D(4, 5) * mat4::rotate2D(0.7);
+        affine2d a = affine2d(m1) * affine2d(m2);
+        mat4 m = m1 * m2;
+        for (int i=0; i<6; ++i)
+            check_fuzzyEqual(a.m[i], affine2d(m).m[i]);
+        check_fuzzyEqual(a * vec2(10, 20), m * vec2(10, 20));
+    }
+
+    { // mapping points
+        affine2d a = affine2d::translate(10, 20) * affine2d::scale(2, 3);
+        check_true(a.isAxisAligned());
+        check_equal(a * vec2(1, 2), vec2(12, 26));
+        vec2 pts[] = { vec2(0, 0), vec2(1, 1), vec2(-1, 2) };
+        a.map(pts, pts, 3);
+        check_equal(pts[0], vec2(10, 20));
+        check_equal(pts[1], vec2(12, 23));
+        check_equal(pts[2], vec2(8, 26));
+    }
+
+    { // bounds
+        affine2d a = affine2d::translate(10, 20) * affine2d::scale(-2, 3);
+        rect2d r = a.mapBounds(rect2d(1, 2, 4, 8));
+        check_equal(r.tl, vec2(2, 26));
+        check_equal(r.br, vec2(8, 44));
+
+        affine2d rot = affine2d::rotate(M_PI / 2.0);
+        check_true(!rot.isAxisAligned());
+        r = rot.mapBounds(rect2d(1, 2, 4, 8));
+        check_fuzzyEqual(r.tl, vec2(-8, 1));
+        check_fuzzyEqual(r.br, vec2(-2, 4));
+    }
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
 void tst_rect2d()
 {
     rect2d r(1, 2, 4, 8);
@@ -239,14 +297,218 @@ void tst_rect2d_intersect()
     cout << __PRETTY_FUNCTION__ << ": ok" << endl;
 }
 
+static void checkMatrixFuzzy(const mat4 &a, const mat4 &b)
+{
+    for (int i=0; i<16; ++i)
+        check_fuzzyEqual(a.m[i], b.m[i]);
+}
+
+void tst_colorMatrix()
+{
+    { // mat4::scale leaves w alone
+        mat4 m = mat4::scale(2, 3, 4);
+        check_equal(m * vec4(1, 1, 1, 1), vec4(2, 3, 4, 1));
+        check_equal(ColorMatrix::brightness(0.5) * vec4(1, 1, 1, 1), vec4(0.5, 0.5, 0.5, 1));
+    }
+
+    { // hue rotates around the gray axis and keeps luminance
+        checkMatrixFuzzy(ColorMatrix::hue(0), mat4());
+        checkMatrixFuzzy(ColorMatrix::hue(2 * M_PI), mat4());
+        checkMatrixFuzzy(ColorMatrix::hue(0.4) * ColorMatrix::hue(1.1), ColorMatrix::hue(1.5));
+        check_fuzzyEqual(ColorMatrix::hue(1.3) * vec4(0.4, 0.4, 0.4, 1), vec4(0.4, 0.4, 0.4, 1));
+        const vec3 lum(RENGINE_LUMINANCE_RED, RENGINE_LUMINANCE_GREEN, RENGINE_LUMINANCE_BLUE);
+        for (float a=-7; a<7; a+=0.25) {
+            vec4 c = ColorMatrix::hue(a) * vec4(0.9, 0.5, 0.1, 1);
+            check_fuzzyEqual(c.x * lum.x + c.y * lum.y + c.z * lum.z, 0.9 * lum.x + 0.5 * lum.y + 0.1 * lum.z);
+            check_equal(c.w, 1);
+        }
+    }
+
+    { // compose matches a full product for matrices which leave alpha alone
+        mat4 a = ColorMatrix::contrast(1.5);
+        mat4 b = ColorMatrix::hue(0.7);
+        checkMatrixFuzzy(ColorMatrix::compose(a, b), a * b);
+        checkMatrixFuzzy(ColorMatrix::compose(b, a), b * a);
+    }
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+void tst_colorFilter()
+{
+    ColorFilter filter;
+    check_true(filter.matrix().isIdentity());
+
+    // hue-rotate(0.5) saturate(2) contrast(0.8): applied left to right
+    unsigned hue = filter.add(ColorFilter::HueRotate, 0.5);
+    unsigned saturate = filter.add(ColorFilter::Saturate, 2);
+    unsigned contrast = filter.add(ColorFilter::Contrast, 0.8);
+    check_equal(filter.size(), 3u);
+    check_equal(hue, 0u);
+    check_equal(contrast, 2u);
+
+    auto expected = [] (float h, float s, float c) {
+        return ColorMatrix::contrast(c) * ColorMatrix::saturation(s) * ColorMatrix::hue(h);
+    };
+    checkMatrixFuzzy(filter.matrix(), expected(0.5, 2, 0.8));
+
+    filter.setAmount(contrast, 1.2);
+    checkMatrixFuzzy(filter.matrix(), expected(0.5, 2, 1.2));
+    filter.setAmount(hue, 2);
+    checkMatrixFuzzy(filter.matrix(), expected(2, 2, 1.2));
+    filter.setAmount(saturate, 0.3);
+    filter.setAmount(contrast, 1);
+    checkMatrixFuzzy(filter.matrix(), expected(2, 0.3, 1));
+    check_equal(filter.amount(saturate), 0.3f);
+    check_true(filter.function(hue) == ColorFilter::HueRotate);
+
+    // The remaining functions
+    ColorFilter other;
+    other.add(ColorFilter::Grayscale, 1);
+    other.add(ColorFilter::Sepia, 0.5);
+    other.add(ColorFilter::Invert, 0.25);
+    other.add(ColorFilter::Brightness, 0.9);
+    checkMatrixFuzzy(other.matrix(), ColorMatrix::brightness(0.9)
+                                     * ColorMatrix::invert(0.25)
+                                     * ColorMatrix::sepia(0.5)
+                                     * ColorMatrix::grayscale());
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+static bool matrixFuzzyEquals(const mat4 &a, const mat4 &b)
+{
+    for (int i=0; i<16; ++i) {
+        if (!fuzzy_equals(a.m[i], b.m[i], 0.001))
+            return false;
+    }
+    return true;
+}
+
+void tst_decomposedTransform()
+{
+    mat4 skew(1, 0.5, 0, 0,
+              0.2, 1, 0, 0,
+              0, 0, 1, 0,
+              0, 0, 0, 1);
+    mat4 perspective(1, 0, 0, 0,
+                     0, 1, 0, 0,
+                     0, 0, 1, 0,
+                     0, 0, -0.002, 1);
+
+    { // round trips
+        mat4 matrices[] = {
+            mat4(),
+            mat4::translate2D(10, 20),
+            mat4::translate2D(10, 20) * mat4::rotate2D(0.7) * mat4::scale2D(2, 3),
+            mat4::rotate2D(2.5) * mat4::scale2D(-1, 2),
+            mat4::rotate2D(0.3) * skew * mat4::scale2D(2, 0.5),
+            mat4::translate(1, 2, 3) * mat4::rotateAroundX(0.4) * mat4::rotateAroundY(1.2) * mat4::scale(1, 2, 3),
+            mat4::scale(-1, -2, 3),
+            perspective * mat4::translate2D(5, 6) * mat4::rotateAroundY(0.5),
+        };
+        for (const mat4 &m : matrices) {
+            DecomposedTransform d(m);
+            check_true(d.isValid());
+            check_true(matrixFuzzyEquals(d.recompose(), m));
+            check_true(matrixFuzzyEquals(DecomposedTransform::interpolate(d, DecomposedTransform(mat4()), 0), m));
+            check_true(matrixFuzzyEquals(DecomposedTransform::interpolate(DecomposedTransform(mat4()), d, 1), m));
+        }
+    }
+
+    auto mix = [] (const mat4 &a, const mat4 &b, double t) {
+        return DecomposedTransform::interpolate(DecomposedTransform(a), DecomposedTransform(b), t);
+    };
+
+    { // rotations are interpolated as rotations, and stay 2D
+        mat4 m = mix(mat4::rotate2D(0), mat4::rotate2D(M_PI / 2), 0.5);
+        check_true(matrixFuzzyEquals(m, mat4::rotate2D(M_PI / 4)));
+        check_true(m.is2D());
+
+        m = mix(mat4::translate2D(10, 0) * mat4::scale2D(1, 1),
+                mat4::translate2D(20, 10) * mat4::rotate2D(M_PI / 2) * mat4::scale2D(3, 3), 0.5);
+        check_true(matrixFuzzyEquals(m, mat4::translate2D(15, 5) * mat4::rotate2D(M_PI / 4) * mat4::scale2D(2, 2)));
+        check_true(m.is2D());
+
+        // The shorter way around
+        m = mix(mat4::rotate2D(170 * M_PI / 180), mat4::rotate2D(-170 * M_PI / 180), 0.5);
+        check_true(matrixFuzzyEquals(m, mat4::rotate2D(M_PI)));
+
+        // A flipped axis doesn't leave the plane
+        m = mix(mat4::rotate2D(0.3), mat4::rotate2D(0.3) * mat4::scale2D(-1, 1), 0.25);
+        check_true(matrixFuzzyEquals(m, mat4::rotate2D(0.3) * mat4::scale2D(0.5, 1)));
+        check_true(m.is2D());
+
+        // 3D rotations too
+        m = mix(mat4::rotateAroundX(0), mat4::rotateAroundX(1), 0.5);
+        check_true(matrixFuzzyEquals(m, mat4::rotateAroundX(0.5)));
+        check_true(!m.is2D());
+    }
+
+    { // translation and scale alone are interpolated directly
+        mat4 m = mix(mat4::translate2D(0, 10), mat4::scale2D(3, 5), 0.5);
+        check_equal(m, mat4(2, 0, 0, 0,
+                            0, 3, 0, 5,
+                            0, 0, 1, 0,
+                            0, 0, 0, 1));
+        check_true(m.type <= (mat4::Translation2D | mat4::Scale2D));
+    }
+
+    { // singular matrices switch halfway
+        mat4 a = mat4::rotate2D(1) * mat4::scale2D(0, 1);
+        mat4 b = mat4::rotate2D(2);
+        check_true(!DecomposedTransform(a).isValid());
+        check_equal(mix(a, b, 0.49), a);
+        check_equal(mix(a, b, 0.51), b);
+    }
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
+
+void tst_simd_blend()
+{
+    const unsigned count = 37;
+    for (unsigned components : { 1, 2, 3, 4, 8, 16 }) {
+        for (unsigned stride : { components, components + 1 }) {
+            std::vector<float> from(count * stride), delta(count * stride), t(count);
+            std::vector<float> out(count * stride, -1);
+            for (unsigned i=0; i<count * stride; ++i) {
+                from[i] = i * 0.5f;
+                delta[i] = 100 - i;
+            }
+            for (unsigned i=0; i<count; ++i)
+                t[i] = i / float(count);
+
+            simd::blend(out.data(), from.data(), delta.data(), t.data(), count, components, stride);
+
+            for (unsigned i=0; i<count; ++i) {
+                for (unsigned c=0; c<stride; ++c) {
+                    unsigned o = i * stride + c;
+                    if (c < components) {
+                        check_fuzzyEqual(out[o], from[o] + delta[o] * t[i]);
+                    } else {
+                        check_equal(out[o], -1);        // padding is left alone
+                    }
+                }
+            }
+        }
+    }
+
+    cout << __PRETTY_FUNCTION__ << ": ok" << endl;
+}
 
 int main(int, char **)
 {
     tst_vec2();
     tst_mat4();
     tst_mat4_vecx();
+    tst_affine2d();
     tst_rect2d();
     tst_rect2d_intersect();
+    tst_simd_blend();
+    tst_colorMatrix();
+    tst_colorFilter();
+    tst_decomposedTransform();
 
     return 0;
 }
\ No newline at end of file
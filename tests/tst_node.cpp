@@ -26,6 +26,9 @@
 
 #include "test.h"
 
+#include <thread>
+#include <sstream>
+
 
 template <typename T> bool tst_node_cast_helper()
 {
@@ -132,6 +135,69 @@ void tst_node_addRemoveParent()
 
 
 
+static bool checkChildren(Node *parent, const std::vector<Node *> &expected)
+{
+    if (parent->childCount() != (int) expected.size())
+        return false;
+    Node *prev = 0;
+    unsigned i = 0;
+    for (Node *c = parent->child(); c; c = c->sibling(), ++i) {
+        if (i >= expected.size() || c != expected[i] || c->previousSibling() != prev || c->parent() != parent)
+            return false;
+        prev = c;
+    }
+    return i == expected.size() && parent->lastChild() == prev;
+}
+
+void tst_node_insertBeforeAfter()
+{
+    Node *root = Node::create();
+    Node *a = Node::create();
+    Node *b = Node::create();
+    Node *c = Node::create();
+    Node *d = Node::create();
+
+    root->insertBefore(b, 0);               // b
+    check_true(checkChildren(root, { b }));
+    root->insertBefore(a, b);               // a b
+    check_true(checkChildren(root, { a, b }));
+    root->insertAfter(d, b);                // a b d
+    check_true(checkChildren(root, { a, b, d }));
+    root->insertAfter(c, b);                // a b c d
+    check_true(checkChildren(root, { a, b, c, d }));
+    check_true(root->hasChild(c));
+    check_true(!a->hasChild(c));
+
+    // Moving nodes around, as when changing z-order
+    root->remove(d);
+    root->insertAfter(d, 0);                // d a b c
+    check_true(checkChildren(root, { d, a, b, c }));
+    root->remove(b);
+    root->insertBefore(b, d);               // b d a c
+    check_true(checkChildren(root, { b, d, a, c }));
+    root->remove(c);
+    root->insertBefore(c, a);               // b d c a
+    check_true(checkChildren(root, { b, d, c, a }));
+    root->remove(a);
+    root->prepend(a);                       // a b d c
+    check_true(checkChildren(root, { a, b, d, c }));
+    root->remove(c);
+    root->remove(a);
+    check_true(checkChildren(root, { b, d }));
+    check_true(a->parent() == 0 && a->sibling() == 0 && a->previousSibling() == 0);
+
+    a->destroy();
+
+    // Destroying a child in the middle keeps the list intact
+    root->append(c);                        // b d c
+    d->destroy();
+    check_true(checkChildren(root, { b, c }));
+
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
 void tst_node_allocator()
 {
     RENGINE_ALLOCATION_POOL(Node, 16);
@@ -153,6 +219,340 @@ void tst_node_allocator()
     n->destroy();
     check_true(written);
 
+    // The pool grows beyond its initial size and gives back memory
+    // once it is no longer used.
+    auto &pool = RectangleNode::__allocation_pool_RectangleNode;
+    unsigned initialChunks = pool.chunkCount();
+    std::vector<RectangleNode *> rects;
+    for (unsigned i=0; i<pool.slotsPerChunk() * 4; ++i) {
+        RectangleNode *r = RectangleNode::create();
+        check_true(r->__is_pool_allocated());
+        rects.push_back(r);
+    }
+    check_true(pool.chunkCount() >= initialChunks + 4);
+    for (auto r : rects)
+        r->destroy();
+#ifndef RENGINE_CONCURRENT_NODE_ALLOCATION
+    check_true(pool.chunkCount() <= initialChunks + 1);
+    pool.compact();
+    check_true(pool.chunkCount() <= initialChunks);
+#endif
+
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_node_allocatorStatistics()
+{
+    auto &pool = OpacityNode::__allocation_pool_OpacityNode;
+    pool.flushThreadStatistics();
+    AllocationPoolBase::endFrame();
+    AllocationPoolStatistics before = pool.statistics();
+
+    std::vector<OpacityNode *> nodes;
+    for (int i=0; i<10; ++i)
+        nodes.push_back(OpacityNode::create());
+    nodes.back()->destroy();
+    nodes.pop_back();
+    pool.flushThreadStatistics();
+
+    AllocationPoolStatistics s = pool.statistics();
+    check_equal(std::string(s.name), std::string("OpacityNode"));
+    check_equal(s.live, before.live + 9);
+    check_true(s.highWaterMark >= s.live);
+    check_true(s.capacity >= s.live);
+    check_equal(s.allocations, before.allocations + 10);
+    check_equal(s.frees, before.frees + 1);
+    check_equal(s.heapFallbacks, 0u);
+
+    AllocationPoolBase::endFrame();
+    s = pool.statistics();
+    check_equal(s.frameAllocations, 10u);
+    check_equal(s.frameFrees, 1u);
+
+    for (auto n : nodes)
+        n->destroy();
+    pool.flushThreadStatistics();
+    AllocationPoolBase::endFrame();
+    s = pool.statistics();
+    check_equal(s.live, before.live);
+    check_equal(s.frameAllocations, 0u);
+    check_equal(s.frameFrees, 9u);
+
+    // The pool is registered and shows up in the dump
+    bool found = false;
+    for (AllocationPoolBase *p = AllocationPoolBase::firstPool(); p; p = p->nextPool())
+        found |= p == &pool;
+    check_true(found);
+    std::ostringstream out;
+    AllocationPoolBase::dumpStatistics(out);
+    check_true(out.str().find("OpacityNode: capacity=") != std::string::npos);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_node_recycler()
+{
+    NodeRecycler recycler;
+
+    // Nodes created by the recycler are fresh when it is empty
+    Node *root = recycler.create<Node>();
+    TransformNode *tn = recycler.create<TransformNode>();
+    tn->setMatrix(mat4::translate2D(1, 2));
+    tn->setProjectionDepth(100);
+    OpacityNode *on = OpacityNode::create(0.5);
+    bool written = false;
+    class OtherNode : public Node {
+    public:
+        bool *m_write;
+        OtherNode(bool *write) : m_write(write) { }
+        ~OtherNode() { *m_write = true; }
+    };
+    *root << tn << on;
+    *tn << RectangleNode::create(rect2d(1, 2, 3, 4), vec4(1, 0, 0, 1))
+        << RectangleNode::create(rect2d(5, 6, 7, 8), vec4(0, 1, 0, 1));
+    *on << new OtherNode(&written);
+
+    // Recycling a subtree detaches it and keeps all pool allocated nodes
+    Node *parent = Node::create();
+    *parent << root;
+    recycler.recycle(root);
+    check_equal(parent->childCount(), 0);
+    check_true(written);
+    check_equal(recycler.size(), 5u);
+    parent->destroy();
+
+    // Recycled nodes come back reset and sorted by type
+    std::vector<Node *> reused;
+    for (int i=0; i<2; ++i) {
+        RectangleNode *r = recycler.create<RectangleNode>();
+        check_true(r->__is_pool_allocated());
+        check_true(r->parent() == 0);
+        check_equal(r->geometry().br, vec2());
+        check_equal(r->color(), vec4());
+        reused.push_back(r);
+    }
+    check_equal(recycler.size(), 3u);
+    TransformNode *tn2 = recycler.create<TransformNode>();
+    check_true(tn2 == tn);
+    check_true(tn2->matrix().isIdentity());
+    check_equal(tn2->projectionDepth(), 0.0f);
+    check_true(tn2->child() == 0);
+    OpacityNode *on2 = recycler.create<OpacityNode>();
+    check_true(on2 == on);
+    check_equal(on2->opacity(), 1.0f);
+    check_equal(recycler.size(), 1u);
+
+    // Once a type runs dry, new nodes are created
+    OpacityNode *on3 = recycler.create<OpacityNode>();
+    check_true(on3 != on2);
+
+    for (auto n : reused)
+        n->destroy();
+    tn2->destroy();
+    on2->destroy();
+    on3->destroy();
+    recycler.clear();
+    check_equal(recycler.size(), 0u);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_node_arena()
+{
+    AllocationArena arena(4096);
+    AllocationPoolStatistics before = Node::__allocation_pool_Node.statistics();
+
+    Node *root = Node::create();
+    Node *first = 0;
+    {
+        AllocationArena::Scope scope(&arena);
+        check_true(AllocationArena::current() == &arena);
+        first = Node::create();
+        check_true(first->__is_arena_allocated());
+        check_true(!first->__is_pool_allocated());
+        for (int i=0; i<100; ++i)
+            *first << RectangleNode::create(rect2d(0, 0, i, i), vec4(1));
+        *first << &(*TransformNode::create(mat4::translate2D(1, 2)) << OpacityNode::create(0.5));
+    }
+    check_true(AllocationArena::current() == 0);
+    check_equal(first->childCount(), 101);
+    check_true(arena.capacity() > 4096);
+    check_true(arena.bytesUsed() > 100 * sizeof(RectangleNode));
+
+    // Arena nodes mix with pool allocated ones, and destroy() only runs
+    // the destructors.
+    *root << first;
+    root->destroy();
+    check_equal(Node::__allocation_pool_Node.statistics().live, before.live);
+
+    // After a reset the same memory is handed out again
+    size_t capacity = arena.capacity();
+    arena.reset();
+    check_equal(arena.bytesUsed(), 0u);
+    {
+        AllocationArena::Scope scope(&arena);
+        Node *again = Node::create();
+        check_true(again == first);
+        for (int i=0; i<100; ++i)
+            *again << RectangleNode::create();
+        check_equal(arena.capacity(), capacity);
+
+        // Nested scopes and oversized allocations
+        AllocationArena other(64);
+        {
+            AllocationArena::Scope inner(&other);
+            Node *n = Node::create();
+            check_true(n->__is_arena_allocated());
+            check_true(other.capacity() >= sizeof(Node));
+        }
+        check_true(AllocationArena::current() == &arena);
+    }
+    arena.reset();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_node_worldTransform()
+{
+    TransformNode *root = TransformNode::create(mat4::translate2D(10, 20));
+    Node *plain = Node::create();
+    TransformNode *t1 = TransformNode::create(mat4::scale2D(2, 3));
+    TransformNode *t2 = TransformNode::create(mat4::translate2D(1, 1));
+    TransformNode *t3d = TransformNode::create(mat4::rotateAroundY(0.5), 1000);
+    TransformNode *t3dChild = TransformNode::create(mat4::translate2D(5, 0));
+
+    *root << plain;
+    *plain << t1;
+    *t1 << t2 << t3d;
+    *t3d << t3dChild;
+
+    check_true(t2->isWorldTransformDirty());
+    check_equal(t2->worldMatrix(), affine2d(mat4::translate2D(10, 20) * mat4::scale2D(2, 3) * mat4::translate2D(1, 1)));
+    check_true(!t2->isWorldTransformDirty());
+    check_true(!t1->isWorldTransformDirty());
+    check_true(!root->isWorldTransformDirty());
+    check_equal(t2->worldProjectionDepth(), 0.0f);
+
+    // 3D subtree, the 2D part stays with the parent
+    check_equal(t3d->worldMatrix(), t1->worldMatrix());
+    check_equal(t3d->worldMatrix3D(), mat4::rotateAroundY(0.5));
+    check_equal(t3d->worldProjectionDepth(), 1000.0f);
+    check_equal(t3dChild->worldMatrix(), t1->worldMatrix());
+    check_equal(t3dChild->worldMatrix3D(), mat4::rotateAroundY(0.5) * mat4::translate2D(5, 0));
+    check_equal(t3dChild->worldProjectionDepth(), 1000.0f);
+
+    // Changing an ancestor invalidates everything below it
+    root->setMatrix(mat4::translate2D(100, 200));
+    check_true(root->isWorldTransformDirty());
+    check_true(t1->isWorldTransformDirty());
+    check_true(t2->isWorldTransformDirty());
+    check_true(t3dChild->isWorldTransformDirty());
+    check_equal(t2->worldMatrix(), affine2d(mat4::translate2D(100, 200) * mat4::scale2D(2, 3) * mat4::translate2D(1, 1)));
+
+    // Changing a leaf does not affect its ancestors
+    t2->setMatrix(mat4::translate2D(2, 2));
+    check_true(!t1->isWorldTransformDirty());
+    check_true(t2->isWorldTransformDirty());
+
+    // Reparenting invalidates the moved subtree
+    t1->remove(t2);
+    check_true(t2->isWorldTransformDirty());
+    check_equal(t2->worldMatrix(), affine2d::translate(2, 2));
+    root->append(t2);
+    check_true(t2->isWorldTransformDirty());
+    check_equal(t2->worldMatrix(), affine2d::translate(102, 202));
+
+    // Moving a plain subtree reaches the transforms inside it
+    root->remove(plain);
+    check_true(t3dChild->isWorldTransformDirty());
+    check_equal(t1->worldMatrix(), affine2d::scale(2, 3));
+    t2->append(plain);
+    check_equal(t1->worldMatrix(), affine2d(mat4::translate2D(102, 202) * mat4::scale2D(2, 3)));
+
+    // A new parent is never confused with an old one, even when it reuses
+    // the old one's memory
+    TransformNode *parent = TransformNode::create(mat4::translate2D(1, 0));
+    TransformNode *child = TransformNode::create(mat4::translate2D(0, 1));
+    *parent << child;
+    check_equal(child->worldMatrix(), affine2d::translate(1, 1));
+    parent->remove(child);
+    parent->destroy();
+    TransformNode *newParent = TransformNode::create(mat4::translate2D(5, 0));
+    *newParent << child;
+    check_equal(child->worldMatrix(), affine2d::translate(5, 1));
+    newParent->destroy();
+
+    root->destroy();
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+class WorkerNode : public Node
+{
+public:
+    RENGINE_CONCURRENT_ALLOCATION_POOL_DECLARATION(WorkerNode);
+    int value = 0;
+};
+RENGINE_ALLOCATION_POOL_DEFINITION(WorkerNode);
+
+void tst_node_concurrentAllocator()
+{
+    const int threadCount = 4;
+    const int treeSize = 5000;
+
+    // Build subtrees on worker threads, churning the pool while at it.
+    std::vector<WorkerNode *> roots(threadCount);
+    std::vector<std::thread> threads;
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([t, &roots] {
+            WorkerNode *root = WorkerNode::create();
+            for (int i=0; i<treeSize; ++i) {
+                WorkerNode *n = WorkerNode::create();
+                n->value = i;
+                root->append(n);
+                if (i % 3 == 0) {
+                    WorkerNode *tmp = WorkerNode::create();
+                    tmp->destroy();
+                }
+            }
+            roots[t] = root;
+        }));
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    // The worker threads have exited, so their counts have been flushed.
+    AllocationPoolStatistics stats = WorkerNode::__allocation_pool_WorkerNode.statistics();
+    const unsigned temporaries = threadCount * ((treeSize + 2) / 3);
+    check_equal(stats.allocations, uint64_t(threadCount * (treeSize + 1) + temporaries));
+    check_equal(stats.frees, uint64_t(temporaries));
+    check_equal(stats.live, unsigned(threadCount * (treeSize + 1)));
+    check_true(stats.highWaterMark >= stats.live);
+    check_true(stats.capacity >= stats.live);
+
+    // Hand them over and verify them here; nodes must be unique.
+    std::vector<Node *> seen;
+    for (auto root : roots) {
+        check_true(root->__is_pool_allocated());
+        check_equal(root->childCount(), treeSize);
+        int expected = 0;
+        for (Node *c = root->child(); c; c = c->sibling()) {
+            check_equal(static_cast<WorkerNode *>(c)->value, expected);
+            ++expected;
+            seen.push_back(c);
+        }
+    }
+    std::sort(seen.begin(), seen.end());
+    check_true(std::adjacent_find(seen.begin(), seen.end()) == seen.end());
+
+    // Release on this thread, then reallocate without growing.
+    unsigned chunks = WorkerNode::__allocation_pool_WorkerNode.chunkCount();
+    for (auto root : roots)
+        root->destroy();
+    for (int i=0; i<treeSize; ++i)
+        WorkerNode::create()->destroy();
+    check_equal(WorkerNode::__allocation_pool_WorkerNode.chunkCount(), chunks);
 
     cout << __FUNCTION__ << ": ok" << endl;
 }
@@ -202,10 +602,16 @@ int main(int, char **)
 {
     tst_node_cast();
     tst_node_addRemoveParent();
+    tst_node_worldTransform();
     // tst_rectanglenode_geometry();
     // tst_node_injectEvict();
 
+    tst_node_insertBeforeAfter();
     tst_node_allocator();
+    tst_node_allocatorStatistics();
+    tst_node_recycler();
+    tst_node_arena();
+    tst_node_concurrentAllocator();
 
     return 0;
 }
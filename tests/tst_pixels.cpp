@@ -0,0 +1,186 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "test.h"
+
+#include <vector>
+
+// Every combination of color and alpha, in 65536 pixels where red runs
+// through all values, green and blue are variations of it and alpha
+// is the row.
+static std::vector<unsigned char> allColorsAndAlphas()
+{
+    std::vector<unsigned char> pixels(256 * 256 * 4);
+    for (unsigned a=0; a<256; ++a) {
+        for (unsigned c=0; c<256; ++c) {
+            unsigned char *p = &pixels[(a * 256 + c) * 4];
+            p[0] = c;
+            p[1] = 255 - c;
+            p[2] = (c * 7) & 0xff;
+            p[3] = a;
+        }
+    }
+    return pixels;
+}
+
+// Converting one pixel at a time always takes the plain C++ path, so it
+// checks that the SIMD path gives the same results.
+template <typename Convert>
+static void checkSameOnePixelAtATime(const std::vector<unsigned char> &source, const std::vector<unsigned char> &converted, Convert convert)
+{
+    std::vector<unsigned char> single(source);
+    for (unsigned i=0; i<source.size()/4; ++i)
+        convert(&single[i * 4], &source[i * 4], 1);
+    check_true(single == converted);
+}
+
+void tst_pixels_premultiply()
+{
+    const std::vector<unsigned char> source = allColorsAndAlphas();
+    const unsigned count = source.size() / 4;
+
+    std::vector<unsigned char> converted(source.size());
+    pixels::premultiply(converted.data(), source.data(), count);
+    for (unsigned i=0; i<count; ++i) {
+        const unsigned char *s = &source[i * 4];
+        const unsigned char *d = &converted[i * 4];
+        for (int c=0; c<3; ++c)
+            check_equal(int(d[c]), int(s[c] * s[3] / 255.0 + 0.5));
+        check_equal(d[3], s[3]);
+    }
+    checkSameOnePixelAtATime(source, converted, [] (unsigned char *d, const unsigned char *s, unsigned n) { pixels::premultiply(d, s, n); });
+
+    // In place, with a count which leaves a few pixels after the SIMD loop
+    std::vector<unsigned char> inPlace(source);
+    pixels::premultiply(inPlace.data(), 19);
+    check_true(memcmp(inPlace.data(), converted.data(), 19 * 4) == 0);
+    check_true(memcmp(inPlace.data() + 19 * 4, source.data() + 19 * 4, 4) == 0);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_pixels_unpremultiply()
+{
+    std::vector<unsigned char> source = allColorsAndAlphas();
+    const unsigned count = source.size() / 4;
+
+    std::vector<unsigned char> converted(source.size());
+    pixels::unpremultiply(converted.data(), source.data(), count);
+    for (unsigned i=0; i<count; ++i) {
+        const unsigned char *s = &source[i * 4];
+        const unsigned char *d = &converted[i * 4];
+        for (int c=0; c<3; ++c) {
+            const int expected = s[3] == 0 ? 0 : std::min(255, int(s[c] * 255.0 / s[3] + 0.5));
+            check_true(std::abs(d[c] - expected) <= 1);
+        }
+        check_equal(d[3], s[3]);
+    }
+    checkSameOnePixelAtATime(source, converted, [] (unsigned char *d, const unsigned char *s, unsigned n) { pixels::unpremultiply(d, s, n); });
+
+    // Premultiplied pixels with enough alpha survive the round trip
+    std::vector<unsigned char> roundTrip(source);
+    pixels::premultiply(roundTrip.data(), count);
+    pixels::unpremultiply(roundTrip.data(), count);
+    for (unsigned i=0; i<count; ++i) {
+        if (source[i * 4 + 3] == 255)
+            check_true(memcmp(&roundTrip[i * 4], &source[i * 4], 4) == 0);
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_pixels_swapRedAndBlue()
+{
+    const std::vector<unsigned char> source = allColorsAndAlphas();
+    const unsigned count = source.size() / 4;
+
+    std::vector<unsigned char> converted(source.size());
+    pixels::swapRedAndBlue(converted.data(), source.data(), count);
+    for (unsigned i=0; i<count; ++i) {
+        check_equal(converted[i * 4 + 0], source[i * 4 + 2]);
+        check_equal(converted[i * 4 + 1], source[i * 4 + 1]);
+        check_equal(converted[i * 4 + 2], source[i * 4 + 0]);
+        check_equal(converted[i * 4 + 3], source[i * 4 + 3]);
+    }
+    checkSameOnePixelAtATime(source, converted, [] (unsigned char *d, const unsigned char *s, unsigned n) { pixels::swapRedAndBlue(d, s, n); });
+
+    // Swapping twice in place gives back the original
+    pixels::swapRedAndBlue(converted.data(), count);
+    check_true(converted == source);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_pixels_fillAlpha()
+{
+    const std::vector<unsigned char> source = allColorsAndAlphas();
+    const unsigned count = source.size() / 4;
+
+    std::vector<unsigned char> converted(source.size());
+    pixels::fillAlpha(converted.data(), source.data(), count);
+    for (unsigned i=0; i<count; ++i) {
+        check_true(memcmp(&converted[i * 4], &source[i * 4], 3) == 0);
+        check_equal(converted[i * 4 + 3], 255);
+    }
+
+    std::vector<unsigned char> inPlace(source);
+    pixels::fillAlpha(inPlace.data(), 7);
+    check_true(memcmp(inPlace.data(), converted.data(), 7 * 4) == 0);
+    check_true(memcmp(inPlace.data() + 7 * 4, source.data() + 7 * 4, 4) == 0);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_pixels_flipLines()
+{
+    for (unsigned height : { 0u, 1u, 4u, 5u }) {
+        const unsigned bytesPerLine = 12;
+        std::vector<unsigned char> source(bytesPerLine * height);
+        for (unsigned i=0; i<source.size(); ++i)
+            source[i] = i;
+
+        std::vector<unsigned char> flipped(source.size());
+        pixels::flipLines(flipped.data(), source.data(), bytesPerLine, height);
+        for (unsigned y=0; y<height; ++y)
+            check_true(memcmp(&flipped[y * bytesPerLine], &source[(height - y - 1) * bytesPerLine], bytesPerLine) == 0);
+
+        std::vector<unsigned char> inPlace(source);
+        pixels::flipLines(inPlace.data(), bytesPerLine, height);
+        check_true(inPlace == flipped);
+    }
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    tst_pixels_premultiply();
+    tst_pixels_unpremultiply();
+    tst_pixels_swapRedAndBlue();
+    tst_pixels_fillAlpha();
+    tst_pixels_flipLines();
+    return 0;
+}
@@ -209,6 +209,132 @@ public:
     }
 };
 
+class AsyncTextures : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "AsyncTextures"; }
+    Node *build() override {
+        // A 16x16 image, red on the left and transparent on the right
+        loader.setDecoder([] (const std::string &, DecodedImage *image) {
+            image->width = image->height = 16;
+            image->pixels = (unsigned char *) calloc(16 * 16, 4);
+            for (int y=0; y<16; ++y) {
+                for (int x=0; x<8; ++x) {
+                    image->pixels[(y * 16 + x) * 4] = 0xff;
+                    image->pixels[(y * 16 + x) * 4 + 3] = 0xff;
+                }
+            }
+            return true;
+        });
+        texture = loader.load("red");
+        while (loader.isLoading() && texture->state() == AsyncTexture::Loading) {
+            // Two rows per call
+            loader.setUploadBudget(16 * 4 * 2);
+            loader.upload();
+            ++uploads;
+        }
+        check_equal(texture->state(), AsyncTexture::Ready);
+        check_equal(texture->size(), vec2(16, 16));
+        check_true(texture->textureId() != 0);
+
+        pending = loader.load("red");
+        check_equal(pending->textureId(), 0u);
+
+        Node *root = Node::create();
+        *root << TextureNode::create(rect2d::fromXywh(10, 10, 16, 16), texture)
+              << TextureNode::create(rect2d::fromXywh(40, 10, 16, 16), pending);
+        return root;
+    }
+
+    void check() override {
+        check_true(uploads >= 8);
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(17, 25, vec4(1, 0, 0, 1));
+        check_pixel(18, 10, vec4(0, 0, 0, 1));
+        check_pixelsOutside(rect2d::fromXywh(10, 10, 8, 16), vec4(0, 0, 0, 1));
+        check_pixel(40, 10, vec4(0, 0, 0, 1));
+        delete texture;
+        delete pending;
+    }
+
+    TextureLoader loader;
+    AsyncTexture *texture = 0;
+    AsyncTexture *pending = 0;
+    int uploads = 0;
+};
+
+class HiddenSubtrees : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "HiddenSubtrees"; }
+    Node *build() override {
+        Node *root = Node::create();
+        visible = RectangleNode::create(rect2d::fromXywh(10, 10, 10, 10), vec4(1, 0, 0, 1));
+        offscreen = RectangleNode::create(rect2d::fromXywh(-20, 10, 10, 10), vec4(1, 0, 0, 1));
+        transparent = OpacityNode::create(0);
+        belowTransparent = RectangleNode::create(rect2d::fromXywh(30, 10, 10, 10), vec4(0, 1, 0, 1));
+        movedOffscreen = TransformNode::create(mat4::translate2D(10000, 0));
+
+        *root
+            << visible
+            << offscreen
+            << &(*transparent << belowTransparent)
+            << &(*movedOffscreen << RectangleNode::create(rect2d::fromXywh(0, 0, 10, 10), vec4(0, 0, 1, 1)))
+
+            // An empty layer, as everything below it is transparent
+            << &(*OpacityNode::create(0.5)
+                 << &(*OpacityNode::create(0)
+                      << RectangleNode::create(rect2d::fromXywh(50, 10, 10, 10), vec4(0, 0, 1, 1))
+                     )
+                )
+            ;
+        this->root = root;
+        return root;
+    }
+
+    void check() override {
+        check_pixel(10, 10, vec4(1, 0, 0, 1));
+        check_pixel(30, 10, vec4(0, 0, 0, 1));
+        check_pixel(50, 10, vec4(0, 0, 0, 1));
+
+        check_true(visible->renderedFrame() > 0);
+        check_equal(root->renderedFrame(), visible->renderedFrame());
+        check_equal(offscreen->renderedFrame(), 0u);
+        check_equal(transparent->renderedFrame(), visible->renderedFrame());
+        check_equal(belowTransparent->renderedFrame(), 0u);
+        check_equal(movedOffscreen->renderedFrame(), 0u);
+    }
+
+    Node *root;
+    Node *visible;
+    Node *offscreen;
+    Node *transparent;
+    Node *belowTransparent;
+    Node *movedOffscreen;
+};
+
+class TransparentScene : public StaticRenderTest
+{
+public:
+    const char *name() const override { return "TransparentScene"; }
+    Node *build() override {
+        // Covers what the earlier tests drew, so leftovers would show
+        vec2 size = surface()->size();
+        return &(*OpacityNode::create(0)
+                 << RectangleNode::create(rect2d::fromXywh(0, 0, size.x, size.y), vec4(1, 0, 0, 1))
+                );
+    }
+
+    void check() override {
+        // The renderer's default fillColor()
+        for (int y=0; y<m_h; ++y) {
+            for (int x=0; x<m_w; ++x) {
+                check_pixel(x, y, vec4(0, 0, 0, 1));
+            }
+        }
+    }
+};
+
 int main(int argc, char *argv[])
 {
     TestBase testBase;
@@ -216,6 +342,9 @@ int main(int argc, char *argv[])
     testBase.addTest(new ColorsAndPositions());
     testBase.addTest(new TexturesOnViewportEdge());
     testBase.addTest(new OpacityTextures());
+    testBase.addTest(new HiddenSubtrees());
+    testBase.addTest(new TransparentScene());
+    testBase.addTest(new AsyncTextures());
 
     std::unique_ptr<Backend> backend(Backend::get());
     std::unique_ptr<Surface>  surface(backend->createSurface(&testBase));
@@ -0,0 +1,324 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "test.h"
+
+#include <math.h>
+#include <vector>
+
+using namespace texturecompression;
+
+static const Texture::Format compressedFormats[] = {
+    Texture::ETC2_RGB8, Texture::ETC2_RGBA8, Texture::S3TC_DXT1, Texture::S3TC_DXT5
+};
+
+// RGBA at (x, y) of a 4x4 block
+static bool blockPixelIs(const unsigned char *rgba, int x, int y, int r, int g, int b, int a)
+{
+    const unsigned char *p = rgba + (y * 4 + x) * 4;
+    return p[0] == r && p[1] == g && p[2] == b && p[3] == a;
+}
+
+void tst_textureCompression_sizes()
+{
+    check_equal(blockSize(Texture::RGBA_32), 0u);
+    check_equal(blockSize(Texture::ETC2_RGB8), 8u);
+    check_equal(blockSize(Texture::S3TC_DXT5), 16u);
+
+    check_equal(dataSize(Texture::RGBA_32, 5, 3), 60u);
+    check_equal(dataSize(Texture::ETC2_RGB8, 8, 8), 32u);
+    check_equal(dataSize(Texture::ETC2_RGBA8, 8, 8), 64u);
+    check_equal(dataSize(Texture::S3TC_DXT1, 5, 3), 16u);     // 2x1 blocks
+    check_equal(dataSize(Texture::ASTC_4x4, 1, 1), 16u);
+    check_equal(dataSize(Texture::RGBA_32, maxImageSize, maxImageSize), size_t(maxImageSize) * maxImageSize * 4);
+
+    // Sizes which are empty or too large have no data size
+    check_equal(dataSize(Texture::RGBA_32, 0, 4), 0u);
+    check_equal(dataSize(Texture::RGBA_32, -4, -4), 0u);
+    check_equal(dataSize(Texture::S3TC_DXT1, maxImageSize + 1, 4), 0u);
+    check_equal(dataSize(Texture::S3TC_DXT1, 131072, 131072), 0u);
+
+    for (Texture::Format format : compressedFormats) {
+        Texture::Format mapped;
+        check_true(formatFromGLInternalFormat(glInternalFormat(format), &mapped));
+        check_equal(mapped, format);
+    }
+    Texture::Format unknown;
+    check_true(!formatFromGLInternalFormat(GL_RGBA, &unknown));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// The expected pixels are what Mesa's llvmpipe sampled from the same blocks
+void tst_textureCompression_etc2()
+{
+    unsigned char rgba[16 * 4];
+
+    const unsigned char individual[] = { 0xa0, 0x2d, 0xec, 0x7d, 0x84, 0x22, 0x8c, 0x81 };
+    decodeETC2Block(individual, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 212, 76, 255, 255));
+    check_true(blockPixelIs(rgba, 3, 0, 183, 47, 251, 255));
+    check_true(blockPixelIs(rgba, 0, 3, 47, 255, 251, 255));
+    check_true(blockPixelIs(rgba, 3, 3, 0, 38, 21, 255));
+
+    const unsigned char differential[] = { 0x99, 0xbf, 0x50, 0x5b, 0x51, 0xb7, 0x0d, 0x4c };
+    decodeETC2Block(differential, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 147, 180, 73, 255));
+    check_true(blockPixelIs(rgba, 0, 3, 255, 255, 188, 255));
+    check_true(blockPixelIs(rgba, 3, 3, 198, 214, 115, 255));
+
+    const unsigned char t[] = { 0x0c, 0x6c, 0x96, 0x67, 0x84, 0x22, 0x0b, 0xd3 };
+    decodeETC2Block(t, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 169, 118, 118, 255));
+    check_true(blockPixelIs(rgba, 3, 0, 68, 102, 204, 255));
+    check_true(blockPixelIs(rgba, 3, 3, 153, 102, 102, 255));
+
+    const unsigned char h[] = { 0xf5, 0x0c, 0x15, 0x5a, 0x6f, 0x52, 0x05, 0x36 };
+    decodeETC2Block(h, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 244, 176, 142, 255));
+    check_true(blockPixelIs(rgba, 3, 3, 244, 176, 142, 255));
+
+    const unsigned char planar[] = { 0xf5, 0x31, 0x07, 0x96, 0x4f, 0xf3, 0x2c, 0x78 };
+    decodeETC2Block(planar, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 235, 177, 158, 255));
+    check_true(blockPixelIs(rgba, 3, 0, 89, 103, 228, 255));
+    check_true(blockPixelIs(rgba, 0, 3, 135, 118, 210, 255));
+    check_true(blockPixelIs(rgba, 3, 3, 0, 44, 255, 255));
+
+    const unsigned char eac[] = { 0x92, 0x32, 0xb5, 0x01, 0x42, 0xbe, 0x6c, 0x14,
+                                  0x11, 0x0d, 0x49, 0xce, 0x70, 0x25, 0xc3, 0x8c };
+    check_true(decompress(Texture::ETC2_RGBA8, 4, 4, eac, rgba));
+    check_true(blockPixelIs(rgba, 0, 0, 176, 74, 176, 158));
+    check_true(blockPixelIs(rgba, 3, 0, 176, 74, 176, 167));
+    check_true(blockPixelIs(rgba, 0, 3, 11, 11, 147, 140));
+    check_true(blockPixelIs(rgba, 3, 3, 11, 11, 147, 149));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_textureCompression_s3tc()
+{
+    unsigned char rgba[16 * 4];
+
+    // Red and blue endpoints, with the four indices along the first row
+    const unsigned char fourColors[] = { 0x00, 0xf8, 0x1f, 0x00, 0xe4, 0x00, 0x00, 0x00 };
+    decodeS3TCColorBlock(fourColors, rgba);
+    check_true(blockPixelIs(rgba, 0, 0, 255, 0, 0, 255));
+    check_true(blockPixelIs(rgba, 1, 0, 0, 0, 255, 255));
+    check_true(blockPixelIs(rgba, 2, 0, 170, 0, 85, 255));
+    check_true(blockPixelIs(rgba, 3, 0, 85, 0, 170, 255));
+    check_true(blockPixelIs(rgba, 0, 1, 255, 0, 0, 255));
+
+    // Swapped endpoints mean three colors and black in DXT1, but not in DXT5
+    const unsigned char threeColors[] = { 0x1f, 0x00, 0x00, 0xf8, 0xe4, 0x00, 0x00, 0x00 };
+    decodeS3TCColorBlock(threeColors, rgba);
+    check_true(blockPixelIs(rgba, 2, 0, 127, 0, 127, 255));
+    check_true(blockPixelIs(rgba, 3, 0, 0, 0, 0, 255));
+    decodeS3TCColorBlock(threeColors, rgba, true);
+    check_true(blockPixelIs(rgba, 3, 0, 170, 0, 85, 255));
+
+    // Alpha 255 to 10 in eight steps, with indices 0, 1, 2 and 7 first
+    const unsigned char eightAlphas[] = { 255, 10, 0x88, 0x0e, 0, 0, 0, 0 };
+    decodeDXT5AlphaBlock(eightAlphas, rgba);
+    check_equal(rgba[0 * 4 + 3], 255);
+    check_equal(rgba[1 * 4 + 3], 10);
+    check_equal(rgba[2 * 4 + 3], 220);
+    check_equal(rgba[3 * 4 + 3], 45);
+    check_equal(rgba[4 * 4 + 3], 255);
+
+    // Increasing endpoints give six steps plus 0 and 255, with indices
+    // 0, 0, 2 and 6 first
+    const unsigned char sixAlphas[] = { 10, 255, 0x80, 0x0c, 0, 0, 0, 0 };
+    decodeDXT5AlphaBlock(sixAlphas, rgba);
+    check_equal(rgba[2 * 4 + 3], 59);
+    check_equal(rgba[3 * 4 + 3], 0);
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+// Peak signal to noise ratio, in dB, over all channels
+static double psnr(const std::vector<unsigned char> &a, const std::vector<unsigned char> &b)
+{
+    double squaredError = 0;
+    for (unsigned i=0; i<a.size(); ++i)
+        squaredError += (double(a[i]) - b[i]) * (double(a[i]) - b[i]);
+    const double mse = squaredError / a.size();
+    return mse > 0 ? 10 * log10(255 * 255 / mse) : 99;
+}
+
+void tst_textureCompression_roundTrip()
+{
+    // Smooth gradients in an odd size, so there are partial blocks
+    const int w = 37, h = 21;
+    std::vector<unsigned char> rgba(w * h * 4);
+    for (int y=0; y<h; ++y) {
+        for (int x=0; x<w; ++x) {
+            unsigned char *p = &rgba[(y * w + x) * 4];
+            p[0] = x * 255 / (w - 1);
+            p[1] = y * 255 / (h - 1);
+            p[2] = 128 + 100 * sin((x + y) * 0.2);
+            p[3] = 255 - (x + y) * 4;
+        }
+    }
+    pixels::premultiply(rgba.data(), w * h);
+
+    for (Texture::Format format : compressedFormats) {
+        std::vector<unsigned char> source(rgba);
+        if (!(format & Texture::AlphaFormatMask))
+            pixels::fillAlpha(source.data(), w * h);
+
+        std::vector<unsigned char> blocks(dataSize(format, w, h));
+        check_true(compress(format, w, h, source.data(), blocks.data()));
+        std::vector<unsigned char> decoded(w * h * 4);
+        check_true(decompress(format, w, h, blocks.data(), decoded.data()));
+        check_true(psnr(source, decoded) > 30);
+
+        // Opaque stays opaque
+        for (int i=0; i<w * h; ++i) {
+            if (source[i * 4 + 3] == 255)
+                check_equal(decoded[i * 4 + 3], 255);
+        }
+    }
+
+    // Opaque white and transparent black are exact
+    for (Texture::Format format : compressedFormats) {
+        for (unsigned char value : { 255, 0 }) {
+            if (value == 0 && !(format & Texture::AlphaFormatMask))
+                continue;
+            std::vector<unsigned char> flat(8 * 8 * 4, value);
+            std::vector<unsigned char> blocks(dataSize(format, 8, 8));
+            compress(format, 8, 8, flat.data(), blocks.data());
+            std::vector<unsigned char> decoded(flat.size());
+            decompress(format, 8, 8, blocks.data(), decoded.data());
+            check_true(decoded == flat);
+        }
+    }
+
+    // There is no ASTC encoder or decoder
+    unsigned char block[16];
+    check_true(!compress(Texture::ASTC_4x4, 4, 4, rgba.data(), block));
+    check_true(!decompress(Texture::ASTC_4x4, 4, 4, block, rgba.data()));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_textureCompression_ktx()
+{
+    std::vector<unsigned char> blocks(dataSize(Texture::ETC2_RGBA8, 6, 9));
+    for (unsigned i=0; i<blocks.size(); ++i)
+        blocks[i] = i * 7;
+    std::vector<unsigned char> file = writeKTX(Texture::ETC2_RGBA8, 6, 9, blocks.data());
+    check_equal(file.size() % 4, 0u);
+
+    KTXImage image;
+    check_true(parseKTX(file.data(), file.size(), &image));
+    check_equal(image.format, Texture::ETC2_RGBA8);
+    check_equal(image.width, 6);
+    check_equal(image.height, 9);
+    check_equal(image.size, blocks.size());
+    check_true(memcmp(image.data, blocks.data(), blocks.size()) == 0);
+
+    // Truncated files and other magic are rejected
+    check_true(!parseKTX(file.data(), file.size() - 8, &image));
+    std::vector<unsigned char> png(file);
+    png[1] = 'P';
+    check_true(!parseKTX(png.data(), png.size(), &image));
+
+    // ETC1 is read as ETC2, which can decode it
+    std::vector<unsigned char> etc1 = writeKTX(Texture::ETC2_RGB8, 4, 4, blocks.data());
+    const unsigned etc1Format = GL_ETC1_RGB8_OES;
+    memcpy(&etc1[12 + 4 * 4], &etc1Format, 4);
+    check_true(parseKTX(etc1.data(), etc1.size(), &image));
+    check_equal(image.format, Texture::ETC2_RGB8);
+
+    // Files written on the other endianness
+    std::vector<unsigned char> swapped(file);
+    for (unsigned offset=12; offset<12 + 13 * 4; offset+=4)
+        std::reverse(&swapped[offset], &swapped[offset + 4]);
+    const unsigned imageSizeOffset = 12 + 13 * 4 + 28;
+    std::reverse(&swapped[imageSizeOffset], &swapped[imageSizeOffset + 4]);
+    check_true(parseKTX(swapped.data(), swapped.size(), &image));
+    check_equal(image.width, 6);
+    check_equal(image.size, blocks.size());
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_textureCompression_malformedKTX()
+{
+    std::vector<unsigned char> blocks(16);
+    std::vector<unsigned char> file = writeKTX(Texture::S3TC_DXT1, 8, 4, blocks.data());
+    KTXImage image;
+    check_true(parseKTX(file.data(), file.size(), &image));
+
+    const unsigned widthOffset = 12 + 6 * 4;
+    const unsigned heightOffset = 12 + 7 * 4;
+    const unsigned keyValueOffset = 12 + 12 * 4;
+    const unsigned imageSizeOffset = 12 + 13 * 4 + 28;
+    auto patched = [&] (unsigned offset, unsigned value) {
+        std::vector<unsigned char> result(file);
+        memcpy(&result[offset], &value, 4);
+        return result;
+    };
+
+    // A header claiming an image whose data size wraps around to 0 in
+    // 32 bits must not get past the 16 byte payload.
+    std::vector<unsigned char> huge = patched(widthOffset, 131072);
+    const unsigned hugeSize = 131072;
+    memcpy(&huge[heightOffset], &hugeSize, 4);
+    check_true(!parseKTX(huge.data(), huge.size(), &image));
+
+    // Sizes within the limits, but with too little data
+    std::vector<unsigned char> large = patched(widthOffset, maxImageSize);
+    check_true(!parseKTX(large.data(), large.size(), &image));
+    std::vector<unsigned char> tooLarge = patched(heightOffset, maxImageSize + 4);
+    check_true(!parseKTX(tooLarge.data(), tooLarge.size(), &image));
+
+    // Empty and negative sizes
+    std::vector<unsigned char> empty = patched(widthOffset, 0);
+    check_true(!parseKTX(empty.data(), empty.size(), &image));
+    std::vector<unsigned char> negative = patched(heightOffset, 0xfffffffc);
+    check_true(!parseKTX(negative.data(), negative.size(), &image));
+
+    // Key/value data or an image size pointing past the end of the file
+    std::vector<unsigned char> keyValues = patched(keyValueOffset, 0xfffffffc);
+    check_true(!parseKTX(keyValues.data(), keyValues.size(), &image));
+    std::vector<unsigned char> imageSize = patched(imageSizeOffset, 8);
+    check_true(!parseKTX(imageSize.data(), imageSize.size(), &image));
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    tst_textureCompression_sizes();
+    tst_textureCompression_etc2();
+    tst_textureCompression_s3tc();
+    tst_textureCompression_roundTrip();
+    tst_textureCompression_ktx();
+    tst_textureCompression_malformedKTX();
+    return 0;
+}
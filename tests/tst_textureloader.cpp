@@ -0,0 +1,205 @@
+/*
+    Copyright (c) 2015, Gunnar Sletta <gunnar@sletta.org>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+    ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+    ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "rengine.h"
+#include "test.h"
+
+#include <atomic>
+#include <thread>
+
+// Decodes "<width>x<height>" into an image of that size where every pixel
+// is 50% transparent white. "slow" sleeps first, anything else fails.
+static std::atomic<int> decodeCount(0);
+
+static bool decodeTestImage(const std::string &source, DecodedImage *image)
+{
+    ++decodeCount;
+    if (source == "slow") {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        image->width = image->height = 1;
+    } else if (sscanf(source.c_str(), "%dx%d", &image->width, &image->height) != 2) {
+        return false;
+    }
+    image->pixels = (unsigned char *) malloc(image->width * image->height * 4);
+    memset(image->pixels, 0xff, image->width * image->height * 4);
+    for (int i=0; i<image->width * image->height; ++i)
+        image->pixels[i * 4 + 3] = 0x80;
+    return true;
+}
+
+// Decodes into a 4x4 white ETC2_RGB8 image
+static bool decodeCompressedImage(const std::string &, DecodedImage *image)
+{
+    ++decodeCount;
+    unsigned char white[16 * 4];
+    memset(white, 0xff, sizeof(white));
+    image->width = image->height = 4;
+    image->format = Texture::ETC2_RGB8;
+    image->pixels = (unsigned char *) malloc(8);
+    texturecompression::compress(Texture::ETC2_RGB8, 4, 4, white, image->pixels);
+    return true;
+}
+
+static void waitForDecoding(TextureLoader *loader, unsigned count)
+{
+    while (decodeCount < int(count))
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    // The last one may still be on its way to the upload queue
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+void tst_textureLoader_failures()
+{
+    decodeCount = 0;
+    TextureLoader loader(2);
+    loader.setDecoder(decodeTestImage);
+
+    AsyncTexture *broken = loader.load("not an image");
+    check_equal(broken->state(), AsyncTexture::Loading);
+    check_equal(broken->textureId(), 0u);
+    check_true(loader.isLoading());
+    waitForDecoding(&loader, 1);
+
+    // Failures don't touch GL, so they can be checked without a context
+    check_true(!loader.upload());
+    check_equal(broken->state(), AsyncTexture::Failed);
+    check_equal(broken->textureId(), 0u);
+    check_true(!loader.isLoading());
+    delete broken;
+
+    // Deleting a texture cancels its load, wherever it is
+    AsyncTexture *slow = loader.load("slow");
+    AsyncTexture *slow2 = loader.load("slow");
+    AsyncTexture *queued[8];
+    for (int i=0; i<8; ++i)
+        queued[i] = loader.load("slow");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    delete slow;
+    delete slow2;
+    for (int i=0; i<8; ++i)
+        delete queued[i];
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    check_true(!loader.isLoading());
+    check_true(decodeCount <= 3);
+
+    // Images larger than the GPU supports fail
+    decodeCount = 0;
+    loader.setMaxTextureSize(8);
+    check_equal(loader.maxTextureSize(), 8);
+    AsyncTexture *large = loader.load("16x4");
+    waitForDecoding(&loader, 1);
+    check_true(!loader.upload());
+    check_equal(large->state(), AsyncTexture::Failed);
+    delete large;
+    loader.setMaxTextureSize(1 << 20);
+    check_equal(loader.maxTextureSize(), texturecompression::maxImageSize);
+
+    // Textures still loading when the loader goes away are left as failed
+    AsyncTexture *orphan;
+    {
+        TextureLoader shortLived(1);
+        shortLived.setDecoder(decodeTestImage);
+        orphan = shortLived.load("not an image");
+    }
+    check_equal(orphan->state(), AsyncTexture::Failed);
+    delete orphan;
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_textureLoader_compressed()
+{
+    // Without a GL context, the uploads do nothing, but the textures still
+    // end up ready with the format that was uploaded.
+    decodeCount = 0;
+    TextureLoader loader(1);
+    loader.setDecoder(decodeCompressedImage);
+
+    // Formats the GPU can't sample are decompressed
+    AsyncTexture *decompressed = loader.load("white");
+    waitForDecoding(&loader, 1);
+    check_true(!loader.upload());
+    check_equal(decompressed->state(), AsyncTexture::Ready);
+    check_equal(decompressed->format(), Texture::RGBx_32);
+    check_equal(decompressed->size(), vec2(4, 4));
+
+    // The others are uploaded as they are
+    loader.setCompressedFormats(std::vector<Texture::Format>(1, Texture::ETC2_RGB8));
+    AsyncTexture *compressed = loader.load("white");
+    waitForDecoding(&loader, 2);
+    check_true(!loader.upload());
+    check_equal(compressed->state(), AsyncTexture::Ready);
+    check_equal(compressed->format(), Texture::ETC2_RGB8);
+    check_true(compressed->isCompressed());
+
+    delete decompressed;
+    delete compressed;
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+void tst_textureLoader_decodedCallback()
+{
+    decodeCount = 0;
+    std::atomic<int> decodedCount(0);
+    TextureLoader loader(1);
+    loader.setDecoder(decodeTestImage);
+    loader.setDecodedCallback([&decodedCount] { ++decodedCount; });
+
+    // While the image is only being decoded, there is nothing to upload
+    // and no reason to render another frame.
+    AsyncTexture *slow = loader.load("slow");
+    check_true(!loader.upload());
+    check_true(loader.isLoading());
+    check_equal(slow->state(), AsyncTexture::Loading);
+
+    // The worker reports when there is
+    while (decodedCount == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    check_equal(decodedCount.load(), 1);
+    check_true(!loader.upload());
+    check_equal(slow->state(), AsyncTexture::Ready);
+    check_true(!loader.isLoading());
+
+    // Cancelled loads have nothing to upload, so they don't report
+    AsyncTexture *cancelled = loader.load("slow");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    delete cancelled;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    check_equal(decodedCount.load(), 1);
+    check_true(!loader.isLoading());
+
+    delete slow;
+
+    cout << __FUNCTION__ << ": ok" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    tst_textureLoader_failures();
+    tst_textureLoader_compressed();
+    tst_textureLoader_decodedCallback();
+    return 0;
+}
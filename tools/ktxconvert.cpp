@@ -0,0 +1,99 @@
+#include "rengine.h"
+
+#include <cstdio>
+#include <cstring>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+using namespace rengine;
+using namespace std;
+
+/*
+    Converts images into KTX files with block compressed textures, which
+    take 4 bits per pixel for opaque images and 8 for ones with alpha,
+    rather than 32. The pixels are premultiplied, as rengine expects.
+
+    ETC2 is supported by OpenGL ES 3 and most mobile GPUs, S3TC (DXT1 and
+    DXT5) by desktop GPUs. rengine decompresses the format on the CPU where
+    the GPU cannot sample it, so either works everywhere.
+
+    Usage: ktxconvert [-etc2 | -s3tc] input.png output.ktx
+ */
+
+static const char *formatName(Texture::Format format)
+{
+    switch (format) {
+    case Texture::ETC2_RGB8: return "ETC2_RGB8";
+    case Texture::ETC2_RGBA8: return "ETC2_RGBA8";
+    case Texture::S3TC_DXT1: return "S3TC_DXT1";
+    case Texture::S3TC_DXT5: return "S3TC_DXT5";
+    default: return "unknown";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool s3tc = false;
+    int arg = 1;
+    if (arg < argc && argv[arg][0] == '-') {
+        s3tc = strcmp(argv[arg], "-s3tc") == 0;
+        if (!s3tc && strcmp(argv[arg], "-etc2") != 0)
+            argc = 0;
+        ++arg;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "Usage: ktxconvert [-etc2 | -s3tc] input.png output.ktx\n");
+        return 1;
+    }
+    const char *input = argv[arg];
+    const char *output = argv[arg + 1];
+
+    int width, height, n;
+    unsigned char *rgba = stbi_load(input, &width, &height, &n, 4);
+    if (!rgba) {
+        fprintf(stderr, "Failed to read '%s': %s\n", input, stbi_failure_reason());
+        return 1;
+    }
+    if (!texturecompression::isValidSize(width, height)) {
+        fprintf(stderr, "'%s' is %dx%d, larger than the supported %dx%d\n", input, width, height,
+                texturecompression::maxImageSize, texturecompression::maxImageSize);
+        return 1;
+    }
+    const unsigned count = width * height;
+    pixels::premultiply(rgba, count);
+
+    bool alpha = false;
+    for (unsigned i=0; i<count && !alpha; ++i)
+        alpha = rgba[i * 4 + 3] != 255;
+    const Texture::Format format = s3tc ? (alpha ? Texture::S3TC_DXT5 : Texture::S3TC_DXT1)
+                                        : (alpha ? Texture::ETC2_RGBA8 : Texture::ETC2_RGB8);
+
+    std::vector<unsigned char> blocks(texturecompression::dataSize(format, width, height));
+    texturecompression::compress(format, width, height, rgba, blocks.data());
+    std::vector<unsigned char> file = texturecompression::writeKTX(format, width, height, blocks.data());
+
+    FILE *f = fopen(output, "wb");
+    if (!f || fwrite(file.data(), 1, file.size(), f) != file.size()) {
+        fprintf(stderr, "Failed to write '%s'\n", output);
+        stbi_image_free(rgba);
+        return 1;
+    }
+    fclose(f);
+
+    // Report the quality, as the peak signal to noise ratio over all channels
+    std::vector<unsigned char> decoded(count * 4);
+    texturecompression::decompress(format, width, height, blocks.data(), decoded.data());
+    double squaredError = 0;
+    for (unsigned i=0; i<count * 4; ++i) {
+        const double d = double(decoded[i]) - rgba[i];
+        squaredError += d * d;
+    }
+    const double mse = squaredError / (count * 4);
+    printf("%s: %dx%d %s, %u -> %u bytes (%.1fx), PSNR %.1f dB\n",
+           output, width, height, formatName(format), count * 4, unsigned(blocks.size()),
+           count * 4.0 / blocks.size(), mse > 0 ? 10 * log10(255 * 255 / mse) : 99.0);
+
+    stbi_image_free(rgba);
+    return 0;
+}